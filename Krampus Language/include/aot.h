@@ -0,0 +1,207 @@
+#pragma once
+
+#include "jit.h"
+#include "data_types.h"
+
+#include <bit>
+
+
+// Ahead of time compilation. aot::emit translates a Chunk tree to C++ source with one function
+// per chunk, which works like the NativeCode of jit::compile: it is entered at any instruction it
+// translated, runs on the frame registers, and returns to the interpreter at the first instruction
+// it did not translate or whose operands it does not handle, before changing anything. Calls,
+// metamethods, errors, hooks and fuel therefore behave exactly as when the chunk is interpreted.
+// The host compiles the file into itself and calls the registration function it defines with the
+// same tree, which attaches the functions through aot::install.
+namespace kpl::aot
+{
+	// Function generated for one chunk and the digest of the chunk it was generated from.
+	struct CompiledChunk
+	{
+		jit::NativeCode::Entry entry;
+		UInt64 digest;
+	};
+
+	// Hash of everything the code generated for chunk depends on: its registers, instructions
+	// and constants. Nested chunks have their own.
+	UInt64 digest(const Chunk& chunk);
+
+	// Whether the function aot::emit generates for chunk runs the instruction at offset itself.
+	// Never for a chunk that is not verified.
+	bool translated(const Chunk& chunk, Offset offset);
+
+	// Writes a C++ source file to out with a function for root and every chunk nested in it, in
+	// depth first order, and a function bool name(kpl::Chunk& root) installing them on a tree
+	// assembled like root. name has to be a valid C++ identifier.
+	void emit(std::ostream& out, const Chunk& root, const std::string& name);
+
+	// Attaches chunks[0] to root and the others to the chunks nested in it, in the order emit
+	// wrote them, replacing any code the JIT generated for them. Returns false, changing
+	// nothing, if the tree does not have count chunks or one of them changed since it was
+	// emitted, is not verified or has breakpoints. jit::discard detaches the functions again.
+	bool install(Chunk& root, const CompiledChunk* chunks, Size count);
+}
+
+
+
+// Operations generated code inlines. Each handles only operands the interpreter handles without
+// calling out, computes exactly what Value::runtime_* computes for them and returns false, or -1
+// for a test, without touching any register for anything else.
+namespace kpl::aot::ops
+{
+	inline bool is_number(const Value& value) { return value.isInteger() || value.isFloat(); }
+	inline type::Float to_float(const Value& value) { return value.isInteger() ? static_cast<type::Float>(value.integral()) : value.floating(); }
+
+	template<typename _IntOp, typename _FloatOp>
+	inline bool arithmetic(Value& dst, const Value& left, const Value& right, _IntOp int_op, _FloatOp float_op)
+	{
+		if (left.isInteger() && right.isInteger())
+		{
+			dst = int_op(left.integral(), right.integral());
+			return true;
+		}
+		if (!is_number(left) || !is_number(right))
+			return false;
+
+		dst = float_op(to_float(left), to_float(right));
+		return true;
+	}
+
+	inline bool add(Value& dst, const Value& left, const Value& right)
+	{
+		return arithmetic(dst, left, right, [](type::Integer a, type::Integer b) { return static_cast<type::Integer>(static_cast<UInt64>(a) + static_cast<UInt64>(b)); }, [](type::Float a, type::Float b) { return a + b; });
+	}
+
+	inline bool sub(Value& dst, const Value& left, const Value& right)
+	{
+		return arithmetic(dst, left, right, [](type::Integer a, type::Integer b) { return static_cast<type::Integer>(static_cast<UInt64>(a) - static_cast<UInt64>(b)); }, [](type::Float a, type::Float b) { return a - b; });
+	}
+
+	inline bool mul(Value& dst, const Value& left, const Value& right)
+	{
+		return arithmetic(dst, left, right, [](type::Integer a, type::Integer b) { return static_cast<type::Integer>(static_cast<UInt64>(a) * static_cast<UInt64>(b)); }, [](type::Float a, type::Float b) { return a * b; });
+	}
+
+	inline bool div(Value& dst, const Value& left, const Value& right)
+	{
+		return arithmetic(dst, left, right,
+			[](type::Integer a, type::Integer b) { return static_cast<type::Float>(a) / static_cast<type::Float>(b); },
+			[](type::Float a, type::Float b) { return a / b; });
+	}
+
+	// Integer operands only. Divisors the interpreter traps on are left to it.
+	template<typename _IntOp>
+	inline bool integral(Value& dst, const Value& left, const Value& right, _IntOp int_op)
+	{
+		if (!left.isInteger() || !right.isInteger())
+			return false;
+
+		dst = int_op(left.integral(), right.integral());
+		return true;
+	}
+
+	inline bool idiv(Value& dst, const Value& left, const Value& right)
+	{
+		if (right.isInteger() && (right.integral() == 0 || right.integral() == -1))
+			return false;
+		return integral(dst, left, right, [](type::Integer a, type::Integer b) { return a / b; });
+	}
+
+	inline bool mod(Value& dst, const Value& left, const Value& right)
+	{
+		if (right.isInteger() && (right.integral() == 0 || right.integral() == -1))
+			return false;
+		return integral(dst, left, right, [](type::Integer a, type::Integer b) { return a % b; });
+	}
+
+	inline bool band(Value& dst, const Value& left, const Value& right) { return integral(dst, left, right, [](type::Integer a, type::Integer b) { return a & b; }); }
+	inline bool bor(Value& dst, const Value& left, const Value& right) { return integral(dst, left, right, [](type::Integer a, type::Integer b) { return a | b; }); }
+	inline bool bxor(Value& dst, const Value& left, const Value& right) { return integral(dst, left, right, [](type::Integer a, type::Integer b) { return a ^ b; }); }
+
+	inline bool neg(Value& dst, const Value& operand)
+	{
+		if (operand.isInteger())
+			dst = static_cast<type::Integer>(0 - static_cast<UInt64>(operand.integral()));
+		else if (operand.isFloat())
+			dst = -operand.floating();
+		else return false;
+		return true;
+	}
+
+	inline bool logical_not(Value& dst, const Value& operand)
+	{
+		switch (operand.type())
+		{
+			case DataType::Null: dst = true; return true;
+			case DataType::Integer: dst = static_cast<type::Boolean>(!operand.integral()); return true;
+			case DataType::Float: dst = static_cast<type::Boolean>(!operand.floating()); return true;
+			case DataType::Boolean: dst = !operand.boolean(); return true;
+			default: return false;
+		}
+	}
+
+	// Numeric comparisons. Returns 1 or 0 for the result, or -1.
+	template<typename _Compare>
+	inline int compare(const Value& left, const Value& right, _Compare compare)
+	{
+		if (left.isInteger() && right.isInteger())
+			return compare(left.integral(), right.integral()) ? 1 : 0;
+		if (!is_number(left) || !is_number(right))
+			return -1;
+		return compare(to_float(left), to_float(right)) ? 1 : 0;
+	}
+
+	inline int eq(const Value& left, const Value& right) { return compare(left, right, [](auto a, auto b) { return a == b; }); }
+	inline int ne(const Value& left, const Value& right) { return compare(left, right, [](auto a, auto b) { return a != b; }); }
+	inline int gr(const Value& left, const Value& right) { return compare(left, right, [](auto a, auto b) { return a > b; }); }
+	inline int ls(const Value& left, const Value& right) { return compare(left, right, [](auto a, auto b) { return a < b; }); }
+	inline int ge(const Value& left, const Value& right) { return compare(left, right, [](auto a, auto b) { return a >= b; }); }
+	inline int le(const Value& left, const Value& right) { return compare(left, right, [](auto a, auto b) { return a <= b; }); }
+
+	// Spends the fuel of a backward jump. Returns false, spending nothing, if the interpreter has
+	// to take the jump and preempt.
+	inline bool spend_fuel(Int64* fuel)
+	{
+		if (*fuel <= 0)
+			return false;
+		--*fuel;
+		return true;
+	}
+
+	// FORLOOP on loop[0] index, loop[1] count or limit and loop[2] step as prepared by FORPREP.
+	// Returns 1 if the body runs again, having spent the fuel of a backward jump to it, 0 if
+	// the loop is done and -1 if the interpreter has to run the instruction.
+	inline int for_loop(Value* loop, Int64* fuel, bool backward)
+	{
+		if (loop[0].isInteger() && loop[1].isInteger() && loop[2].isInteger())
+		{
+			const UInt64 count = static_cast<UInt64>(loop[1].integral());
+			if (count == 0)
+				return 0;
+			if (backward && !spend_fuel(fuel))
+				return -1;
+
+			const type::Integer index = static_cast<type::Integer>(static_cast<UInt64>(loop[0].integral()) + static_cast<UInt64>(loop[2].integral()));
+			loop[0] = index;
+			loop[1] = static_cast<type::Integer>(count - 1);
+			loop[3] = index;
+			return 1;
+		}
+
+		if (loop[0].isFloat() && loop[1].isFloat() && loop[2].isFloat())
+		{
+			const type::Float step = loop[2].floating();
+			const type::Float index = loop[0].floating() + step;
+			if (step > 0 ? index > loop[1].floating() : index < loop[1].floating())
+				return 0;
+			if (backward && !spend_fuel(fuel))
+				return -1;
+
+			loop[0] = index;
+			loop[3] = index;
+			return 1;
+		}
+
+		return -1;
+	}
+}
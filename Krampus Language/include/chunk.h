@@ -6,6 +6,25 @@
 
 namespace kpl
 {
+	class Chunk;
+
+	namespace jit
+	{
+		class NativeCode;
+		class LoopTraces;
+
+		bool compile(Chunk& chunk);
+		void discard(Chunk& chunk);
+		void record_loop(Chunk& chunk, Offset head, Offset end);
+	}
+
+	namespace aot
+	{
+		struct CompiledChunk;
+
+		bool install(Chunk& root, const CompiledChunk* chunks, Size count);
+	}
+
 	class ChunkConstant
 	{
 	public:
@@ -34,6 +53,11 @@ namespace kpl
 
 		inline Type type() const { return _type; }
 
+		// Payload of a constant of the matching type().
+		inline Int64 integral() const { return _value.integral; }
+		inline double floating() const { return _value.floating; }
+		inline std::string_view string() const { return { _value.string, _value.string_len }; }
+
 		ChunkConstant(const char* string);
 		ChunkConstant(const char* string, Size count);
 		ChunkConstant(const std::string& string);
@@ -52,6 +76,29 @@ namespace kpl
 
 
 
+	// Cases of one SWITCH jump table: Integer or String keys and the instruction each jumps to.
+	// A key matching no case jumps to default_target. Keys of any other type never match.
+	struct ChunkSwitch
+	{
+		std::vector<std::pair<ChunkConstant, Offset>> cases;
+		Offset default_target;
+	};
+
+
+
+	// Try region of a Chunk: an error raised by an instruction in [start, end) jumps to target
+	// with the error value in R(reg). Regions are searched in order, so a region nested in
+	// another has to come first.
+	struct ExceptionHandler
+	{
+		Offset start;
+		Offset end;
+		Offset target;
+		UInt8 reg;
+	};
+
+
+
 	class ChunkBuilder
 	{
 	private:
@@ -59,6 +106,8 @@ namespace kpl
 		std::vector<ChunkConstant> _constants;
 		std::vector<Chunk*> _chunks;
 		std::vector<inst::Instruction> _instructions;
+		std::vector<ChunkSwitch> _switches;
+		std::vector<ExceptionHandler> _handlers;
 		UInt8 _registers;
 
 	public:
@@ -75,6 +124,8 @@ namespace kpl
 			_constants{},
 			_chunks{},
 			_instructions{},
+			_switches{},
+			_handlers{},
 			_registers{ 0 }
 		{}
 
@@ -87,6 +138,13 @@ namespace kpl
 		inline ChunkBuilder& instructions(const std::vector<inst::Instruction>& instructions) { return _instructions = instructions, *this; }
 		inline ChunkBuilder& instructions(std::vector<inst::Instruction>&& instructions) { return _instructions = std::move(instructions), *this; }
 
+		// Jump tables of the SWITCH instructions, which name them by their index in switches.
+		inline ChunkBuilder& switches(const std::vector<ChunkSwitch>& switches) { return _switches = switches, *this; }
+		inline ChunkBuilder& switches(std::vector<ChunkSwitch>&& switches) { return _switches = std::move(switches), *this; }
+
+		inline ChunkBuilder& handlers(const std::vector<ExceptionHandler>& handlers) { return _handlers = handlers, *this; }
+		inline ChunkBuilder& handlers(std::vector<ExceptionHandler>&& handlers) { return _handlers = std::move(handlers), *this; }
+
 		inline ChunkBuilder& registers(unsigned int count) { return _registers = static_cast<UInt8>(utils::clamp(count, 0, 255)), *this; }
 
 
@@ -102,14 +160,135 @@ namespace kpl
 		inline ChunkBuilder& operator<< (const std::vector<inst::Instruction>& right) { return instructions(right); }
 		inline ChunkBuilder& operator<< (std::vector<inst::Instruction>&& right) { return instructions(std::move(right)); }
 
+		inline ChunkBuilder& operator<< (const std::vector<ChunkSwitch>& right) { return switches(right); }
+		inline ChunkBuilder& operator<< (std::vector<ChunkSwitch>&& right) { return switches(std::move(right)); }
+
+		inline ChunkBuilder& operator<< (const std::vector<ExceptionHandler>& right) { return handlers(right); }
+		inline ChunkBuilder& operator<< (std::vector<ExceptionHandler>&& right) { return handlers(std::move(right)); }
+
 		inline ChunkBuilder& operator<< (unsigned int right) { return registers(right); }
 	};
 
 
 
 
+	// Inline cache of one GET_PROP, SET_PROP or INVOKE instruction with a constant property name.
+	// Grows from monomorphic to capacity entries and then stays megamorphic.
+	struct PropertyCache
+	{
+		static constexpr unsigned int capacity = 4;
+
+		struct Entry
+		{
+			const type::ObjectLayout* layout;	// Receiver layout of a class property, nullptr for an own property
+			UInt64 serial;						// Serial of the object holding the property
+			Value* slot;
+		};
+
+		Entry entries[capacity];
+		UInt8 size;
+		bool megamorphic;
+	};
+
+
+
+	// Jump table of one SWITCH instruction, built from a ChunkSwitch. Integer keys in
+	// [first, first + dense_count) index dense directly, which holds default_target where there
+	// is no case. All other cases go to an open-addressed table probed linearly from their hash.
+	struct SwitchTable
+	{
+		struct Entry
+		{
+			UInt64 hash;
+			Value key;			// Null in an empty slot
+			Offset target;
+		};
+
+		Offset default_target;
+		Int64 first;
+		Size dense_count;
+		Offset* dense;
+		Size mask;				// Capacity of entries minus one, a power of two
+		Entry* entries;			// nullptr if every case is dense
+
+		static inline UInt64 hash(Int64 key) { return static_cast<UInt64>(key) * 0x9e3779b97f4a7c15ULL; }
+		static inline UInt64 hash(const std::string& key) { return std::hash<std::string>{}(key); }
+
+		// Instruction a SWITCH on key jumps to. Keys compare like EQ on integers, floats and
+		// strings; any other key, an Object with an == operator included, takes the default.
+		inline Offset target(const Value& key) const
+		{
+			switch (key.type())
+			{
+				case DataType::Integer:
+					return target(key.integral());
+
+				case DataType::Float: {
+					const type::Float value = key.floating();
+					if (value >= -0x1p63 && value < 0x1p63 && static_cast<type::Float>(static_cast<Int64>(value)) == value)
+						return target(static_cast<Int64>(value));
+					return default_target;
+				}
+
+				case DataType::String: {
+					if (!entries)
+						return default_target;
+
+					const std::string& string = key.string();
+					const UInt64 h = hash(string);
+					for (Size slot = h & mask;; slot = (slot + 1) & mask)
+					{
+						const Entry& entry = entries[slot];
+						if (entry.key.isNull())
+							return default_target;
+						if (entry.hash == h && entry.key.isString() && entry.key.string() == string)
+							return entry.target;
+					}
+				}
+
+				default:
+					return default_target;
+			}
+		}
+
+		inline Offset target(Int64 key) const
+		{
+			const UInt64 index = static_cast<UInt64>(key) - static_cast<UInt64>(first);
+			if (index < dense_count)
+				return dense[index];
+
+			if (!entries)
+				return default_target;
+
+			const UInt64 h = hash(key);
+			for (Size slot = h & mask;; slot = (slot + 1) & mask)
+			{
+				const Entry& entry = entries[slot];
+				if (entry.key.isNull())
+					return default_target;
+				if (entry.hash == h && entry.key.isInteger() && entry.key.integral() == key)
+					return entry.target;
+			}
+		}
+	};
+
+
+
+	// Facts about one register of a Chunk, computed by optimizer::analyze_registers.
+	// RegisterStack uses them to only clear and release the registers that need it.
+	namespace register_flag
+	{
+		static constexpr UInt8 read_on_entry = 0x1;		// May be read before it is written, so it has to start as Null
+		static constexpr UInt8 reference = 0x2;			// May hold a heap reference, so closing the frame has to release it
+	}
+
+
+
 	class Chunk
 	{
+	public:
+		static constexpr UInt32 no_cache = 0xffffffff;
+
 	private:
 		Value* _constants;
 		Size _constant_count;
@@ -118,19 +297,63 @@ namespace kpl
 		Size _chunk_count;
 
 		unsigned int _register_count;
+		UInt8* _register_flags;
+		UInt8* _entry_regs;
+		UInt8* _reference_regs;
+		UInt8 _entry_count;
+		UInt8 _reference_count;
+		bool _variadic;
+		bool _verified;
 
 		InstructionCode* _code;
+		opcode::id* _opcodes;
 		Size _code_count;
 
+		PropertyCache* _caches;
+		UInt32* _cache_index;
+		Size _cache_count;
+
+		SwitchTable* _switches;
+		Size _switch_count;
+
+		ExceptionHandler* _handlers;
+		Size _handler_count;
+
+		UInt32* _global_slots;
+		UInt64 _globals;
+
+		jit::NativeCode* _native;
+		UInt32 _calls;
+
+		jit::LoopTraces* _traces;
+		UInt32 _loops;
+
+		opcode::id* _breakpoints;
+
 		void* _data;
 
+		void release_breakpoints();
+
 	private:
 		static constexpr int constant_size = sizeof(*_constants);
 		static constexpr int chunk_size = sizeof(*_chunks);
 		static constexpr int instruction_size = sizeof(*_code);
-		static constexpr int chunk_object_size(Size constants, Size chunks, unsigned int code)
+		static constexpr int opcode_size = sizeof(*_opcodes);
+		static constexpr int cache_size = sizeof(*_caches);
+		static constexpr int cache_index_size = sizeof(*_cache_index);
+		static constexpr int global_slot_size = sizeof(*_global_slots);
+		static constexpr int register_info_size = sizeof(*_register_flags) + sizeof(*_entry_regs) + sizeof(*_reference_regs);
+		static constexpr int switch_size = sizeof(SwitchTable);
+		static constexpr int switch_entry_size = sizeof(SwitchTable::Entry);
+		static constexpr int switch_target_size = sizeof(Offset);
+		static constexpr int handler_size = sizeof(ExceptionHandler);
+		static constexpr Size chunk_object_size(Size constants, Size chunks, Size code, Size caches, Size registers,
+			Size switches, Size switch_entries, Size switch_targets, Size handlers)
 		{
-			return constants * constant_size + chunks * chunk_size + code * instruction_size;
+			return constants * (constant_size + global_slot_size) + chunks * chunk_size + caches * cache_size
+				+ code * (instruction_size + cache_index_size + opcode_size) + registers * register_info_size
+				+ switches * switch_size + switch_entries * switch_entry_size + switch_targets * switch_target_size
+				+ handlers * handler_size;
 		}
 
 	public:
@@ -140,8 +363,30 @@ namespace kpl
 			_chunks{ nullptr },
 			_chunk_count{ 0 },
 			_register_count{ 0 },
+			_register_flags{ nullptr },
+			_entry_regs{ nullptr },
+			_reference_regs{ nullptr },
+			_entry_count{ 0 },
+			_reference_count{ 0 },
+			_variadic{ false },
+			_verified{ false },
 			_code{ nullptr },
+			_opcodes{ nullptr },
 			_code_count{ 0 },
+			_caches{ nullptr },
+			_cache_index{ nullptr },
+			_cache_count{ 0 },
+			_switches{ nullptr },
+			_switch_count{ 0 },
+			_handlers{ nullptr },
+			_handler_count{ 0 },
+			_global_slots{ nullptr },
+			_globals{ 0 },
+			_native{ nullptr },
+			_calls{ 0 },
+			_traces{ nullptr },
+			_loops{ 0 },
+			_breakpoints{ nullptr },
 			_data{ nullptr }
 		{}
 		~Chunk();
@@ -155,17 +400,113 @@ namespace kpl
 		inline Size constants_count() const { return _constant_count; }
 		inline const Value& constant(Offset index) const { return _constants[index]; }
 
+		// Slot of a constant used as a global name in the GlobalsManager the chunk was last linked
+		// to, or GlobalsManager::no_slot for any other constant.
+		inline UInt32 global_slot(Offset constant) const { return _global_slots[constant]; }
+
+		// Chunks are built without knowing which state runs them. link_globals resolves their
+		// global names to slots of globals, and linked_globals is the GlobalsManager::serial of
+		// the globals they were last linked to, or 0.
+		void link_globals(GlobalsManager& globals);
+		inline UInt64 linked_globals() const { return _globals; }
+
 		inline Size chunk_count() const { return _chunk_count; }
 		inline Chunk* chunk(Offset index) const { return _chunks[index]; }
 
 		inline Size register_count() const { return _register_count; }
 
+		// register_flag bits of every register.
+		inline const UInt8* register_flags() const { return _register_flags; }
+
+		// Registers with register_flag::read_on_entry, in ascending order.
+		inline const UInt8* entry_registers() const { return _entry_regs; }
+		inline Size entry_register_count() const { return _entry_count; }
+
+		// Registers with register_flag::reference, in ascending order. Empty for a frame that only ever holds scalars.
+		inline const UInt8* reference_registers() const { return _reference_regs; }
+		inline Size reference_register_count() const { return _reference_count; }
+
+		// Whether the chunk uses VARARG, VARARGS or ARG_COUNT. Only the frames of a variadic
+		// chunk keep their arguments on the RegisterStack below the self slot.
+		inline bool is_variadic() const { return _variadic; }
+
+		// Whether every instruction passed verifier::verify when the chunk was built. Failing
+		// ones dispatch as opcode::id::INVALID, and only verified chunks are compiled.
+		inline bool is_verified() const { return _verified; }
+
 		inline InstructionCode instruction(Offset index) const { return _code[index]; }
 		inline Size instruction_count() const { return _code_count; }
 
+		// Opcode the interpreter dispatches on for each instruction. Starts as the encoded
+		// opcode and may be rewritten to a specialized one; the encoded code never changes.
+		// Rewriting an instruction with a breakpoint changes the opcode it runs with after it.
+		inline opcode::id dispatch_opcode(Offset index) const { return _opcodes[index]; }
+		inline void set_dispatch_opcode(Offset index, opcode::id op)
+		{
+			if (_opcodes[index] == opcode::id::BREAK) [[unlikely]]
+				_breakpoints[index] = op;
+			else _opcodes[index] = op;
+		}
+
+		inline Size property_cache_count() const { return _cache_count; }
+		inline PropertyCache* property_cache(Offset index) const
+		{
+			UInt32 cache = _cache_index[index];
+			return cache != no_cache ? _caches + cache : nullptr;
+		}
+
+		inline Size switch_count() const { return _switch_count; }
+		inline const SwitchTable& switch_table(Offset index) const { return _switches[index]; }
+
+		inline Size handler_count() const { return _handler_count; }
+		inline const ExceptionHandler* handlers() const { return _handlers; }
+
+		// Handler of the innermost try region around instruction, or nullptr. Only searched once
+		// an error is raised, so running code inside a try region costs nothing.
+		inline const ExceptionHandler* handler(Offset instruction) const
+		{
+			for (const ExceptionHandler* handler = _handlers, *end = _handlers + _handler_count; handler != end; ++handler)
+				if (instruction >= handler->start && instruction < handler->end)
+					return handler;
+			return nullptr;
+		}
+
+		// Machine code jit::compile generated or aot::install attached to the chunk, or nullptr
+		// while it is interpreted.
+		inline jit::NativeCode* native_code() const { return _native; }
+
+		// Counts calls calls of the chunk and returns how many there were, which is what makes it hot.
+		inline UInt32 count_call(UInt32 calls = 1) { return _calls += calls; }
+
+		// Loops jit::record_loop traced or tried to trace in the chunk, or nullptr if none.
+		inline jit::LoopTraces* loop_traces() const { return _traces; }
+
+		// Counts a backward jump taken in the chunk and returns how many there were since the
+		// last loop was recorded.
+		inline UInt32 count_loop() { return ++_loops; }
+
+		// Breakpoints write opcode::id::BREAK over the dispatch opcode of their instruction and
+		// keep the one they replaced aside, so the other instructions run exactly as before.
+		// A chunk with breakpoints drops any machine code and is interpreted until they are all
+		// cleared. A breakpoint on the second instruction of a superinstruction splits it.
+		// set_breakpoint and clear_breakpoint return false if there was nothing to change.
+		bool set_breakpoint(Offset offset);
+		bool clear_breakpoint(Offset offset);
+		void clear_breakpoints();
+
+		inline bool has_breakpoints() const { return _breakpoints; }
+		inline bool has_breakpoint(Offset offset) const { return _breakpoints && _opcodes[offset] == opcode::id::BREAK; }
+
+		// Dispatch opcode the instruction at offset runs with once its breakpoint was handled.
+		inline opcode::id breakpoint_opcode(Offset offset) const { return _breakpoints[offset]; }
+
 		inline ChunkBuilder builder() { return { this }; }
 		static inline ChunkBuilder builder(Chunk* chunk) { return { chunk }; }
 
 		friend class ChunkBuilder;
+		friend bool jit::compile(Chunk& chunk);
+		friend void jit::discard(Chunk& chunk);
+		friend void jit::record_loop(Chunk& chunk, Offset head, Offset end);
+		friend bool aot::install(Chunk& root, const aot::CompiledChunk* chunks, Size count);
 	};
 }
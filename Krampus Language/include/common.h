@@ -11,6 +11,11 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <memory>
+#include <limits>
+#include <bitset>
+#include <array>
+#include <span>
 
 #ifndef __cpp_lib_concepts
 #define __cpp_lib_concepts
@@ -47,6 +52,7 @@ namespace kpl
 namespace kpl
 {
 	class KPLState;
+	class GlobalsManager;
 
 	class Value;
 
@@ -48,6 +48,8 @@ namespace kpl
 		inline BadValueOperation() : exception() {}
 		inline BadValueOperation(const char* msg) : exception(msg) {}
 		inline BadValueOperation(const std::string& msg) : exception(msg.c_str()) {}
+
+		using exception::what;
 	};
 
 	class Value
@@ -180,12 +182,21 @@ namespace kpl
 		Value runtime_idiv(const Value& right, KPLState& state) const;
 		Value runtime_mod(const Value& right, KPLState& state) const;
 
-		Value runtime_eq(const Value& right, KPLState& state) const;
-		Value runtime_ne(const Value& right, KPLState& state) const;
-		Value runtime_gr(const Value& right, KPLState& state) const;
-		Value runtime_ls(const Value& right, KPLState& state) const;
-		Value runtime_ge(const Value& right, KPLState& state) const;
-		Value runtime_le(const Value& right, KPLState& state) const;
+		// Comparisons return their result as a plain bool; a metamethod result is converted
+		// with to_bool right where it is called.
+		bool runtime_equals(const Value& right, KPLState& state) const;
+		bool runtime_not_equals(const Value& right, KPLState& state) const;
+		bool runtime_greater(const Value& right, KPLState& state) const;
+		bool runtime_less(const Value& right, KPLState& state) const;
+		bool runtime_greater_equals(const Value& right, KPLState& state) const;
+		bool runtime_less_equals(const Value& right, KPLState& state) const;
+
+		inline Value runtime_eq(const Value& right, KPLState& state) const { return runtime_equals(right, state); }
+		inline Value runtime_ne(const Value& right, KPLState& state) const { return runtime_not_equals(right, state); }
+		inline Value runtime_gr(const Value& right, KPLState& state) const { return runtime_greater(right, state); }
+		inline Value runtime_ls(const Value& right, KPLState& state) const { return runtime_less(right, state); }
+		inline Value runtime_ge(const Value& right, KPLState& state) const { return runtime_greater_equals(right, state); }
+		inline Value runtime_le(const Value& right, KPLState& state) const { return runtime_less_equals(right, state); }
 
 		Value runtime_shl(const Value& right, KPLState& state) const;
 		Value runtime_shr(const Value& right, KPLState& state) const;
@@ -215,24 +226,9 @@ namespace kpl
 		const Value& get_property(const std::string& name) const;
 		void del_property(const std::string& name);
 
-		inline void set_property(const Value& name, const Value& value)
-		{
-			if(name._type == DataType::String)
-				set_property(name._value.string, value);
-			else set_property(name.to_string(), value);
-		}
-		const Value& get_property(const Value& name) const
-		{
-			if (name._type == DataType::String)
-				return get_property(name._value.string);
-			return get_property(name.to_string());
-		}
-		void del_property(const Value& name)
-		{
-			if (name._type == DataType::String)
-				del_property(name._value.string);
-			else del_property(name.to_string());
-		}
+		inline void set_property(const Value& name, const Value& value);
+		inline const Value& get_property(const Value& name) const;
+		inline void del_property(const Value& name);
 
 		std::string to_string() const;
 
@@ -250,6 +246,9 @@ namespace kpl
 		inline bool operator! () const { return !to_bool(); }
 	};
 
+	static_assert(sizeof(Value) == CallArguments::value_size, "CallArguments::value_size must match Value");
+	static_assert(alignof(Value) == CallArguments::value_alignment, "CallArguments::value_alignment must match Value");
+
 	namespace type::literal
 	{
 		extern const Value Null;
@@ -335,6 +334,22 @@ namespace kpl::type
 {
 	class List : public KPLVirtualObject, public std::list<Value>
 	{
+	public:
+		static constexpr Size cursor_count = 2;
+
+	private:
+		static constexpr Size no_position = std::numeric_limits<Size>::max();
+
+		// Element a loop going through the list in order visits next, and its index.
+		struct Cursor
+		{
+			const_iterator element;
+			Size position = no_position;
+		};
+
+		std::array<Cursor, cursor_count> _cursors;
+		Offset _next_cursor = 0;
+
 	public:
 		static void _mheap_delete(void* block);
 
@@ -344,8 +359,45 @@ namespace kpl::type
 
 		inline List(const List& list) : list{ list } {}
 
+		// Assigning copies or takes the elements only; loops going through either list start over.
+		inline List& operator= (const List& other) { forget_cursors(); list::operator=(other); return *this; }
+		inline List& operator= (List&& other) noexcept { forget_cursors(); other.forget_cursors(); list::operator=(std::move(other)); return *this; }
+
 		std::string to_string() const;
 
+		// Element at index for a loop going through the list in order, or nullptr past its end.
+		// The list remembers where its last cursor_count loops are, so asking for the index after
+		// the one returned is O(1); any other index walks from the front.
+		const Value* step(Size index);
+
+		// Mutators that free or move nodes hide the std::list ones to forget those positions.
+		template<typename... _Args>
+		inline iterator erase(_Args&&... args) { forget_cursors(); return list::erase(std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline decltype(auto) remove(_Args&&... args) { forget_cursors(); return list::remove(std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline decltype(auto) remove_if(_Args&&... args) { forget_cursors(); return list::remove_if(std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline decltype(auto) unique(_Args&&... args) { forget_cursors(); return list::unique(std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline void resize(_Args&&... args) { forget_cursors(); list::resize(std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline void assign(_Args&&... args) { forget_cursors(); list::assign(std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline void sort(_Args&&... args) { forget_cursors(); list::sort(std::forward<_Args>(args)...); }
+
+		inline void reverse() noexcept { forget_cursors(); list::reverse(); }
+		inline void pop_front() { forget_cursors(); list::pop_front(); }
+		inline void pop_back() { forget_cursors(); list::pop_back(); }
+		inline void clear() { forget_cursors(); list::clear(); }
+
+		inline void swap(List& other) { forget_cursors(); other.forget_cursors(); list::swap(other); }
+
+		template<typename... _Args>
+		inline void splice(const_iterator pos, List& other, _Args&&... args) { forget_cursors(); other.forget_cursors(); list::splice(pos, other, std::forward<_Args>(args)...); }
+		template<typename... _Args>
+		inline void merge(List& other, _Args&&... args) { forget_cursors(); other.forget_cursors(); list::merge(other, std::forward<_Args>(args)...); }
+
 		static Value runtime_concat(const List& left, const List& right, MemoryHeap& heap);
 		static Value runtime_concat(const List& left, const Array& right, MemoryHeap& heap);
 
@@ -353,6 +405,13 @@ namespace kpl::type
 		static type::Boolean runtime_ne(const List& left, const List& right, KPLState& state);
 
 		static type::Boolean runtime_in(const List& left, const Value& right, KPLState& state);
+
+	private:
+		inline void forget_cursors()
+		{
+			for (Cursor& cursor : _cursors)
+				cursor.position = no_position;
+		}
 	};
 }
 
@@ -360,24 +419,51 @@ namespace kpl::type
 
 namespace kpl::type
 {
+	// Identifies the own property names of an Object. Objects that gained the same names in the
+	// same order share a layout, so equal layouts prove that a name is absent from both.
+	class ObjectLayout
+	{
+	private:
+		std::unordered_map<std::string, std::unique_ptr<ObjectLayout>> _transitions;
+
+	public:
+		ObjectLayout() = default;
+		ObjectLayout(const ObjectLayout&) = delete;
+
+		static ObjectLayout* root();
+
+		ObjectLayout* with(const std::string& name);
+	};
+
+
+
 	class Object : public KPLVirtualObject, public std::unordered_map<std::string, Value>
 	{
 	private:
 		Value _class;
 		Value* _parents;
 		Size _parentSize;
+		ObjectLayout* _layout;
+		UInt64 _serial;
 
 	public:
 		static void _mheap_delete(void* block);
 
 	public:
-		inline Object() : unordered_map(), _class(), _parents(nullptr), _parentSize(0) {}
-		inline Object(const Value& class_) : unordered_map(), _class(class_), _parents(nullptr), _parentSize(0) {}
+		inline Object() : unordered_map(), _class(), _parents(nullptr), _parentSize(0), _layout(ObjectLayout::root()), _serial(next_serial()) {}
+		inline Object(const Value& class_) : unordered_map(), _class(class_), _parents(nullptr), _parentSize(0), _layout(ObjectLayout::root()), _serial(next_serial()) {}
 		Object(const Value* parents, const Size count);
 		~Object();
 
 		inline const Value& get_class() const { return _class; }
 
+		// Layout of the own property names, or nullptr once a property has been removed.
+		inline const ObjectLayout* layout() const { return _layout; }
+
+		// Unique among all objects, and renewed whenever a property is removed; pointers
+		// to properties stay valid while it does not change.
+		inline UInt64 serial() const { return _serial; }
+
 		inline Size get_parent_count() const { return _parentSize; }
 		inline const Value& get_parent(Offset index) const { return _parents[index]; }
 
@@ -387,12 +473,12 @@ namespace kpl::type
 
 		const Value& get_property(const std::string& name) const;
 
-		inline void set_property(const std::string& name, const Value& value) { insert({ name, value }); }
+		inline void set_property(const std::string& name, const Value& value) { insert_or_assign(name, value); }
 		inline void set_property(const Value& name, const Value& value)
 		{
 			if (name.type() == DataType::String)
-				insert({ name.string(), value });
-			else insert({ name.to_string(), value });
+				insert_or_assign(name.string(), value);
+			else insert_or_assign(name.to_string(), value);
 		}
 
 		inline const Value& get_property(const Value& name) const
@@ -410,8 +496,17 @@ namespace kpl::type
 			else erase( name.to_string() );
 		}
 
+		// Mutators hide the unordered_map ones to keep layout() and serial() up to date.
+		std::pair<iterator, bool> insert(const value_type& property);
+		std::pair<iterator, bool> insert_or_assign(const std::string& name, const Value& value);
+		Value& operator[] (const std::string& name);
+		size_type erase(const std::string& name);
+		void clear();
+
 	private:
 		bool is_same_or_parent(const Value& value);
+
+		static UInt64 next_serial();
 	};
 }
 
@@ -534,6 +629,11 @@ namespace kpl::type
 		Value invoke(KPLState& state, const std::string& property_name, const CallArguments& args = CallArguments());
 		Value invoke(KPLState& state, const Value& property_name, const CallArguments& args = CallArguments());
 
+		// Iteration hook for ITER_NEXT. cursor is Null on the first call and otherwise keeps
+		// whatever the previous call stored there. Stores the next pair in key and value and
+		// returns true, or returns false once exhausted. Throws unless overridden.
+		virtual bool iterate(KPLState& state, Value& cursor, Value& key, Value& value);
+
 	protected:
 		virtual const Value& inner_get_property(const std::string& name) const { return literal::Null; }
 		virtual void inner_set_property(const std::string name, const Value& value) {}
@@ -559,6 +659,25 @@ namespace kpl
 	inline Value& Value::operator= (type::Function* right) { try_dec_ref(); return _type = DataType::Function, _value.function = right, inc_ref(right), * this; }
 	inline Value& Value::operator= (type::Userdata* right) { return _type = DataType::Userdata, _value.userdata = right, *this; }
 
+	inline void Value::set_property(const Value& name, const Value& value)
+	{
+		if (name._type == DataType::String)
+			set_property(*name._value.string, value);
+		else set_property(name.to_string(), value);
+	}
+	inline const Value& Value::get_property(const Value& name) const
+	{
+		if (name._type == DataType::String)
+			return get_property(*name._value.string);
+		return get_property(name.to_string());
+	}
+	inline void Value::del_property(const Value& name)
+	{
+		if (name._type == DataType::String)
+			del_property(*name._value.string);
+		else del_property(name.to_string());
+	}
+
 	inline void Value::try_inc_ref()
 	{
 		switch (_type)
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+
+
+// Instrumentation hooks are compiled in by default on debug builds only. When
+// compiled in, every hook site costs one null test of the installed hooks.
+#ifndef KPL_ENABLE_HOOKS
+#	ifdef NDEBUG
+#		define KPL_ENABLE_HOOKS 0
+#	else
+#		define KPL_ENABLE_HOOKS 1
+#	endif
+#endif
+
+#if KPL_ENABLE_HOOKS
+#	define __KPL_HOOK(_Hooks, _Call) do { if (kpl::RuntimeHooks* __hooks = (_Hooks)) [[unlikely]] __hooks->_Call; } while(0)
+#else
+#	define __KPL_HOOK(_Hooks, _Call) ((void)0)
+#endif
+
+
+namespace kpl
+{
+	class RuntimeHooks
+	{
+	public:
+		RuntimeHooks() = default;
+		RuntimeHooks(const RuntimeHooks&) = default;
+		RuntimeHooks(RuntimeHooks&&) noexcept = default;
+		virtual ~RuntimeHooks() = default;
+
+		RuntimeHooks& operator= (const RuntimeHooks&) = default;
+		RuntimeHooks& operator= (RuntimeHooks&&) noexcept = default;
+
+		virtual void on_instruction(KPLState& /*state*/, const Chunk& /*chunk*/, Offset /*offset*/, InstructionCode /*inst*/) {}
+
+		virtual void on_call_enter(KPLState& /*state*/, const type::Function& /*function*/) {}
+		virtual void on_call_exit(KPLState& /*state*/, const type::Function& /*function*/) {}
+
+		virtual void on_allocation(const void* /*object*/, Size /*size*/) {}
+	};
+
+
+
+	// Receives the breakpoints of Chunk::set_breakpoint. Unlike RuntimeHooks it is not affected
+	// by KPL_ENABLE_HOOKS: only instructions with a breakpoint ever check for it.
+	class BreakpointHandler
+	{
+	public:
+		BreakpointHandler() = default;
+		BreakpointHandler(const BreakpointHandler&) = default;
+		BreakpointHandler(BreakpointHandler&&) noexcept = default;
+		virtual ~BreakpointHandler() = default;
+
+		BreakpointHandler& operator= (const BreakpointHandler&) = default;
+		BreakpointHandler& operator= (BreakpointHandler&&) noexcept = default;
+
+		// Called before the instruction at offset runs, regs being the registers of its frame.
+		// It may set and clear breakpoints, this one included; stepping means setting one on
+		// the instruction that runs next.
+		virtual void on_breakpoint(KPLState& state, Chunk& chunk, Offset offset, Value* regs) = 0;
+	};
+
+
+
+	class InstructionTraceHooks : public RuntimeHooks
+	{
+	private:
+		std::ostream* _os;
+
+	public:
+		inline InstructionTraceHooks(std::ostream& os = std::cout) : _os{ &os } {}
+
+		void on_instruction(KPLState& state, const Chunk& chunk, Offset offset, InstructionCode inst) override;
+	};
+}
@@ -14,9 +14,9 @@
 #define __KPL_INST_ARG_KC(_Inst) (((_Inst) >> 23) & 0x1)
 
 #define __KPL_INST_ARG_BX(_Inst) static_cast<unsigned int>(((_Inst) >> 14) & 0x3ffff)
-#define __KPL_INST_ARG_SBX(_Inst) ((((_Inst) >> 14) & 0x1) ? (((_Inst) >> 15) & 0x1ffff) | 0xffff8000 : (((_Inst) >> 15) | 0x1ffff))
+#define __KPL_INST_ARG_SBX(_Inst) static_cast<int>((((_Inst) >> 14) & 0x1) ? (((_Inst) >> 15) & 0x1ffff) | 0xfffe0000 : (((_Inst) >> 15) & 0x1ffff))
 #define __KPL_INST_ARG_AX(_Inst) static_cast<unsigned int>(((_Inst) >> 6) & 0x3ffffff)
-#define __KPL_INST_ARG_SAX(_Inst) ((((_Inst) >> 6) & 0x1) ? (((_Inst) >> 7) & 0x1ffffff) | 0xffffff80 : (((_Inst) >> 7) | 0x1ffffff))
+#define __KPL_INST_ARG_SAX(_Inst) static_cast<int>((((_Inst) >> 6) & 0x1) ? (((_Inst) >> 7) & 0x1ffffff) | 0xfe000000 : (((_Inst) >> 7) & 0x1ffffff))
 
 
 namespace kpl::inst::arg
@@ -125,12 +125,12 @@ namespace kpl::inst
 
 		static inline Instruction load_null(A first_reg, B last_reg)
 		{
-			return Instruction().opcode(opcode::id::LOAD_BOOL).a(first_reg).b(last_reg);
+			return Instruction().opcode(opcode::id::LOAD_NULL).a(first_reg).b(last_reg);
 		}
 
 		static inline Instruction load_int(A dst_reg, sBx value)
 		{
-			return Instruction().opcode(opcode::id::LOAD_INT).a(dst_reg).bx(value);
+			return Instruction().opcode(opcode::id::LOAD_INT).a(dst_reg).sbx(value);
 		}
 
 		static inline Instruction get_global(A dst_reg, KB symbol)
@@ -178,7 +178,7 @@ namespace kpl::inst
 			return Instruction().opcode(opcode::id::NEW_OBJECT).a(dst_reg).b(class_).c(has_class);
 		}
 
-		static inline Instruction new_object(A al_reg, B first_reg, C last_reg)
+		static inline Instruction set_al(A al_reg, B first_reg, C last_reg)
 		{
 			return Instruction().opcode(opcode::id::SET_AL).a(al_reg).b(first_reg).c(last_reg);
 		}
@@ -305,24 +305,33 @@ namespace kpl::inst
 
 		static inline Instruction get(A dst_reg, KB base, KC index)
 		{
-			return Instruction().opcode(opcode::id::INSTANCEOF).a(dst_reg).b(base).c(index);
+			return Instruction().opcode(opcode::id::GET).a(dst_reg).b(base).c(index);
 		}
 
 		static inline Instruction set(A base, KB index, KC value)
 		{
-			return Instruction().opcode(opcode::id::INSTANCEOF).a(base).b(index).c(value);
+			return Instruction().opcode(opcode::id::SET).a(base).b(index).c(value);
 		}
 
-		static inline Instruction set(Ax target)
+		static inline Instruction jp(Ax target)
 		{
-			return Instruction().opcode(opcode::id::INSTANCEOF).ax(target);
+			return Instruction().opcode(opcode::id::JP).ax(target);
 		}
 
+		static inline Instruction test(KB value, C expected)
+		{
+			return Instruction().opcode(opcode::id::TEST).b(value).c(expected);
+		}
+
+		static inline Instruction test_set(A dst_reg, KB value, C expected)
+		{
+			return Instruction().opcode(opcode::id::TEST_SET).a(dst_reg).b(value).c(expected);
+		}
 
 
-		static inline Instruction call(A func, B args)
+		static inline Instruction call(A func, B args, C results = 0)
 		{
-			return Instruction().opcode(opcode::id::CALL).a(func).b(args);
+			return Instruction().opcode(opcode::id::CALL).a(func).b(args).c(results);
 		}
 
 		static inline Instruction invoke(A func, KB symbol, C args)
@@ -334,6 +343,66 @@ namespace kpl::inst
 		{
 			return Instruction().opcode(opcode::id::RETURN).a(return_any).b(value);
 		}
+
+		static inline Instruction yield(A resume_reg, KB value)
+		{
+			return Instruction().opcode(opcode::id::YIELD).a(resume_reg).b(value);
+		}
+
+		static inline Instruction resume(A dst_reg, KB coroutine, KC value)
+		{
+			return Instruction().opcode(opcode::id::RESUME).a(dst_reg).b(coroutine).c(value);
+		}
+
+		static inline Instruction forprep(A base_reg, Bx loop)
+		{
+			return Instruction().opcode(opcode::id::FORPREP).a(base_reg).bx(loop);
+		}
+
+		static inline Instruction forloop(A base_reg, Bx body)
+		{
+			return Instruction().opcode(opcode::id::FORLOOP).a(base_reg).bx(body);
+		}
+
+		static inline Instruction iter_prep(A base_reg, Bx next)
+		{
+			return Instruction().opcode(opcode::id::ITER_PREP).a(base_reg).bx(next);
+		}
+
+		static inline Instruction iter_next(A base_reg, Bx body)
+		{
+			return Instruction().opcode(opcode::id::ITER_NEXT).a(base_reg).bx(body);
+		}
+
+		static inline Instruction switch_(KB value, C table)
+		{
+			return Instruction().opcode(opcode::id::SWITCH).b(value).c(table);
+		}
+
+		static inline Instruction throw_(KB value)
+		{
+			return Instruction().opcode(opcode::id::THROW).b(value);
+		}
+
+		static inline Instruction return_multi(A first_reg, B count)
+		{
+			return Instruction().opcode(opcode::id::RETURN_MULTI).a(first_reg).b(count);
+		}
+
+		static inline Instruction vararg(A dst_reg, B first_arg, C count)
+		{
+			return Instruction().opcode(opcode::id::VARARG).a(dst_reg).b(first_arg).c(count);
+		}
+
+		static inline Instruction varargs(A dst_reg, B first_arg)
+		{
+			return Instruction().opcode(opcode::id::VARARGS).a(dst_reg).b(first_arg);
+		}
+
+		static inline Instruction arg_count(A dst_reg)
+		{
+			return Instruction().opcode(opcode::id::ARG_COUNT).a(dst_reg);
+		}
 	};
 }
 
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "chunk.h"
+#include "vmem.h"
+
+
+// Baseline JIT. Only x86-64 has a code generator; elsewhere jit::compile never succeeds
+// and every chunk is interpreted.
+#ifndef KPL_JIT
+#	if defined(_M_X64) || defined(__x86_64__)
+#		define KPL_JIT 1
+#	else
+#		define KPL_JIT 0
+#	endif
+#endif
+
+
+namespace kpl::jit
+{
+	// Calls after which a chunk is compiled.
+	static constexpr UInt32 call_threshold = 1000;
+
+	// Backward jumps a chunk takes before the loop of the next one is recorded.
+	static constexpr UInt32 loop_threshold = 2000;
+
+	// Backward jumps after which another loop is tried when the one that got hot was recorded
+	// before, so an outer loop cannot keep hiding the loops nested in it. A prime, so the
+	// retry does not land on the same edge of a nest every time.
+	static constexpr UInt32 loop_retry = 97;
+
+	// Loops of a chunk recorded at most, whether they could be traced or not.
+	static constexpr Size max_loops = 4;
+
+	// Instructions one iteration of a traced loop can run at most.
+	static constexpr Size max_trace_length = 256;
+
+	// Machine code for a whole Chunk. Each instruction gets the template of its opcode, which
+	// only handles Null, Integer, Float and Boolean registers and never calls out. Anything
+	// else, including every instruction without a template, returns to the interpreter at
+	// that instruction before changing any register, so the code can stop and resume at any
+	// instruction boundary and always computes what the interpreter would.
+	class NativeCode
+	{
+	public:
+		// Runs from start with the registers of the frame at regs and returns the offset of the
+		// instruction the interpreter has to run next. Backward jumps spend fuel like the
+		// interpreter does; one that would run out returns at the jump instead.
+		typedef Offset (*Entry)(Value* regs, Offset start, Int64* fuel);
+
+	private:
+		std::unique_ptr<utils::ExecutableBlock> _code;
+		Entry _entry;
+		std::vector<opcode::id> _opcodes;
+
+	public:
+		NativeCode(const NativeCode&) = delete;
+		NativeCode(NativeCode&&) = delete;
+
+		NativeCode& operator= (const NativeCode&) = delete;
+		NativeCode& operator= (NativeCode&&) = delete;
+
+		NativeCode(const std::vector<UInt8>& code, std::vector<opcode::id>&& opcodes);
+
+		// Wraps a function aot::emit generated for the chunk and the host compiled with it.
+		NativeCode(Entry entry, std::vector<opcode::id>&& opcodes);
+
+		~NativeCode() = default;
+
+		inline Offset run(Value* regs, Offset start, Int64& fuel) const { return _entry(regs, start, &fuel); }
+
+		// Whether the code was compiled ahead of time rather than by the JIT. Turning the JIT
+		// off keeps it.
+		inline bool ahead_of_time() const { return !_code; }
+
+		// Dispatch opcode the instruction had before the chunk was compiled.
+		inline opcode::id opcode(Offset index) const { return _opcodes[index]; }
+	};
+
+	// One instruction of a recorded loop iteration, with the types its register operands had
+	// when it ran: B and C, or A to A+2 for FORLOOP.
+	struct TraceStep
+	{
+		Offset offset;
+		InstructionCode code;
+		DataType types[3];
+	};
+
+	// Machine code for one recorded path around a loop, specialized to the types that path
+	// saw. It is entered at the loop head, checks the types of the registers the loop reads
+	// before writing, and keeps those holding Integers and Floats unboxed in machine
+	// registers across iterations. A guard that fails leaves at the instruction it belongs
+	// to, before that instruction changed anything, after writing the unboxed registers back.
+	class Trace
+	{
+	public:
+		// Runs from the loop head with the registers of the frame at regs and returns the offset
+		// of the instruction the interpreter has to run next. Fuel is spent like in NativeCode.
+		typedef Offset (*Entry)(Value* regs, Int64* fuel);
+
+	private:
+		utils::ExecutableBlock _code;
+		Offset _head;
+		opcode::id _opcode;
+
+	public:
+		Trace(const Trace&) = delete;
+		Trace(Trace&&) = delete;
+
+		Trace& operator= (const Trace&) = delete;
+		Trace& operator= (Trace&&) = delete;
+
+		Trace(const std::vector<UInt8>& code, Offset head, opcode::id op);
+		~Trace() = default;
+
+		inline Offset run(Value* regs, Int64& fuel) const { return reinterpret_cast<Entry>(_code.data())(regs, &fuel); }
+
+		inline Offset head() const { return _head; }
+
+		// Dispatch opcode the loop head had before opcode::id::TRACE replaced it.
+		inline opcode::id opcode() const { return _opcode; }
+	};
+
+	// Traced loops of a chunk and the recording of the next one. A recording marks every
+	// instruction from the loop head to its backward jump with opcode::id::RECORD and ends
+	// when execution gets back to the head, leaves the loop some other way, or runs
+	// something a trace cannot do.
+	class LoopTraces
+	{
+	private:
+		std::vector<std::unique_ptr<Trace>> _traces;
+		std::vector<Offset> _recorded;
+
+		std::vector<TraceStep> _steps;
+		std::vector<opcode::id> _saved;
+		Offset _head;
+		Offset _end;
+		bool _recording;
+
+	public:
+		LoopTraces(const LoopTraces&) = delete;
+		LoopTraces(LoopTraces&&) = delete;
+
+		LoopTraces& operator= (const LoopTraces&) = delete;
+		LoopTraces& operator= (LoopTraces&&) = delete;
+
+		LoopTraces();
+		~LoopTraces();
+
+		inline bool recording() const { return _recording; }
+
+		// Trace whose loop starts at head, or nullptr.
+		const Trace* find(Offset head) const;
+
+		// Whether the loop at head was recorded before, traced or not.
+		bool recorded(Offset head) const;
+
+		// Loops of the chunk recorded so far.
+		inline Size recorded_count() const { return _recorded.size(); }
+
+		// Marks the loop from head to the backward jump at end for recording.
+		void start(Chunk& chunk, Offset head, Offset end);
+
+		// Records the instruction at offset, about to run on the frame registers regs, and
+		// returns the opcode it has to be dispatched with. Getting back to the head compiles
+		// the trace, and that opcode is then opcode::id::TRACE.
+		opcode::id record(Chunk& chunk, Offset offset, const Value* regs);
+
+		// Gives every instruction the dispatch opcode it had before it was traced or recorded.
+		void restore(Chunk& chunk);
+
+	private:
+		void stop(Chunk& chunk);
+	};
+
+	// Compiles chunk and rewrites the dispatch opcode of every instruction with a template to
+	// opcode::id::NATIVE. Returns false, leaving chunk interpreted, if it is already compiled,
+	// is not verified, has breakpoints, has no instruction with a template or there is no code
+	// generator for this platform.
+	bool compile(Chunk& chunk);
+
+	// Restores the dispatch opcodes chunk had before compile or record_loop and frees its
+	// machine code and traces.
+	void discard(Chunk& chunk);
+
+	// Starts recording the loop of chunk from head to the backward jump at end, unless it was
+	// recorded before or the chunk has recorded max_loops loops. Also resets the count of
+	// backward jumps so the next hot loop of the chunk can be found, or so another loop gets
+	// a turn soon if this one was recorded before. Does nothing if chunk is not verified or
+	// while it has breakpoints.
+	void record_loop(Chunk& chunk, Offset head, Offset end);
+}
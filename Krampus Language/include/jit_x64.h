@@ -0,0 +1,325 @@
+#pragma once
+
+#include "jit.h"
+
+#if KPL_JIT
+namespace kpl::jit::x64
+{
+	// Generated code addresses a register of the frame as its DataType followed by its 8 byte payload.
+	static_assert(sizeof(Value) == 16, "jit code expects a 16 byte Value");
+
+	static constexpr Int32 payload_offset = 8;
+	static constexpr Int32 value_size = sizeof(Value);
+
+	static constexpr UInt8 type_code(DataType type) { return static_cast<UInt8>(type); }
+
+	// Types a register can hold without owning a reference, so storing over it is a plain write.
+	static constexpr UInt8 last_scalar_type = type_code(DataType::Boolean);
+
+	enum class Reg : UInt8 { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+	enum class Xmm : UInt8 { xmm0, xmm1, xmm2, xmm3, xmm4, xmm5 };
+
+	// Integer argument registers of the calling convention.
+#ifdef _WIN32
+	static constexpr Reg args[] = { Reg::rcx, Reg::rdx, Reg::r8 };
+#else
+	static constexpr Reg args[] = { Reg::rdi, Reg::rsi, Reg::rdx };
+#endif
+
+	enum class Condition : UInt8
+	{
+		below = 0x2,
+		above_equal = 0x3,
+		equal = 0x4,
+		not_equal = 0x5,
+		below_equal = 0x6,
+		above = 0x7,
+		parity = 0xa,
+		less = 0xc,
+		greater_equal = 0xd,
+		less_equal = 0xe,
+		greater = 0xf
+	};
+
+	// Condition that holds exactly when condition does not.
+	static constexpr Condition negate(Condition condition) { return static_cast<Condition>(static_cast<UInt8>(condition) ^ 1); }
+
+	// Two operand integer instructions, as the opcode of their r/m64, r64 form.
+	enum class Alu : UInt8 { add = 0x01, sub = 0x29, cmp = 0x39, imul = 0xaf };
+
+	// Scalar double instructions, as the opcode following F2 0F.
+	enum class Sse : UInt8 { add = 0x58, mul = 0x59, sub = 0x5c, div = 0x5e };
+
+	// Emits the few x86-64 instructions the JIT is made of. Memory operands are always a
+	// register of the frame, [rbx + disp32], or the fuel counter, [r12].
+	class Assembler
+	{
+	public:
+		typedef unsigned int Label;
+
+	private:
+		static constexpr Offset unbound = static_cast<Offset>(-1);
+
+		struct Fixup
+		{
+			Offset at;
+			Label label;
+		};
+
+		std::vector<UInt8> _code;
+		std::vector<Offset> _labels;
+		std::vector<Fixup> _fixups;
+
+		inline void byte(UInt8 value) { _code.push_back(value); }
+		inline void bytes(std::initializer_list<UInt8> values) { _code.insert(_code.end(), values); }
+
+		inline void dword(UInt32 value)
+		{
+			for (int i = 0; i < 4; ++i, value >>= 8)
+				byte(static_cast<UInt8>(value));
+		}
+
+		inline void qword(UInt64 value)
+		{
+			for (int i = 0; i < 8; ++i, value >>= 8)
+				byte(static_cast<UInt8>(value));
+		}
+
+		inline void rel32(Label label)
+		{
+			_fixups.push_back({ _code.size(), label });
+			dword(0);
+		}
+
+		static inline UInt8 code(Reg reg) { return static_cast<UInt8>(reg); }
+		static inline UInt8 code(Xmm reg) { return static_cast<UInt8>(reg); }
+
+		// REX prefix extending the reg and r/m fields, left out when it would be empty.
+		inline void rex(bool wide, UInt8 reg, UInt8 rm)
+		{
+			const UInt8 value = static_cast<UInt8>(0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3));
+			if (value != 0x40)
+				byte(value);
+		}
+
+		inline void direct(UInt8 reg, UInt8 rm) { byte(static_cast<UInt8>(0xc0 | ((reg & 7) << 3) | (rm & 7))); }
+
+		// ModRM and displacement of [rbx + disp32].
+		inline void frame(UInt8 reg, Int32 disp)
+		{
+			byte(static_cast<UInt8>(0x80 | ((reg & 7) << 3) | 3));
+			dword(static_cast<UInt32>(disp));
+		}
+
+		static inline Int32 type_of(unsigned int reg) { return static_cast<Int32>(reg) * value_size; }
+		static inline Int32 payload_of(unsigned int reg) { return static_cast<Int32>(reg) * value_size + payload_offset; }
+
+	public:
+		inline const std::vector<UInt8>& code() const { return _code; }
+		inline Offset size() const { return _code.size(); }
+
+		inline Label label()
+		{
+			_labels.push_back(unbound);
+			return static_cast<Label>(_labels.size() - 1);
+		}
+
+		inline void bind(Label label) { _labels[label] = _code.size(); }
+		inline Offset position(Label label) const { return _labels[label]; }
+
+		// Drops everything emitted from position on. Labels bound there must not be used again.
+		inline void rewind(Offset position)
+		{
+			_code.resize(position);
+			while (!_fixups.empty() && _fixups.back().at >= position)
+				_fixups.pop_back();
+		}
+
+		inline void align(Size alignment)
+		{
+			while (_code.size() % alignment)
+				byte(0xcc);		// int3
+		}
+
+		// Resolves every rel32 to the label it refers to.
+		inline void link()
+		{
+			for (const Fixup& fixup : _fixups)
+			{
+				const Int64 rel = static_cast<Int64>(_labels[fixup.label]) - static_cast<Int64>(fixup.at + 4);
+				const UInt32 value = static_cast<UInt32>(static_cast<Int32>(rel));
+				for (int i = 0; i < 4; ++i)
+					_code[fixup.at + i] = static_cast<UInt8>(value >> (i * 8));
+			}
+		}
+
+		inline void int32(Int32 value) { dword(static_cast<UInt32>(value)); }
+
+		inline void push(Reg reg) { rex(false, 0, code(reg)); byte(static_cast<UInt8>(0x50 | (code(reg) & 7))); }
+		inline void pop(Reg reg) { rex(false, 0, code(reg)); byte(static_cast<UInt8>(0x58 | (code(reg) & 7))); }
+		inline void ret() { byte(0xc3); }
+
+		// Jumps to the entry rcx of the table of int32 offsets, relative to the table, at label.
+		inline void jump_table(Label table)
+		{
+			bytes({ 0x48, 0x8d, 0x05 }); rel32(table);		// lea rax, [rip + table]
+			bytes({ 0x48, 0x63, 0x0c, 0x88 });				// movsxd rcx, dword [rax + rcx * 4]
+			bytes({ 0x48, 0x01, 0xc8 });					// add rax, rcx
+			bytes({ 0xff, 0xe0 });							// jmp rax
+		}
+
+		inline void jmp(Label label) { byte(0xe9); rel32(label); }
+		inline void jcc(Condition condition, Label label) { bytes({ 0x0f, static_cast<UInt8>(0x80 | static_cast<UInt8>(condition)) }); rel32(label); }
+
+		inline void mov(Reg dst, Reg src) { rex(true, code(src), code(dst)); byte(0x89); direct(code(src), code(dst)); }
+		inline void mov_eax(UInt32 value) { byte(0xb8); dword(value); }
+
+		inline void mov(Reg dst, UInt64 bits)
+		{
+			const Int64 value = static_cast<Int64>(bits);
+			rex(true, 0, code(dst));
+			if (value == static_cast<Int32>(value))
+			{
+				byte(0xc7); direct(0, code(dst)); int32(static_cast<Int32>(value));
+			}
+			else
+			{
+				byte(static_cast<UInt8>(0xb8 | (code(dst) & 7))); qword(bits);
+			}
+		}
+
+		inline void cmp_type(unsigned int reg, UInt8 type) { byte(0x83); frame(7, type_of(reg)); byte(type); }
+		inline void load_type(Reg dst, unsigned int reg) { rex(false, code(dst), 0); byte(0x8b); frame(code(dst), type_of(reg)); }
+		inline void store_type(unsigned int reg, Reg src) { rex(false, code(src), 0); byte(0x89); frame(code(src), type_of(reg)); }
+		inline void store_type(unsigned int reg, DataType type) { byte(0xc7); frame(0, type_of(reg)); dword(type_code(type)); }
+
+		inline void load_payload(Reg dst, unsigned int reg) { rex(true, code(dst), 0); byte(0x8b); frame(code(dst), payload_of(reg)); }
+		inline void store_payload(unsigned int reg, Reg src) { rex(true, code(src), 0); byte(0x89); frame(code(src), payload_of(reg)); }
+
+		// Uses rax for a payload that does not fit a sign extended imm32.
+		inline void store_payload(unsigned int reg, UInt64 bits)
+		{
+			const Int64 value = static_cast<Int64>(bits);
+			if (value == static_cast<Int32>(value))
+			{
+				bytes({ 0x48, 0xc7 }); frame(0, payload_of(reg)); int32(static_cast<Int32>(value));
+			}
+			else
+			{
+				mov(Reg::rax, bits);
+				store_payload(reg, Reg::rax);
+			}
+		}
+
+		inline void cmp_payload_zero(unsigned int reg) { bytes({ 0x48, 0x83 }); frame(7, payload_of(reg)); byte(0); }
+		inline void cmp_payload_byte_zero(unsigned int reg) { byte(0x80); frame(7, payload_of(reg)); byte(0); }
+
+		inline void alu(Alu op, Reg dst, Reg src)
+		{
+			if (op == Alu::imul)
+			{
+				rex(true, code(dst), code(src)); bytes({ 0x0f, 0xaf }); direct(code(dst), code(src));
+			}
+			else
+			{
+				rex(true, code(src), code(dst)); byte(static_cast<UInt8>(op)); direct(code(src), code(dst));
+			}
+		}
+
+		// dst op= payload of reg.
+		inline void alu(Alu op, Reg dst, unsigned int reg)
+		{
+			rex(true, code(dst), 0);
+			if (op == Alu::imul)
+				bytes({ 0x0f, 0xaf });
+			else byte(static_cast<UInt8>(static_cast<UInt8>(op) + 2));
+			frame(code(dst), payload_of(reg));
+		}
+
+		inline void test(Reg reg) { rex(true, code(reg), code(reg)); byte(0x85); direct(code(reg), code(reg)); }
+		inline void dec(Reg reg) { rex(true, 0, code(reg)); byte(0xff); direct(1, code(reg)); }
+
+		inline void movsd(Xmm dst, Xmm src) { byte(0xf2); rex(false, code(dst), code(src)); bytes({ 0x0f, 0x10 }); direct(code(dst), code(src)); }
+		inline void load_float(Xmm dst, unsigned int reg) { byte(0xf2); rex(false, code(dst), 0); bytes({ 0x0f, 0x10 }); frame(code(dst), payload_of(reg)); }
+		inline void store_float(unsigned int reg, Xmm src) { byte(0xf2); rex(false, code(src), 0); bytes({ 0x0f, 0x11 }); frame(code(src), payload_of(reg)); }
+		inline void movq(Xmm dst, Reg src) { byte(0x66); rex(true, code(dst), code(src)); bytes({ 0x0f, 0x6e }); direct(code(dst), code(src)); }
+		inline void cvtsi2sd(Xmm dst, Reg src) { byte(0xf2); rex(true, code(dst), code(src)); bytes({ 0x0f, 0x2a }); direct(code(dst), code(src)); }
+		inline void sse(Sse op, Xmm dst, Xmm src) { byte(0xf2); rex(false, code(dst), code(src)); bytes({ 0x0f, static_cast<UInt8>(op) }); direct(code(dst), code(src)); }
+		inline void ucomisd(Xmm left, Xmm right) { byte(0x66); rex(false, code(left), code(right)); bytes({ 0x0f, 0x2e }); direct(code(left), code(right)); }
+
+		inline void type_pair() { bytes({ 0xc1, 0xe0, 0x04, 0x09, 0xc8 }); }		// shl eax, 4; or eax, ecx
+		inline void cmp_eax(UInt8 value) { bytes({ 0x83, 0xf8, value }); }
+		inline void test_eax() { bytes({ 0x85, 0xc0 }); }
+
+		inline void cmp_fuel_zero() { bytes({ 0x49, 0x83, 0x3c, 0x24, 0x00 }); }	// cmp qword [r12], 0
+		inline void dec_fuel() { bytes({ 0x49, 0xff, 0x0c, 0x24 }); }			// dec qword [r12]
+	};
+
+	// Operand B or C of an instruction.
+	struct Operand
+	{
+		const Value* constant;		// nullptr for a register
+		unsigned int reg;
+
+		inline bool can_be(DataType type) const { return !constant || constant->type() == type; }
+	};
+
+	inline bool is_scalar(const Value& value)
+	{
+		return value.isNull() || value.isInteger() || value.isFloat() || value.isBoolean();
+	}
+
+	// Payload of a scalar constant as the generated code stores it.
+	inline UInt64 payload_bits(const Value& value)
+	{
+		switch (value.type())
+		{
+			case DataType::Integer: return static_cast<UInt64>(value.integral());
+			case DataType::Float: {
+				UInt64 bits;
+				const type::Float floating = value.floating();
+				std::memcpy(&bits, &floating, sizeof(bits));
+				return bits;
+			}
+			case DataType::Boolean: return value.boolean() ? 1 : 0;
+			default: return 0;
+		}
+	}
+
+	// Exits when a double comparison of left and right, already set by ucomisd, does not go
+	// the way taken says. op is one of the comparison opcodes; LS and LE expect the operands
+	// of ucomisd swapped. Unordered operands compare false, and so unequal, as they do in C++.
+	inline void float_guard(Assembler& assembler, opcode::id op, bool taken, Assembler::Label exit)
+	{
+		switch (op)
+		{
+			case opcode::id::EQ:
+			case opcode::id::NE: {
+				// EQ holds when ZF is set and PF is clear.
+				const bool equal = (op == opcode::id::EQ) == taken;
+				if (equal)
+				{
+					assembler.jcc(Condition::parity, exit);
+					assembler.jcc(Condition::not_equal, exit);
+				}
+				else
+				{
+					const Assembler::Label unordered = assembler.label();
+					assembler.jcc(Condition::parity, unordered);
+					assembler.jcc(Condition::equal, exit);
+					assembler.bind(unordered);
+				}
+			} break;
+
+			case opcode::id::GR:
+			case opcode::id::LS:
+				assembler.jcc(taken ? Condition::below_equal : Condition::above, exit);
+				break;
+
+			default:
+				assembler.jcc(taken ? Condition::below : Condition::above_equal, exit);
+				break;
+		}
+	}
+}
+#endif
@@ -8,30 +8,47 @@ namespace kpl
 {
 	class GlobalsManager
 	{
+	public:
+		static constexpr UInt32 no_slot = 0xffffffff;
+
 	private:
-		std::unordered_map<std::string, Value> _values;
+		std::unordered_map<std::string, UInt32> _names;
+		std::vector<Value> _slots;
+		UInt64 _serial;
 		Value _nullvalue = nullptr;
 
 	public:
-		GlobalsManager() = default;
-		GlobalsManager(const GlobalsManager&) = default;
-		GlobalsManager(GlobalsManager&&) noexcept = default;
+		inline GlobalsManager() : _serial{ next_serial() } {}
+		inline GlobalsManager(const GlobalsManager& globals) : _names{ globals._names }, _slots{ globals._slots }, _serial{ next_serial() } {}
+		GlobalsManager(GlobalsManager&& globals) noexcept;
 		~GlobalsManager() = default;
 
-		GlobalsManager& operator= (const GlobalsManager&) = default;
-		GlobalsManager& operator= (GlobalsManager&&) noexcept = default;
+		GlobalsManager& operator= (const GlobalsManager& right);
+		GlobalsManager& operator= (GlobalsManager&& right) noexcept;
+
+		// Slot of a global name in this manager, added the first time the name is used. Slots
+		// are never removed, so a Chunk linked to this manager keeps valid slots.
+		UInt32 slot(const std::string& name);
+		UInt32 find_slot(const std::string& name) const;
+
+		// Unique among all managers, and renewed when the slots stop matching the names, which
+		// tells Chunk::link_globals whether a chunk has to be linked again.
+		inline UInt64 serial() const { return _serial; }
+
+		inline const Value& get_slot(UInt32 slot) const { return slot < _slots.size() ? _slots[slot] : _nullvalue; }
+		inline void set_slot(UInt32 slot, const Value& value) { _slots[slot] = value; }
 
 		const Value& get_value(const std::string& name) const;
 
-		inline void set_value(const std::string& name, const Value& value) { _values[name] = value; }
-		inline void set_value(const std::string& name, Value&& value) { _values[name] = std::move(value); }
-		inline void delete_value(const std::string& name) { _values.erase(name); }
+		inline void set_value(const std::string& name, const Value& value) { set_slot(slot(name), value); }
+		inline void set_value(const std::string& name, Value&& value) { set_slot(slot(name), std::move(value)); }
+		void delete_value(const std::string& name);
 
 		inline void set_value(const Value& name, const Value& value)
 		{
 			if (name.type() == DataType::String)
-				_values[name.string()] = value;
-			else _values[name.to_string()] = value;
+				set_value(name.string(), value);
+			else set_value(name.to_string(), value);
 		}
 		inline const Value& get_value(const Value& name) const
 		{
@@ -42,9 +59,12 @@ namespace kpl
 		inline void delete_value(const Value& name)
 		{
 			if (name.type() == DataType::String)
-				_values.erase(name.string());
-			else _values.erase(name.to_string());
+				delete_value(name.string());
+			else delete_value(name.to_string());
 		}
+
+	private:
+		static UInt64 next_serial();
 	};
 
 
@@ -53,15 +73,52 @@ namespace kpl
 	{
 	public:
 		friend Value runtime::execute(KPLState& state, Function& function, const Value& self, const CallArguments& args);
+		friend struct runtime::RuntimeState;
+
+		static constexpr Int64 unlimited_fuel = std::numeric_limits<Int64>::max();
 
 	private:
 		MemoryHeap _heap;
 		GlobalsManager _globals;
 		runtime::CallStack _calls;
 		runtime::RegisterStack _regs;
+		Int64 _fuel = unlimited_fuel;
+		bool _jit = true;
+		BreakpointHandler* _breakpoints = nullptr;
 
 	public:
 		KPLState() = default;
 		~KPLState() = default;
+
+		// Sizes in bytes of the script call and register stacks. They are only reserved up
+		// front; exceeding them throws runtime::StackOverflow.
+		inline KPLState(Size call_stack_size, Size register_stack_size) :
+			_calls{ call_stack_size },
+			_regs{ register_stack_size }
+		{}
+
+		inline GlobalsManager& globals() { return _globals; }
+		inline const GlobalsManager& globals() const { return _globals; }
+
+		// Instruction budget shared by every script run on this state. One unit is spent per
+		// backward jump and per call; see runtime::OutOfFuel for what happens at zero.
+		inline Int64 fuel() const { return _fuel; }
+		inline void set_fuel(Int64 fuel) { _fuel = fuel; }
+
+		// Whether chunks that get hot are compiled to machine code. Turning it off makes every
+		// compiled chunk drop its machine code the next time it runs.
+		inline bool jit_enabled() const { return _jit; }
+		inline void set_jit_enabled(bool enabled) { _jit = enabled; }
+
+		// Handler of the breakpoints reached by scripts run on this state. Without one they are
+		// run through.
+		inline BreakpointHandler* breakpoint_handler() const { return _breakpoints; }
+		inline void set_breakpoint_handler(BreakpointHandler* handler) { _breakpoints = handler; }
+
+		inline void set_hooks(RuntimeHooks* hooks)
+		{
+			MemoryHeap::set_hooks(hooks);
+			_heap.set_hooks(hooks);
+		}
 	};
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "hooks.h"
 
 namespace kpl
 {
@@ -71,6 +72,7 @@ namespace kpl
 	private:
 		MemoryBlock* _front;
 		MemoryBlock* _back;
+		RuntimeHooks* _hooks;
 
 	public:
 		MemoryHeap(const MemoryHeap&) = delete;
@@ -85,6 +87,9 @@ namespace kpl
 
 		void garbage_collector();
 
+		inline RuntimeHooks* hooks() const { return _hooks; }
+		inline void set_hooks(RuntimeHooks* hooks) { _hooks = hooks; }
+
 	private:
 		MemoryBlock* malloc(Size size, void (*destructor)(void*) = nullptr);
 		void free(MemoryBlock* block);
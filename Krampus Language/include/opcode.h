@@ -2,6 +2,166 @@
 
 #include "common.h"
 
+
+// Expands _Op(NAME##_Kind) for every opcode that has register/constant operand variants.
+// An empty _Kind names the opcodes themselves; _RR, _RK and _KR name one variant block.
+#define __KPL_SPECIALIZED_OPCODE_LIST(_Op, _Kind) \
+	_Op(ADD##_Kind) \
+	_Op(SUB##_Kind) \
+	_Op(MUL##_Kind) \
+	_Op(DIV##_Kind) \
+	_Op(EQ##_Kind) \
+	_Op(NE##_Kind) \
+	_Op(GR##_Kind) \
+	_Op(LS##_Kind) \
+	_Op(GE##_Kind) \
+	_Op(LE##_Kind) \
+	_Op(EQ_JP##_Kind) \
+	_Op(NE_JP##_Kind) \
+	_Op(GR_JP##_Kind) \
+	_Op(LS_JP##_Kind) \
+	_Op(GE_JP##_Kind) \
+	_Op(LE_JP##_Kind) \
+	_Op(ADD_II##_Kind) \
+	_Op(ADD_FF##_Kind) \
+	_Op(SUB_II##_Kind) \
+	_Op(SUB_FF##_Kind) \
+	_Op(MUL_II##_Kind) \
+	_Op(MUL_FF##_Kind) \
+	_Op(DIV_II##_Kind) \
+	_Op(DIV_FF##_Kind) \
+	_Op(EQ_II##_Kind) \
+	_Op(NE_II##_Kind) \
+	_Op(GR_II##_Kind) \
+	_Op(LS_II##_Kind) \
+	_Op(GE_II##_Kind) \
+	_Op(LE_II##_Kind) \
+	_Op(EQ_JP_II##_Kind) \
+	_Op(NE_JP_II##_Kind) \
+	_Op(GR_JP_II##_Kind) \
+	_Op(LS_JP_II##_Kind) \
+	_Op(GE_JP_II##_Kind) \
+	_Op(LE_JP_II##_Kind) \
+	_Op(GR_JP_FF##_Kind) \
+	_Op(LS_JP_FF##_Kind) \
+	_Op(GE_JP_FF##_Kind) \
+	_Op(LE_JP_FF##_Kind)
+
+// Expands _Op(NAME) for every opcode, in id order. Used to build dispatch tables.
+#define __KPL_OPCODE_LIST(_Op) \
+	_Op(NOP) \
+	_Op(MOVE) \
+	_Op(LOAD_K) \
+	_Op(LOAD_BOOL) \
+	_Op(LOAD_NULL) \
+	_Op(LOAD_INT) \
+	_Op(GET_GLOBAL) \
+	_Op(GET_LOCAL) \
+	_Op(GET_PROP) \
+	_Op(SET_GLOBAL) \
+	_Op(SET_LOCAL) \
+	_Op(SET_PROP) \
+	_Op(NEW_ARRAY) \
+	_Op(NEW_LIST) \
+	_Op(NEW_OBJECT) \
+	_Op(SET_AL) \
+	_Op(SELF) \
+	_Op(ADD) \
+	_Op(SUB) \
+	_Op(MUL) \
+	_Op(DIV) \
+	_Op(IDIV) \
+	_Op(MOD) \
+	_Op(EQ) \
+	_Op(NE) \
+	_Op(GR) \
+	_Op(LS) \
+	_Op(GE) \
+	_Op(LE) \
+	_Op(SHL) \
+	_Op(SHR) \
+	_Op(BAND) \
+	_Op(BOR) \
+	_Op(XOR) \
+	_Op(BNOT) \
+	_Op(NOT) \
+	_Op(NEG) \
+	_Op(LEN) \
+	_Op(IN) \
+	_Op(INSTANCEOF) \
+	_Op(GET) \
+	_Op(SET) \
+	_Op(JP) \
+	_Op(TEST) \
+	_Op(TEST_SET) \
+	_Op(CALL) \
+	_Op(INVOKE) \
+	_Op(RETURN) \
+	_Op(YIELD) \
+	_Op(RESUME) \
+	_Op(FORPREP) \
+	_Op(FORLOOP) \
+	_Op(ITER_PREP) \
+	_Op(ITER_NEXT) \
+	_Op(SWITCH) \
+	_Op(THROW) \
+	_Op(RETURN_MULTI) \
+	_Op(VARARG) \
+	_Op(VARARGS) \
+	_Op(ARG_COUNT) \
+	_Op(EQ_JP) \
+	_Op(NE_JP) \
+	_Op(GR_JP) \
+	_Op(LS_JP) \
+	_Op(GE_JP) \
+	_Op(LE_JP) \
+	_Op(TEST_JP) \
+	_Op(LOAD_K_ADD) \
+	_Op(LOAD_K_SUB) \
+	_Op(LOAD_K_GET) \
+	_Op(LOAD_INT_ADD) \
+	_Op(LOAD_INT_SUB) \
+	_Op(LOAD_INT_GET) \
+	_Op(GET_PROP_CALL) \
+	_Op(ADD_II) \
+	_Op(ADD_FF) \
+	_Op(SUB_II) \
+	_Op(SUB_FF) \
+	_Op(MUL_II) \
+	_Op(MUL_FF) \
+	_Op(DIV_II) \
+	_Op(DIV_FF) \
+	_Op(EQ_II) \
+	_Op(NE_II) \
+	_Op(GR_II) \
+	_Op(LS_II) \
+	_Op(GE_II) \
+	_Op(LE_II) \
+	_Op(EQ_JP_II) \
+	_Op(NE_JP_II) \
+	_Op(GR_JP_II) \
+	_Op(LS_JP_II) \
+	_Op(GE_JP_II) \
+	_Op(LE_JP_II) \
+	_Op(GR_JP_FF) \
+	_Op(LS_JP_FF) \
+	_Op(GE_JP_FF) \
+	_Op(LE_JP_FF) \
+	_Op(GET_GLOBAL_SLOT) \
+	_Op(SET_GLOBAL_SLOT) \
+	_Op(TAILCALL) \
+	_Op(FORLOOP_INT) \
+	_Op(FORLOOP_FLOAT) \
+	_Op(NATIVE) \
+	_Op(RECORD) \
+	_Op(TRACE) \
+	_Op(BREAK) \
+	_Op(INVALID) \
+	__KPL_SPECIALIZED_OPCODE_LIST(_Op, _RR) \
+	__KPL_SPECIALIZED_OPCODE_LIST(_Op, _RK) \
+	__KPL_SPECIALIZED_OPCODE_LIST(_Op, _KR)
+
+
 namespace kpl::opcode
 {
 	enum class id : UInt8
@@ -51,15 +211,181 @@ namespace kpl::opcode
 		JP,			// Ax
 		TEST,		// KB C
 		TEST_SET,	// A KB C
-		CALL,		// A B
+		CALL,		// A B C
 		INVOKE,		// A KB C
 		RETURN,		// A KB
+		YIELD,		// A KB
+		RESUME,		// A KB KC
+		FORPREP,	// A Bx
+		FORLOOP,	// A Bx
+		ITER_PREP,	// A Bx
+		ITER_NEXT,	// A Bx
+		SWITCH,		// KB C
+		THROW,		// KB
+		RETURN_MULTI,	// A B
+		VARARG,		// A B C
+		VARARGS,	// A B
+		ARG_COUNT,	// A
+
+		// Superinstructions. Never encoded in bytecode: ChunkBuilder writes them to the
+		// dispatch opcodes of the first instruction of a fused pair. The second
+		// instruction keeps its own opcode so jumps into the pair stay valid.
+		EQ_JP,			// KB KC + JP Ax
+		NE_JP,			// KB KC + JP Ax
+		GR_JP,			// KB KC + JP Ax
+		LS_JP,			// KB KC + JP Ax
+		GE_JP,			// KB KC + JP Ax
+		LE_JP,			// KB KC + JP Ax
+		TEST_JP,		// KB C + JP Ax
+		LOAD_K_ADD,		// A Bx + ADD A KB KC
+		LOAD_K_SUB,		// A Bx + SUB A KB KC
+		LOAD_K_GET,		// A Bx + GET A KB KC
+		LOAD_INT_ADD,	// A sBx + ADD A KB KC
+		LOAD_INT_SUB,	// A sBx + SUB A KB KC
+		LOAD_INT_GET,	// A sBx + GET A KB KC
+		GET_PROP_CALL,	// A KB KC + CALL A B
+
+		// Quickened opcodes. The interpreter writes them over ADD..LE and the fused
+		// compare jumps once it has seen the operand types. They check both types
+		// with one compare and restore the generic opcode when the check fails.
+		ADD_II,			// A KB KC
+		ADD_FF,			// A KB KC
+		SUB_II,			// A KB KC
+		SUB_FF,			// A KB KC
+		MUL_II,			// A KB KC
+		MUL_FF,			// A KB KC
+		DIV_II,			// A KB KC
+		DIV_FF,			// A KB KC
+		EQ_II,			// KB KC
+		NE_II,			// KB KC
+		GR_II,			// KB KC
+		LS_II,			// KB KC
+		GE_II,			// KB KC
+		LE_II,			// KB KC
+		EQ_JP_II,		// KB KC + JP Ax
+		NE_JP_II,		// KB KC + JP Ax
+		GR_JP_II,		// KB KC + JP Ax
+		LS_JP_II,		// KB KC + JP Ax
+		GE_JP_II,		// KB KC + JP Ax
+		LE_JP_II,		// KB KC + JP Ax
+		GR_JP_FF,		// KB KC + JP Ax
+		LS_JP_FF,		// KB KC + JP Ax
+		GE_JP_FF,		// KB KC + JP Ax
+		LE_JP_FF,		// KB KC + JP Ax
+
+		// Global accesses by a constant name. The Chunk resolves the name to a slot of
+		// the GlobalsManager running it, stored per constant.
+		GET_GLOBAL_SLOT,	// A B
+		SET_GLOBAL_SLOT,	// B KC
+
+		// CALL in tail position. ChunkBuilder selects it for a CALL A B directly followed
+		// by a RETURN of R(A); it runs the callee in the current frame and CallInfo.
+		TAILCALL,		// A B
+
+		// Quickened FORLOOP. FORPREP leaves the index, count or limit and step of a loop all
+		// integers or all floats; FORLOOP picks the matching variant on its first iteration.
+		FORLOOP_INT,	// A Bx
+		FORLOOP_FLOAT,	// A Bx
+
+		// Written by jit::compile over the instructions of a compiled chunk it has a template
+		// for. It runs the machine code from there and interprets the instruction it stopped at.
+		NATIVE,
+
+		// Written by jit::record_loop over a hot loop while one iteration of it is recorded.
+		RECORD,
+
+		// Written over the head of a traced loop. It runs the trace and interprets the
+		// instruction it left at.
+		TRACE,
+
+		// Written by Chunk::set_breakpoint. It reports the breakpoint and then runs the
+		// instruction with the dispatch opcode it replaced.
+		BREAK,
+
+		// Written by verifier::verify over instructions that failed verification. It raises an
+		// error instead of running the instruction.
+		INVALID,
+
+		// Operand-kind variants of __KPL_SPECIALIZED_OPCODE_LIST, one block per kind.
+		// ChunkBuilder selects them from the K bits, so their handlers never test them.
+#define __KPL_OPCODE_ENUM_ENTRY(_Name) _Name,
+		__KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_ENUM_ENTRY, _RR)
+		__KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_ENUM_ENTRY, _RK)
+		__KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_ENUM_ENTRY, _KR)
+#undef __KPL_OPCODE_ENUM_ENTRY
+	};
+
+	// Where the B and C operands of an opcode come from. Any reads the K bits at runtime.
+	enum class operands : UInt8
+	{
+		Any,
+		RR,		// R(B) R(C)
+		RK,		// R(B) K(C)
+		KR,		// K(B) R(C)
 	};
 
 
+#define __KPL_OPCODE_ID(_Name) id::_Name,
+	static constexpr id specialized[] = { __KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_ID, ) };
+#undef __KPL_OPCODE_ID
+
+	static constexpr unsigned int specialized_count = sizeof(specialized) / sizeof(*specialized);
+	static constexpr unsigned int first_variant = static_cast<unsigned int>(id::ADD_RR);
+
+	static constexpr unsigned int count = first_variant + specialized_count * 3;
+	static constexpr unsigned int bytecode_count = static_cast<unsigned int>(id::ARG_COUNT) + 1;
+
+	static_assert(count <= 256, "opcode::id must fit in a UInt8");
+	static_assert(bytecode_count <= 64, "bytecode opcodes must fit in 6 bits");
+
+	static constexpr bool is_bytecode(id opcode_id) { return static_cast<unsigned int>(opcode_id) < bytecode_count; }
+
+	static constexpr operands operand_kind(id opcode_id)
+	{
+		const unsigned int index = static_cast<unsigned int>(opcode_id);
+		if (index < first_variant)
+			return operands::Any;
+
+		return static_cast<operands>(1 + (index - first_variant) / specialized_count);
+	}
+
+	// Returns the opcode an operand-kind variant was selected from.
+	static constexpr id operand_base(id opcode_id)
+	{
+		const unsigned int index = static_cast<unsigned int>(opcode_id);
+		if (index < first_variant)
+			return opcode_id;
+
+		return specialized[(index - first_variant) % specialized_count];
+	}
+
+	// Returns the variant of opcode_id for the given operand kind, or opcode_id if it has none.
+	static constexpr id operand_variant(id opcode_id, operands kind)
+	{
+		if (kind == operands::Any)
+			return opcode_id;
+
+		for (unsigned int i = 0; i < specialized_count; ++i)
+			if (specialized[i] == opcode_id)
+				return static_cast<id>(first_variant + (static_cast<unsigned int>(kind) - 1) * specialized_count + i);
+
+		return opcode_id;
+	}
+
+	// Whether the dispatch opcode runs its instruction together with the next one.
+	static constexpr bool is_superinstruction(id opcode_id)
+	{
+		const id base = operand_base(opcode_id);
+		return (base >= id::EQ_JP && base <= id::GET_PROP_CALL) || (base >= id::EQ_JP_II && base <= id::LE_JP_FF);
+	}
+
+
 
 	static constexpr const char* name(id opcode_id)
 	{
+		if (operand_kind(opcode_id) != operands::Any)
+			opcode_id = operand_base(opcode_id);
+
 		switch (opcode_id)
 		{
 			case id::NOP: return "nop";
@@ -110,6 +436,74 @@ namespace kpl::opcode
 			case id::CALL: return "call";
 			case id::INVOKE: return "invoke";
 			case id::RETURN: return "return";
+			case id::YIELD: return "yield";
+			case id::RESUME: return "resume";
+			case id::FORPREP: return "forprep";
+			case id::FORLOOP: return "forloop";
+			case id::ITER_PREP: return "iter_prep";
+			case id::ITER_NEXT: return "iter_next";
+			case id::SWITCH: return "switch";
+			case id::THROW: return "throw";
+			case id::RETURN_MULTI: return "return_multi";
+			case id::VARARG: return "vararg";
+			case id::VARARGS: return "varargs";
+			case id::ARG_COUNT: return "arg_count";
+			case id::EQ_JP: return "eq_jp";
+			case id::NE_JP: return "ne_jp";
+			case id::GR_JP: return "gr_jp";
+			case id::LS_JP: return "ls_jp";
+			case id::GE_JP: return "ge_jp";
+			case id::LE_JP: return "le_jp";
+			case id::TEST_JP: return "test_jp";
+			case id::LOAD_K_ADD: return "load_k_add";
+			case id::LOAD_K_SUB: return "load_k_sub";
+			case id::LOAD_K_GET: return "load_k_get";
+			case id::LOAD_INT_ADD: return "load_int_add";
+			case id::LOAD_INT_SUB: return "load_int_sub";
+			case id::LOAD_INT_GET: return "load_int_get";
+			case id::GET_PROP_CALL: return "get_prop_call";
+			case id::ADD_II: return "add_ii";
+			case id::ADD_FF: return "add_ff";
+			case id::SUB_II: return "sub_ii";
+			case id::SUB_FF: return "sub_ff";
+			case id::MUL_II: return "mul_ii";
+			case id::MUL_FF: return "mul_ff";
+			case id::DIV_II: return "div_ii";
+			case id::DIV_FF: return "div_ff";
+			case id::EQ_II: return "eq_ii";
+			case id::NE_II: return "ne_ii";
+			case id::GR_II: return "gr_ii";
+			case id::LS_II: return "ls_ii";
+			case id::GE_II: return "ge_ii";
+			case id::LE_II: return "le_ii";
+			case id::EQ_JP_II: return "eq_jp_ii";
+			case id::NE_JP_II: return "ne_jp_ii";
+			case id::GR_JP_II: return "gr_jp_ii";
+			case id::LS_JP_II: return "ls_jp_ii";
+			case id::GE_JP_II: return "ge_jp_ii";
+			case id::LE_JP_II: return "le_jp_ii";
+			case id::GR_JP_FF: return "gr_jp_ff";
+			case id::LS_JP_FF: return "ls_jp_ff";
+			case id::GE_JP_FF: return "ge_jp_ff";
+			case id::LE_JP_FF: return "le_jp_ff";
+			case id::GET_GLOBAL_SLOT: return "get_global_slot";
+			case id::SET_GLOBAL_SLOT: return "set_global_slot";
+			case id::TAILCALL: return "tailcall";
+			case id::FORLOOP_INT: return "forloop_int";
+			case id::FORLOOP_FLOAT: return "forloop_float";
+			case id::NATIVE: return "native";
+			case id::RECORD: return "record";
+			case id::TRACE: return "trace";
+			case id::BREAK: return "break";
+			case id::INVALID: return "invalid";
+
+			// Operand-kind variants were replaced by their base opcode above.
+#define __KPL_OPCODE_CASE(_Name) case id::_Name:
+			__KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_CASE, _RR)
+			__KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_CASE, _RK)
+			__KPL_SPECIALIZED_OPCODE_LIST(__KPL_OPCODE_CASE, _KR)
+#undef __KPL_OPCODE_CASE
+				break;
 		}
 
 		return "<unknown-opcode>";
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "chunk.h"
+
+namespace kpl::optimizer
+{
+	// Fills flags, one byte per register of chunk, with the register_flag bits of each register.
+	void analyze_registers(const Chunk& chunk, UInt8* flags);
+
+	// Rewrites the dispatch opcode of a CALL A B directly followed by RETURN R(A) to TAILCALL,
+	// unless the CALL is inside a try region or chunk is variadic.
+	void select_tail_calls(Chunk& chunk);
+
+	// Rewrites the dispatch opcodes of common instruction pairs to superinstructions.
+	void fuse_superinstructions(Chunk& chunk);
+
+	// Gives the first instruction of the superinstruction the instruction at offset is the
+	// second half of, if any, its own generic opcode back, so both are dispatched on their own.
+	void split_superinstruction(Chunk& chunk, Offset offset);
+
+	// Rewrites the dispatch opcodes of __KPL_SPECIALIZED_OPCODE_LIST to the variant matching their K bits.
+	void specialize_operands(Chunk& chunk);
+}
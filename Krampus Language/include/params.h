@@ -4,12 +4,25 @@
 
 namespace kpl
 {
+	// Arguments of a call from the host. A single Value or an array of them is passed by
+	// reference; lists are copied, to storage inside the object when they are short.
 	class CallArguments
 	{
+	public:
+		// Size and alignment of a Value. data_types.h includes this file before Value is complete,
+		// so they cannot be taken from it here; it checks them against Value once it is.
+		static constexpr Size value_size = 16;
+		static constexpr Size value_alignment = 8;
+
 	private:
+		static constexpr Size inline_capacity = 4;
+
 		Size _size;
 		Value* _args;
 		bool _allocated;
+		alignas(value_alignment) Byte _inline[inline_capacity * value_size];
+
+		Value* allocate();
 
 	public:
 		inline CallArguments(Value* args, Size count) :
@@ -24,6 +37,9 @@ namespace kpl
 			_allocated{ false }
 		{}
 
+		CallArguments(const CallArguments&) = delete;
+		CallArguments& operator= (const CallArguments&) = delete;
+
 		inline operator bool() const { return _size; }
 		inline bool operator! () const { return !_size; }
 
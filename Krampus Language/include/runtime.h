@@ -2,6 +2,32 @@
 
 #include "instruction.h"
 #include "data_types.h"
+#include "chunk.h"
+#include "vmem.h"
+
+
+// Dispatch engine used by runtime::execute. Define KPL_DISPATCH to one of the
+// values below to override the default for the current compiler.
+#define KPL_DISPATCH_SWITCH 0		// Portable switch loop
+#define KPL_DISPATCH_GOTO 1			// Token threaded table (labels-as-values, GCC/Clang)
+#define KPL_DISPATCH_TAILCALL 2		// One function per opcode chained by guaranteed tail calls (Clang)
+
+#ifndef KPL_DISPATCH
+#	if defined(__GNUC__) || defined(__clang__)
+#		define KPL_DISPATCH KPL_DISPATCH_GOTO
+#	else
+#		define KPL_DISPATCH KPL_DISPATCH_SWITCH
+#	endif
+#endif
+
+#if KPL_DISPATCH == KPL_DISPATCH_GOTO && !defined(__GNUC__) && !defined(__clang__)
+#	error "KPL_DISPATCH_GOTO requires labels-as-values (GCC or Clang)"
+#endif
+
+#if KPL_DISPATCH == KPL_DISPATCH_TAILCALL && !(defined(__clang__) && __has_cpp_attribute(clang::musttail))
+#	error "KPL_DISPATCH_TAILCALL requires [[clang::musttail]]"
+#endif
+
 
 namespace kpl::runtime
 {
@@ -9,6 +35,21 @@ namespace kpl::runtime
 	typedef type::Function Function;
 	class Parameters;
 
+	struct RuntimeState;
+
+	// What the caller does with the value returned by a frame pushed from inside the dispatch loop.
+	enum class ReturnAction : UInt8
+	{
+		Store,			// Write it to CallInfo::ret, if any
+		SkipIfTrue,		// Skip the caller's next instruction if it is true (comparison metamethods)
+		SkipIfFalse,	// Skip the caller's next instruction if it is false (__ne__ through __eq__)
+		Keep			// Native entries only: store it to the return value but leave the frame open (execute_batch)
+	};
+
+	// Saved state of the caller. Native entries (function == nullptr) mark a host boundary
+	// and keep the register window that was active when runtime::execute was entered.
+	// args and results describe the frame called from it: the number of arguments it was
+	// passed and how many values the caller expects at ret.
 	struct CallInfo
 	{
 		Register* top;
@@ -16,18 +57,35 @@ namespace kpl::runtime
 		Function* function;
 		CallInfo* prev;
 		Offset instruction;
+		Register* ret;
+		UInt32 args;
+		UInt8 results;
+		ReturnAction action;
+	};
+
+	// Thrown when a CallStack or RegisterStack would grow past the size it was created with.
+	class StackOverflow : public std::exception
+	{
+	public:
+		inline const char* what() const noexcept override { return "Script stack overflow"; }
 	};
 
 	class RegisterStack;
 
+	// CallStack and RegisterStack reserve their whole size as address space and commit it as
+	// frames are pushed, so an idle or shallow state only pays for the pages it touched.
 	class CallStack
 	{
 	public:
 		static constexpr int default_size = 32768 * sizeof(CallInfo);
 
 	private:
+		utils::ReservedBlock _memory;
 		CallInfo* _base;
 		CallInfo* _top;
+		CallInfo* _end;
+
+		void grow(const CallInfo* info);
 
 	public:
 		CallStack(const CallStack&) = delete;
@@ -39,12 +97,15 @@ namespace kpl::runtime
 		CallStack(Size size = default_size);
 		~CallStack();
 		
-		CallInfo* push(RegisterStack& regs, Function& function, Offset instruction);
+		CallInfo* push(RegisterStack& regs, Function& function, Offset instruction, Register* ret = nullptr, ReturnAction action = ReturnAction::Store,
+			unsigned int args = 0, unsigned int results = 1);
 		CallInfo* pop();
 
-		void push_native();
+		void push_native(RegisterStack& regs, unsigned int args = 0);
 
 		inline CallInfo* top() { return _top; }
+		inline CallInfo* base() { return _base; }
+		inline Size capacity() const { return _memory.size() / sizeof(CallInfo); }
 	};
 
 	class RegisterStack
@@ -53,12 +114,20 @@ namespace kpl::runtime
 		static constexpr int default_size = 65536 * sizeof(Register);
 
 	private:
+		utils::ReservedBlock _memory;
 		Register* _base;
+		Register* _end;
 
 		Register* _top;
 		Register* _regs;
 		Register* _bottom;
 
+		void grow(const Register* top);
+		inline void reserve(const Register* top) { if (top >= _end) [[unlikely]] grow(top); }
+
+		void open(const Chunk& chunk, unsigned int args);
+		void open_frame(const Chunk& chunk, const Value& self, Register* bottom, unsigned int args);
+
 	public:
 		RegisterStack(const RegisterStack&) = delete;
 		RegisterStack(RegisterStack&&) = delete;
@@ -70,29 +139,153 @@ namespace kpl::runtime
 		~RegisterStack();
 
 		void set(const CallInfo& info);
+
+		// Opens a frame for func whose self slot is R(bottom_reg), or the register above the
+		// current frame if it is negative, with the args registers above it as arguments.
+		// A variadic chunk gets its frame above the arguments instead, so they stay in place.
 		void set(const Function& func, const Value& self, int bottom_reg = -1, unsigned int args = 0);
 
-		void push_args(const CallArguments& args, unsigned int max_args);
+		// Opens a frame for func above the current one and passes it args.
+		void set(const Function& func, const Value& self, std::span<const Value> args);
+		inline void set(const Function& func, const Value& self, const CallArguments& args)
+		{
+			set(func, self, std::span<const Value>{ args.data(), args.size() });
+		}
+
+		// Passes args again to the current frame, running chunk, as if it had just been opened
+		// with them. The frame has to have been opened with as many arguments.
+		void rebind(const Chunk& chunk, std::span<const Value> args);
 
-		void close();
+		// Reuses the current frame, running current, for func: self goes to the self slot and
+		// R(first_arg) .. R(first_arg + args - 1) are moved down to R(0).
+		void replace(const Chunk& current, const Function& func, const Value& self, unsigned int first_arg, unsigned int args);
+
+		void push_args(const CallArguments& args, const Chunk& chunk);
+
+		// Releases the self slot, the registers chunk may have stored a reference in and, for a
+		// variadic chunk, its args arguments. Registers below keep are left alone.
+		void close(const Chunk& chunk, unsigned int args, const Register* keep = nullptr);
 
 		inline void write(unsigned int id, const Value& value) { _regs[id] = value; }
 		inline const Value& read(unsigned int id) { return _regs[id]; }
 		inline void move(unsigned int dst, unsigned int src) { _regs[dst] = _regs[src]; }
 
+		// Writes argument id of a frame of chunk that was opened with no arguments.
+		// Arguments the chunk never reads are dropped.
+		inline void write_arg(const Chunk& chunk, unsigned int id, const Value& value)
+		{
+			if (id < chunk.register_count() && (chunk.register_flags()[id] & register_flag::read_on_entry))
+				_regs[id] = value;
+		}
+
 		inline Value& reg(unsigned int id) { return _regs[id]; }
 		inline const Value& reg(unsigned int id) const { return _regs[id]; }
 
+		// Arguments of a variadic frame that was passed count of them.
+		inline Value* arguments(unsigned int count) { return _bottom - count; }
+
 		inline Value& self() { return *_bottom; }
 		inline const Value& self() const { return *_bottom; }
 
 		inline void set_self(const Value& value) { *_bottom = value; }
 
+		inline Size capacity() const { return _memory.size() / sizeof(Register); }
+
 		friend class CallStack;
 	};
 
 
 
 
+	// Thrown when the fuel of a KPLState runs out outside of a coroutine. A coroutine is
+	// preempted instead, and resume continues it once the host has refilled the budget.
+	class OutOfFuel : public std::exception
+	{
+	public:
+		inline const char* what() const noexcept override { return "Instruction budget exhausted"; }
+	};
+
+	// Raised by THROW. Script errors, this and BadValueOperation, go to the try regions of the
+	// running frames first and only leave runtime::execute when none of them handles the error.
+	class ScriptError : public std::exception
+	{
+	private:
+		Value _value;
+
+	public:
+		inline explicit ScriptError(const Value& value) : _value{ value } {}
+
+		inline const Value& value() const { return _value; }
+
+		inline const char* what() const noexcept override { return "Unhandled script error"; }
+	};
+
+	// A script function running on its own CallStack and RegisterStack. YIELD suspends it and
+	// returns to whoever resumed it, leaving its frames in place until the next resume, so a
+	// parked coroutine holds no native stack.
+	class Coroutine : public type::Userdata
+	{
+	public:
+		static constexpr int default_call_stack_size = 256 * sizeof(CallInfo);
+		static constexpr int default_register_stack_size = 4096 * sizeof(Register);
+
+		enum class Status : UInt8
+		{
+			Suspended,		// Stopped at a YIELD
+			Preempted,		// Stopped because the state ran out of fuel
+			Running,
+			Dead
+		};
+
+	private:
+		CallStack _calls;
+		RegisterStack _regs;
+
+		Function* _function;
+		Value _self;
+		Offset _inst_offset;
+		Register* _resume_reg;
+		Status _status;
+		bool _started;
+
+	public:
+		Coroutine(const Coroutine&) = delete;
+		Coroutine(Coroutine&&) = delete;
+
+		Coroutine& operator= (const Coroutine&) = delete;
+		Coroutine& operator= (Coroutine&&) = delete;
+
+		Coroutine(Function& function, const Value& self = type::literal::Null,
+			Size call_stack_size = default_call_stack_size, Size register_stack_size = default_register_stack_size);
+		~Coroutine();
+
+		// Runs until the coroutine yields or returns and gives back the yielded or returned value.
+		// The first resume passes value as the first argument; later ones make it the result of YIELD.
+		// A preempted coroutine returns Null and ignores the value it is resumed with.
+		Value resume(KPLState& state, const Value& value = type::literal::Null);
+
+		inline Status status() const { return _status; }
+		inline bool dead() const { return _status == Status::Dead; }
+		inline bool preempted() const { return _status == Status::Preempted; }
+
+	private:
+		// Drops the frames still on the stacks, function running in the top one, and releases
+		// their registers.
+		void release(Function* function);
+
+	public:
+		friend struct RuntimeState;
+	};
+
+
+
 	Value execute(KPLState& state, Function& function, const Value& self, const CallArguments& args = CallArguments());
+
+	// Calls function once per element of results, args holding arg_count arguments for each of
+	// them one after the other, and stores the result of row i to results[i]. Equivalent to
+	// calling execute for every row, but the frame is opened once and only its arguments are
+	// rebound between rows, so the call is counted and the call hooks fire once for the batch.
+	// An exception stops the batch with the results of the rows before the failing one stored.
+	void execute_batch(KPLState& state, Function& function, const Value& self, std::span<const Value> args,
+		Size arg_count, std::span<Value> results);
 }
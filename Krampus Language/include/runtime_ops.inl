@@ -0,0 +1,565 @@
+// Opcode handlers for runtime::execute.
+// This file is included by runtime.cpp once per dispatch engine; op_begin, op_end,
+// end_inst and to_end are defined by the engine before including it.
+
+
+// Handlers of __KPL_SPECIALIZED_OPCODE_LIST are written once and expanded for every
+// operand kind: _Kind is empty for the opcode itself and _RR, _RK or _KR for its variants.
+// __KPL_EXPAND makes MSVC's traditional preprocessor split __VA_ARGS__ into arguments.
+#define __KPL_EXPAND(_X) _X
+#define __KPL_EACH_OPERAND_KIND(_Handler, ...) \
+	__KPL_EXPAND(_Handler(, __VA_ARGS__)) \
+	__KPL_EXPAND(_Handler(_RR, __VA_ARGS__)) \
+	__KPL_EXPAND(_Handler(_RK, __VA_ARGS__)) \
+	__KPL_EXPAND(_Handler(_KR, __VA_ARGS__))
+
+#define __KPL_BINARY_OPERANDS(_Kind, _Name) \
+	constexpr opcode::operands kind = opcode::operand_kind(opcode::id::_Name##_Kind); \
+	const Value& left = operand_b<kind>(runtime); \
+	const Value& right = operand_c<kind>(runtime);
+
+// Generic paths. Script metamethods of Object operands are entered as frames of this loop
+// before falling back to Value::runtime_*. A comparison metamethod frame skips the next
+// instruction itself when it returns true; for a fused JP that means the JP runs alone on false.
+#define __KPL_ARITH(_Method, _Property) \
+	if (!enter_metamethod(state, runtime, left, special_props::_Property, &R(A), ReturnAction::Store, right)) \
+		R(A) = left._Method(right, state);
+
+#define __KPL_COMPARE(_Method, _Enter) \
+	if (!_Enter(state, runtime, left, right) && left._Method(right, state)) \
+		++runtime.inst_offset;
+
+#define __KPL_COMPARE_JP(_Method, _Enter) \
+	if (_Enter(state, runtime, left, right)) {} \
+	else if (left._Method(right, state)) \
+		++runtime.inst_offset; \
+	else jump_fused;
+
+#define __KPL_ARITH_OP(_Kind, _Name, _Method, _Property) \
+op_begin(_Name##_Kind) \
+	__KPL_BINARY_OPERANDS(_Kind, _Name) \
+	quicken(runtime, left, right, opcode::id::_Name##_II##_Kind, opcode::id::_Name##_FF##_Kind); \
+	__KPL_ARITH(_Method, _Property) \
+	end_inst; \
+op_end
+
+#define __KPL_COMPARE_OP(_Kind, _Name, _FloatName, _Method, _Enter) \
+op_begin(_Name##_Kind) \
+	__KPL_BINARY_OPERANDS(_Kind, _Name) \
+	quicken(runtime, left, right, opcode::id::_Name##_II##_Kind, opcode::id::_FloatName##_Kind); \
+	__KPL_COMPARE(_Method, _Enter) \
+	end_inst; \
+op_end
+
+#define __KPL_COMPARE_JP_OP(_Kind, _Name, _FloatName, _Method, _Enter) \
+op_begin(_Name##_Kind) \
+	__KPL_BINARY_OPERANDS(_Kind, _Name) \
+	quicken(runtime, left, right, opcode::id::_Name##_II##_Kind, opcode::id::_FloatName##_Kind); \
+	__KPL_COMPARE_JP(_Method, _Enter) \
+	end_inst; \
+op_end
+
+#define __KPL_QUICK_ARITH_OP(_Kind, _Name, _Generic, _Types, _Result, _Method, _Property) \
+op_begin(_Name##_Kind) \
+	__KPL_BINARY_OPERANDS(_Kind, _Name) \
+	if (type_pair(left, right) == _Types) [[likely]] \
+		R(A) = _Result; \
+	else \
+	{ \
+		dequicken(runtime, opcode::id::_Generic##_Kind); \
+		__KPL_ARITH(_Method, _Property) \
+	} \
+	end_inst; \
+op_end
+
+#define __KPL_QUICK_COMPARE_OP(_Kind, _Name, _Generic, _Types, _Test, _Method, _Enter) \
+op_begin(_Name##_Kind) \
+	__KPL_BINARY_OPERANDS(_Kind, _Name) \
+	if (type_pair(left, right) == _Types) [[likely]] \
+	{ \
+		if (_Test) \
+			++runtime.inst_offset; \
+	} \
+	else \
+	{ \
+		dequicken(runtime, opcode::id::_Generic##_Kind); \
+		__KPL_COMPARE(_Method, _Enter) \
+	} \
+	end_inst; \
+op_end
+
+#define __KPL_QUICK_COMPARE_JP_OP(_Kind, _Name, _Generic, _Types, _Test, _Method, _Enter) \
+op_begin(_Name##_Kind) \
+	__KPL_BINARY_OPERANDS(_Kind, _Name) \
+	if (type_pair(left, right) == _Types) [[likely]] \
+	{ \
+		if (_Test) \
+			++runtime.inst_offset; \
+		else jump_fused; \
+	} \
+	else \
+	{ \
+		dequicken(runtime, opcode::id::_Generic##_Kind); \
+		__KPL_COMPARE_JP(_Method, _Enter) \
+	} \
+	end_inst; \
+op_end
+
+#define __KPL_BINARY_OP(_Name, _Method, _Property) \
+op_begin(_Name) \
+	const Value& left = RKB; \
+	const Value& right = RKC; \
+	__KPL_ARITH(_Method, _Property) \
+	end_inst; \
+op_end
+
+#define __KPL_UNARY_OP(_Name, _Method, _Property) \
+op_begin(_Name) \
+	const Value& operand = RKB; \
+	if (!enter_metamethod(state, runtime, operand, special_props::_Property, &R(A), ReturnAction::Store)) \
+		R(A) = operand._Method(state); \
+	end_inst; \
+op_end
+
+
+op_begin(NOP)
+	end_inst;
+op_end
+
+op_begin(MOVE)
+	REGS.move(A, B);
+	end_inst;
+op_end
+
+op_begin(LOAD_K)
+	R(A) = Kst(Bx);
+	end_inst;
+op_end
+
+op_begin(LOAD_BOOL)
+	R(A) = B ? true : false;
+	if (C)
+		runtime.inst_offset++;
+	end_inst;
+op_end
+
+op_begin(LOAD_NULL)
+	unsigned int to = B;
+	for (unsigned int i = A; i <= to; ++i)
+		R(i) = nullptr;
+	end_inst;
+op_end
+
+op_begin(LOAD_INT)
+	R(A) = static_cast<type::Integer>(sBx);
+	end_inst;
+op_end
+
+op_begin(GET_GLOBAL)
+	R(A) = runtime.globals.get_value(RKB);
+	end_inst;
+op_end
+
+op_begin(GET_LOCAL)
+	R(A) = runtime.function->get_local(RKB);
+	end_inst;
+op_end
+
+op_begin(GET_PROP)
+	R(A) = get_property(runtime, RKB, RKC);
+	end_inst;
+op_end
+
+op_begin(SET_GLOBAL)
+	runtime.globals.set_value(RKB, RKC);
+	end_inst;
+op_end
+
+op_begin(SET_LOCAL)
+	runtime.function->set_local(RKB, RKC);
+	end_inst;
+op_end
+
+op_begin(SET_PROP)
+	set_property(runtime, R(A), RKB, RKC);
+	end_inst;
+op_end
+
+op_begin(NEW_ARRAY)
+	R(A) = runtime.heap.make_array(static_cast<Size>(RKB.to_integer()));
+	end_inst;
+op_end
+
+op_begin(NEW_LIST)
+	R(A) = runtime.heap.make_list();
+	end_inst;
+op_end
+
+op_begin(NEW_OBJECT)
+	if (C)
+		R(A) = runtime.heap.make_object(RKB);
+	else R(A) = runtime.heap.make_object();
+	end_inst;
+op_end
+
+op_begin(SET_AL)
+	const Value& iterable = R(A);
+
+	switch (iterable.type())
+	{
+		case DataType::Array: {
+			type::Array& array = iterable.array();
+			Offset offset = 0;
+			for (Register* r = &R(B), *end = &R(C); r <= end; ++r)
+				array[offset++] = *r;
+		} break;
+
+		case DataType::List: {
+			type::List& list = iterable.list();
+			for (Register* r = &R(B), *end = &R(C); r <= end; ++r)
+				list.push_back(*r);
+		} break;
+	}
+	end_inst;
+op_end
+
+op_begin(SELF)
+	REGS.write(A, REGS.self());
+	end_inst;
+op_end
+
+__KPL_EACH_OPERAND_KIND(__KPL_ARITH_OP, ADD, runtime_add, operator_add)
+__KPL_EACH_OPERAND_KIND(__KPL_ARITH_OP, SUB, runtime_sub, operator_sub)
+__KPL_EACH_OPERAND_KIND(__KPL_ARITH_OP, MUL, runtime_mul, operator_mul)
+__KPL_EACH_OPERAND_KIND(__KPL_ARITH_OP, DIV, runtime_div, operator_div)
+
+__KPL_BINARY_OP(IDIV, runtime_idiv, operator_idiv)
+__KPL_BINARY_OP(MOD, runtime_mod, operator_mod)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_OP, EQ, EQ, runtime_equals, enter_eq)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_OP, NE, NE, runtime_not_equals, enter_ne)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_OP, GR, GR, runtime_greater, enter_gr)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_OP, LS, LS, runtime_less, enter_ls)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_OP, GE, GE, runtime_greater_equals, enter_ge)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_OP, LE, LE, runtime_less_equals, enter_le)
+
+__KPL_BINARY_OP(SHL, runtime_shl, operator_shl)
+__KPL_BINARY_OP(SHR, runtime_shr, operator_shr)
+__KPL_BINARY_OP(BAND, runtime_band, operator_band)
+__KPL_BINARY_OP(BOR, runtime_bor, operator_bor)
+__KPL_BINARY_OP(XOR, runtime_xor, operator_xor)
+__KPL_UNARY_OP(BNOT, runtime_bnot, operator_bnot)
+__KPL_UNARY_OP(NOT, runtime_not, operator_not)
+__KPL_UNARY_OP(NEG, runtime_neg, operator_neg)
+__KPL_UNARY_OP(LEN, runtime_length, operator_len)
+
+__KPL_BINARY_OP(IN, runtime_in, operator_in)
+
+op_begin(INSTANCEOF)
+	R(A) = RKB.runtime_instanceof(RKC, state);
+	end_inst;
+op_end
+
+__KPL_BINARY_OP(GET, runtime_subscrived_get, operator_get)
+
+op_begin(SET)
+	Value& object = R(A);
+	if (!enter_metamethod(state, runtime, object, special_props::operator_set, nullptr, ReturnAction::Store, RKB, RKC))
+		object.runtime_subscrived_set(RKB, RKC, state);
+	end_inst;
+op_end
+
+op_begin(JP)
+	jump_to(Ax);
+	end_inst;
+op_end
+
+op_begin(TEST)
+	if (RKB.to_bool() == static_cast<bool>(C))
+		runtime.inst_offset++;
+	end_inst;
+op_end
+
+op_begin(TEST_SET)
+	if (RKB.to_bool() == static_cast<bool>(C))
+		runtime.inst_offset++;
+	else R(A) = RKB;
+	end_inst;
+op_end
+
+op_begin(CALL)
+	call(state, runtime);
+	consume_fuel;
+	end_inst;
+op_end
+
+op_begin(INVOKE)
+	invoke(state, runtime, A, RKB, C);
+	consume_fuel;
+	end_inst;
+op_end
+
+op_begin(RETURN)
+	if (end_call(state, runtime, A ? &RKB : nullptr))
+		to_end;
+	end_inst;
+op_end
+
+op_begin(YIELD)
+	runtime.suspend(RKB, R(A));
+	to_end;
+op_end
+
+op_begin(RESUME)
+	R(A) = coroutine_operand(RKB).resume(state, RKC);
+	end_inst;
+op_end
+
+op_begin(FORPREP)
+	if (!for_prep(&R(A)))
+		jump_to(Bx + 1);
+	end_inst;
+op_end
+
+op_begin(FORLOOP)
+	if (for_loop(runtime, &R(A)))
+		jump_to(Bx);
+	end_inst;
+op_end
+
+op_begin(ITER_PREP)
+	iter_prep(&R(A));
+	jump_to(Bx);
+	end_inst;
+op_end
+
+op_begin(ITER_NEXT)
+	if (iter_next(state, &R(A)))
+		jump_to(Bx);
+	end_inst;
+op_end
+
+op_begin(SWITCH)
+	jump_to(runtime.chunk->switch_table(C).target(RKB));
+	end_inst;
+op_end
+
+op_begin(THROW)
+	throw ScriptError(RKB);
+op_end
+
+op_begin(RETURN_MULTI)
+	if (end_call_multi(state, runtime, &R(A), B))
+		to_end;
+	end_inst;
+op_end
+
+op_begin(VARARG)
+	vararg(runtime, A, B, C);
+	end_inst;
+op_end
+
+op_begin(VARARGS)
+	R(A) = varargs(runtime, B);
+	end_inst;
+op_end
+
+op_begin(ARG_COUNT)
+	R(A) = static_cast<type::Integer>(runtime.calls.top()->args);
+	end_inst;
+op_end
+
+
+
+// Superinstructions. The second instruction of each pair is loaded with fetch_inst,
+// so hooks still see both halves.
+
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_JP_OP, EQ_JP, EQ_JP, runtime_equals, enter_eq)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_JP_OP, NE_JP, NE_JP, runtime_not_equals, enter_ne)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_JP_OP, GR_JP, GR_JP_FF, runtime_greater, enter_gr)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_JP_OP, LS_JP, LS_JP_FF, runtime_less, enter_ls)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_JP_OP, GE_JP, GE_JP_FF, runtime_greater_equals, enter_ge)
+__KPL_EACH_OPERAND_KIND(__KPL_COMPARE_JP_OP, LE_JP, LE_JP_FF, runtime_less_equals, enter_le)
+
+op_begin(TEST_JP)
+	if (RKB.to_bool() == static_cast<bool>(C))
+		++runtime.inst_offset;
+	else jump_fused;
+	end_inst;
+op_end
+
+op_begin(LOAD_K_ADD)
+	R(A) = Kst(Bx);
+	fetch_inst;
+	const Value& left = RKB;
+	const Value& right = RKC;
+	__KPL_ARITH(runtime_add, operator_add)
+	end_inst;
+op_end
+
+op_begin(LOAD_K_SUB)
+	R(A) = Kst(Bx);
+	fetch_inst;
+	const Value& left = RKB;
+	const Value& right = RKC;
+	__KPL_ARITH(runtime_sub, operator_sub)
+	end_inst;
+op_end
+
+op_begin(LOAD_K_GET)
+	R(A) = Kst(Bx);
+	fetch_inst;
+	const Value& left = RKB;
+	const Value& right = RKC;
+	__KPL_ARITH(runtime_subscrived_get, operator_get)
+	end_inst;
+op_end
+
+op_begin(LOAD_INT_ADD)
+	R(A) = static_cast<type::Integer>(sBx);
+	fetch_inst;
+	const Value& left = RKB;
+	const Value& right = RKC;
+	__KPL_ARITH(runtime_add, operator_add)
+	end_inst;
+op_end
+
+op_begin(LOAD_INT_SUB)
+	R(A) = static_cast<type::Integer>(sBx);
+	fetch_inst;
+	const Value& left = RKB;
+	const Value& right = RKC;
+	__KPL_ARITH(runtime_sub, operator_sub)
+	end_inst;
+op_end
+
+op_begin(LOAD_INT_GET)
+	R(A) = static_cast<type::Integer>(sBx);
+	fetch_inst;
+	const Value& left = RKB;
+	const Value& right = RKC;
+	__KPL_ARITH(runtime_subscrived_get, operator_get)
+	end_inst;
+op_end
+
+op_begin(GET_PROP_CALL)
+	R(A) = get_property(runtime, RKB, RKC);
+	fetch_inst;
+	call(state, runtime);
+	consume_fuel;
+	end_inst;
+op_end
+
+
+
+// Global accesses through a slot of the GlobalsManager of the running state.
+
+op_begin(GET_GLOBAL_SLOT)
+	R(A) = runtime.globals.get_slot(global_slot(runtime, B));
+	end_inst;
+op_end
+
+op_begin(SET_GLOBAL_SLOT)
+	runtime.globals.set_slot(global_slot(runtime, B), RKC);
+	end_inst;
+op_end
+
+
+
+op_begin(TAILCALL)
+	if (!tail_call(state, runtime) && end_call(state, runtime, &R(A)))
+		to_end;
+	consume_fuel;
+	end_inst;
+op_end
+
+op_begin(FORLOOP_INT)
+	Register* const loop = &R(A);
+	if (loop[0].isInteger() && loop[1].isInteger() && loop[2].isInteger()) [[likely]]
+	{
+		if (int_for_loop(loop))
+			jump_to(Bx);
+	}
+	else if (for_loop(runtime, loop))
+		jump_to(Bx);
+	end_inst;
+op_end
+
+op_begin(FORLOOP_FLOAT)
+	Register* const loop = &R(A);
+	if (loop[0].isFloat() && loop[1].isFloat() && loop[2].isFloat()) [[likely]]
+	{
+		if (float_for_loop(loop))
+			jump_to(Bx);
+	}
+	else if (for_loop(runtime, loop))
+		jump_to(Bx);
+	end_inst;
+op_end
+
+op_begin(NATIVE)
+	dispatch_to(run_native(state, runtime));
+op_end
+
+op_begin(RECORD)
+	dispatch_to(record_step(state, runtime));
+op_end
+
+op_begin(TRACE)
+	dispatch_to(run_trace(state, runtime));
+op_end
+
+op_begin(BREAK)
+	dispatch_to(break_point(state, runtime));
+op_end
+
+op_begin(INVALID)
+	throw BadValueOperation("Invalid instruction");
+op_end
+
+
+// Quickened handlers. The fast path works on the raw operands and never leaves this file;
+// a failed guard restores the generic opcode and takes the generic path once.
+
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, ADD_II, ADD, int_pair, static_cast<type::Integer>(static_cast<UInt64>(left.integral()) + static_cast<UInt64>(right.integral())), runtime_add, operator_add)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, ADD_FF, ADD, float_pair, left.floating() + right.floating(), runtime_add, operator_add)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, SUB_II, SUB, int_pair, static_cast<type::Integer>(static_cast<UInt64>(left.integral()) - static_cast<UInt64>(right.integral())), runtime_sub, operator_sub)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, SUB_FF, SUB, float_pair, left.floating() - right.floating(), runtime_sub, operator_sub)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, MUL_II, MUL, int_pair, static_cast<type::Integer>(static_cast<UInt64>(left.integral()) * static_cast<UInt64>(right.integral())), runtime_mul, operator_mul)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, MUL_FF, MUL, float_pair, left.floating() * right.floating(), runtime_mul, operator_mul)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, DIV_II, DIV, int_pair, static_cast<type::Float>(left.integral()) / static_cast<type::Float>(right.integral()), runtime_div, operator_div)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_ARITH_OP, DIV_FF, DIV, float_pair, left.floating() / right.floating(), runtime_div, operator_div)
+
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_OP, EQ_II, EQ, int_pair, left.integral() == right.integral(), runtime_equals, enter_eq)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_OP, NE_II, NE, int_pair, left.integral() != right.integral(), runtime_not_equals, enter_ne)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_OP, GR_II, GR, int_pair, left.integral() > right.integral(), runtime_greater, enter_gr)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_OP, LS_II, LS, int_pair, left.integral() < right.integral(), runtime_less, enter_ls)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_OP, GE_II, GE, int_pair, left.integral() >= right.integral(), runtime_greater_equals, enter_ge)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_OP, LE_II, LE, int_pair, left.integral() <= right.integral(), runtime_less_equals, enter_le)
+
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, EQ_JP_II, EQ_JP, int_pair, left.integral() == right.integral(), runtime_equals, enter_eq)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, NE_JP_II, NE_JP, int_pair, left.integral() != right.integral(), runtime_not_equals, enter_ne)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, GR_JP_II, GR_JP, int_pair, left.integral() > right.integral(), runtime_greater, enter_gr)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, LS_JP_II, LS_JP, int_pair, left.integral() < right.integral(), runtime_less, enter_ls)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, GE_JP_II, GE_JP, int_pair, left.integral() >= right.integral(), runtime_greater_equals, enter_ge)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, LE_JP_II, LE_JP, int_pair, left.integral() <= right.integral(), runtime_less_equals, enter_le)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, GR_JP_FF, GR_JP, float_pair, left.floating() > right.floating(), runtime_greater, enter_gr)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, LS_JP_FF, LS_JP, float_pair, left.floating() < right.floating(), runtime_less, enter_ls)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, GE_JP_FF, GE_JP, float_pair, left.floating() >= right.floating(), runtime_greater_equals, enter_ge)
+__KPL_EACH_OPERAND_KIND(__KPL_QUICK_COMPARE_JP_OP, LE_JP_FF, LE_JP, float_pair, left.floating() <= right.floating(), runtime_less_equals, enter_le)
+
+
+
+#undef __KPL_EXPAND
+#undef __KPL_EACH_OPERAND_KIND
+#undef __KPL_BINARY_OPERANDS
+#undef __KPL_ARITH
+#undef __KPL_COMPARE
+#undef __KPL_COMPARE_JP
+#undef __KPL_ARITH_OP
+#undef __KPL_COMPARE_OP
+#undef __KPL_COMPARE_JP_OP
+#undef __KPL_QUICK_ARITH_OP
+#undef __KPL_QUICK_COMPARE_OP
+#undef __KPL_QUICK_COMPARE_JP_OP
+#undef __KPL_BINARY_OP
+#undef __KPL_UNARY_OP
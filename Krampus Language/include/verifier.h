@@ -0,0 +1,18 @@
+#pragma once
+
+#include "chunk.h"
+
+namespace kpl::verifier
+{
+	// Whether the instruction at offset of chunk only names registers below its register count,
+	// constants and switch tables it has, and only jumps, skips or falls through to instructions
+	// inside it. Those are all the interpreter takes for granted.
+	bool verify_instruction(const Chunk& chunk, Offset offset);
+
+	// Checks every instruction and try region of chunk and rewrites the dispatch opcode of each
+	// instruction that fails to opcode::id::INVALID, which raises an error instead of running it.
+	// A try region that does not fit the chunk fails every instruction. Returns whether all of
+	// them passed. A chunk without instructions never does; ChunkBuilder gives an empty one a
+	// lone NOP, which fails because it runs off the end.
+	bool verify(Chunk& chunk);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.h"
+
+namespace kpl::utils
+{
+	// Address space reserved up front whose pages are committed on demand. One extra page
+	// after size() is reserved and never committed, so a write past the end faults instead
+	// of corrupting whatever the allocator placed there. Committed pages read as zero.
+	class ReservedBlock
+	{
+	public:
+		static constexpr Size commit_step = 64 * 1024;
+
+	private:
+		Byte* _base;
+		Size _size;
+		Size _committed;
+
+	public:
+		ReservedBlock(const ReservedBlock&) = delete;
+		ReservedBlock(ReservedBlock&&) = delete;
+
+		ReservedBlock& operator= (const ReservedBlock&) = delete;
+		ReservedBlock& operator= (ReservedBlock&&) = delete;
+
+		explicit ReservedBlock(Size size);
+		~ReservedBlock();
+
+		inline Byte* data() const { return _base; }
+		inline Size size() const { return _size; }
+		inline Size committed() const { return _committed; }
+
+		// Commits at least the first bytes bytes. Returns false if bytes is beyond size().
+		bool commit(Size bytes);
+
+		static Size page_size();
+	};
+
+	// Pages for generated machine code. They are writable until seal() and executable, but
+	// no longer writable, after it.
+	class ExecutableBlock
+	{
+	private:
+		Byte* _base;
+		Size _size;
+
+	public:
+		ExecutableBlock(const ExecutableBlock&) = delete;
+		ExecutableBlock(ExecutableBlock&&) = delete;
+
+		ExecutableBlock& operator= (const ExecutableBlock&) = delete;
+		ExecutableBlock& operator= (ExecutableBlock&&) = delete;
+
+		explicit ExecutableBlock(Size size);
+		~ExecutableBlock();
+
+		inline Byte* data() const { return _base; }
+		inline Size size() const { return _size; }
+
+		void seal();
+	};
+}
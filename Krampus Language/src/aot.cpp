@@ -0,0 +1,384 @@
+#include "aot.h"
+
+namespace kpl::aot
+{
+	// FNV-1a.
+	class Digest
+	{
+	private:
+		UInt64 _hash = 14695981039346656037ULL;
+
+	public:
+		inline void add(const void* data, Size size)
+		{
+			for (const UInt8* byte = static_cast<const UInt8*>(data), *end = byte + size; byte != end; ++byte)
+				_hash = (_hash ^ *byte) * 1099511628211ULL;
+		}
+
+		template<typename _Ty>
+		inline void add(const _Ty& value) { add(&value, sizeof(value)); }
+
+		inline UInt64 value() const { return _hash; }
+	};
+
+	UInt64 digest(const Chunk& chunk)
+	{
+		Digest digest;
+		digest.add(static_cast<UInt64>(chunk.register_count()));
+		digest.add(static_cast<UInt8>(chunk.is_variadic()));
+		digest.add(static_cast<UInt64>(chunk.chunk_count()));
+
+		digest.add(static_cast<UInt64>(chunk.instruction_count()));
+		for (Offset i = 0; i < chunk.instruction_count(); ++i)
+			digest.add(chunk.instruction(i));
+
+		digest.add(static_cast<UInt64>(chunk.constants_count()));
+		for (Offset i = 0; i < chunk.constants_count(); ++i)
+		{
+			const Value& constant = chunk.constant(i);
+			digest.add(static_cast<UInt8>(constant.type()));
+			switch (constant.type())
+			{
+				case DataType::Integer: digest.add(constant.integral()); break;
+				case DataType::Float: digest.add(std::bit_cast<UInt64>(constant.floating())); break;
+				case DataType::Boolean: digest.add(static_cast<UInt8>(constant.boolean())); break;
+				case DataType::String:
+					digest.add(static_cast<UInt64>(constant.string().size()));
+					digest.add(constant.string().data(), constant.string().size());
+					break;
+				default: break;
+			}
+		}
+		return digest.value();
+	}
+
+	static inline bool is_scalar(const Value& value)
+	{
+		return value.isNull() || value.isInteger() || value.isFloat() || value.isBoolean();
+	}
+
+	// Generated code writes constants as literals, so only scalar ones can be operands.
+	static inline bool scalar_operand(const Chunk& chunk, unsigned int index, bool constant)
+	{
+		return !constant || is_scalar(chunk.constant(index));
+	}
+
+	bool translated(const Chunk& chunk, Offset offset)
+	{
+		if (!chunk.is_verified())
+			return false;
+
+		const InstructionCode code = chunk.instruction(offset);
+		const Size count = chunk.instruction_count();
+		auto rkb = [&]() { return scalar_operand(chunk, inst::arg::b(code), inst::arg::kb(code)); };
+		auto rkc = [&]() { return scalar_operand(chunk, inst::arg::c(code), inst::arg::kc(code)); };
+
+		switch (inst::arg::opcode(code))
+		{
+			case opcode::id::NOP:
+			case opcode::id::MOVE:
+			case opcode::id::LOAD_NULL:
+			case opcode::id::LOAD_INT:
+				return true;
+
+			case opcode::id::LOAD_BOOL:
+				return !inst::arg::c(code) || offset + 2 <= count;
+
+			case opcode::id::LOAD_K:
+				return is_scalar(chunk.constant(inst::arg::bx(code)));
+
+			case opcode::id::ADD:
+			case opcode::id::SUB:
+			case opcode::id::MUL:
+			case opcode::id::DIV:
+			case opcode::id::IDIV:
+			case opcode::id::MOD:
+			case opcode::id::BAND:
+			case opcode::id::BOR:
+			case opcode::id::XOR:
+				return rkb() && rkc();
+
+			case opcode::id::EQ:
+			case opcode::id::NE:
+			case opcode::id::GR:
+			case opcode::id::LS:
+			case opcode::id::GE:
+			case opcode::id::LE:
+				return rkb() && rkc() && offset + 2 <= count;
+
+			case opcode::id::NOT:
+			case opcode::id::NEG:
+				return rkb();
+
+			case opcode::id::TEST:
+			case opcode::id::TEST_SET:
+				return rkb() && offset + 2 <= count;
+
+			case opcode::id::JP:
+				return inst::arg::ax(code) <= count;
+
+			case opcode::id::FORLOOP:
+				return inst::arg::bx(code) <= count;
+
+			default:
+				return false;
+		}
+	}
+
+
+
+	// Writes the code of one chunk as a function with entry labels for every instruction it
+	// translated. Instructions it did not translate return their own offset.
+	class Emitter
+	{
+	private:
+		std::ostream& _out;
+		const Chunk& _chunk;
+		std::vector<bool> _translated;
+		std::vector<bool> _labels;
+
+		std::string constant(const Value& value) const
+		{
+			std::ostringstream ss;
+			switch (value.type())
+			{
+				case DataType::Integer:
+					if (value.integral() == std::numeric_limits<type::Integer>::min())
+						ss << "kpl::Value(std::numeric_limits<kpl::type::Integer>::min())";
+					else ss << "kpl::Value(kpl::type::Integer(" << value.integral() << "LL))";
+					break;
+
+				case DataType::Float:
+					ss << "kpl::Value(std::bit_cast<kpl::type::Float>(0x" << std::hex << std::bit_cast<UInt64>(value.floating()) << "ULL))";
+					break;
+
+				case DataType::Boolean:
+					ss << "kpl::Value(" << (value.boolean() ? "true" : "false") << ")";
+					break;
+
+				default:
+					ss << "kpl::Value()";
+					break;
+			}
+			return ss.str();
+		}
+
+		inline std::string reg(unsigned int index) const { return "regs[" + std::to_string(index) + "]"; }
+		inline std::string rk(unsigned int index, bool constant) const { return constant ? this->constant(_chunk.constant(index)) : reg(index); }
+
+		inline std::string label(Offset offset) const { return "i" + std::to_string(offset); }
+
+		// Marks the instructions entered other than by falling through to them.
+		void find_labels()
+		{
+			const Size count = _chunk.instruction_count();
+			_translated.assign(count, false);
+			_labels.assign(count + 1, false);
+
+			for (Offset i = 0; i < count; ++i)
+			{
+				if (!translated(_chunk, i))
+					continue;
+
+				_translated[i] = _labels[i] = true;
+
+				const InstructionCode code = _chunk.instruction(i);
+				switch (inst::arg::opcode(code))
+				{
+					case opcode::id::LOAD_BOOL:
+						if (inst::arg::c(code))
+							_labels[i + 2] = true;
+						break;
+
+					case opcode::id::EQ:
+					case opcode::id::NE:
+					case opcode::id::GR:
+					case opcode::id::LS:
+					case opcode::id::GE:
+					case opcode::id::LE:
+					case opcode::id::TEST:
+					case opcode::id::TEST_SET:
+						_labels[i + 2] = true;
+						break;
+
+					case opcode::id::JP: _labels[inst::arg::ax(code)] = true; break;
+					case opcode::id::FORLOOP: _labels[inst::arg::bx(code)] = true; break;
+					default: break;
+				}
+			}
+		}
+
+		void instruction(Offset offset)
+		{
+			const InstructionCode code = _chunk.instruction(offset);
+			const unsigned int a = inst::arg::a(code);
+			const unsigned int b = inst::arg::b(code);
+			const unsigned int c = inst::arg::c(code);
+			auto rkb = [&]() { return rk(b, inst::arg::kb(code)); };
+			auto rkc = [&]() { return rk(c, inst::arg::kc(code)); };
+			const std::string exit = "return " + std::to_string(offset) + ";";
+			const std::string skip = "goto " + label(offset + 2) + ";";
+
+			auto binary = [&](const char* op) {
+				_out << "\tif (!kpl::aot::ops::" << op << "(" << reg(a) << ", " << rkb() << ", " << rkc() << ")) " << exit << "\n";
+			};
+			auto compare = [&](const char* op) {
+				_out << "\tswitch (kpl::aot::ops::" << op << "(" << rkb() << ", " << rkc() << ")) { case -1: " << exit << " case 1: " << skip << " }\n";
+			};
+
+			switch (inst::arg::opcode(code))
+			{
+				case opcode::id::NOP: break;
+				case opcode::id::MOVE: _out << "\t" << reg(a) << " = " << reg(b) << ";\n"; break;
+				case opcode::id::LOAD_K: _out << "\t" << reg(a) << " = " << constant(_chunk.constant(inst::arg::bx(code))) << ";\n"; break;
+				case opcode::id::LOAD_INT: _out << "\t" << reg(a) << " = kpl::type::Integer(" << inst::arg::sbx(code) << ");\n"; break;
+
+				case opcode::id::LOAD_BOOL:
+					_out << "\t" << reg(a) << " = " << (b ? "true" : "false") << ";\n";
+					if (c)
+						_out << "\t" << skip << "\n";
+					break;
+
+				case opcode::id::LOAD_NULL:
+					for (unsigned int i = a; i <= b; ++i)
+						_out << "\t" << reg(i) << " = nullptr;\n";
+					break;
+
+				case opcode::id::ADD: binary("add"); break;
+				case opcode::id::SUB: binary("sub"); break;
+				case opcode::id::MUL: binary("mul"); break;
+				case opcode::id::DIV: binary("div"); break;
+				case opcode::id::IDIV: binary("idiv"); break;
+				case opcode::id::MOD: binary("mod"); break;
+				case opcode::id::BAND: binary("band"); break;
+				case opcode::id::BOR: binary("bor"); break;
+				case opcode::id::XOR: binary("bxor"); break;
+
+				case opcode::id::NOT: _out << "\tif (!kpl::aot::ops::logical_not(" << reg(a) << ", " << rkb() << ")) " << exit << "\n"; break;
+				case opcode::id::NEG: _out << "\tif (!kpl::aot::ops::neg(" << reg(a) << ", " << rkb() << ")) " << exit << "\n"; break;
+
+				case opcode::id::EQ: compare("eq"); break;
+				case opcode::id::NE: compare("ne"); break;
+				case opcode::id::GR: compare("gr"); break;
+				case opcode::id::LS: compare("ls"); break;
+				case opcode::id::GE: compare("ge"); break;
+				case opcode::id::LE: compare("le"); break;
+
+				case opcode::id::JP: {
+					const Offset target = inst::arg::ax(code);
+					if (target <= offset)
+						_out << "\tif (!kpl::aot::ops::spend_fuel(fuel)) " << exit << "\n";
+					_out << "\tgoto " << label(target) << ";\n";
+				} break;
+
+				case opcode::id::TEST:
+					_out << "\tif (" << rkb() << ".to_bool() == " << (c ? "true" : "false") << ") " << skip << "\n";
+					break;
+
+				case opcode::id::TEST_SET:
+					_out << "\tif (" << rkb() << ".to_bool() == " << (c ? "true" : "false") << ") " << skip << "\n";
+					_out << "\t" << reg(a) << " = " << rkb() << ";\n";
+					break;
+
+				case opcode::id::FORLOOP: {
+					const Offset body = inst::arg::bx(code);
+					_out << "\tswitch (kpl::aot::ops::for_loop(&" << reg(a) << ", fuel, " << (body <= offset ? "true" : "false") << ")) "
+						<< "{ case -1: " << exit << " case 1: goto " << label(body) << "; }\n";
+				} break;
+
+				default: break;
+			}
+		}
+
+	public:
+		inline Emitter(std::ostream& out, const Chunk& chunk) :
+			_out{ out },
+			_chunk{ chunk },
+			_translated{},
+			_labels{}
+		{}
+
+		void emit(const std::string& function)
+		{
+			find_labels();
+			const Size count = _chunk.instruction_count();
+
+			_out << "static kpl::Offset " << function << "(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)\n{\n";
+			_out << "\t(void)regs;\n\t(void)fuel;\n";
+			_out << "\tswitch (start)\n\t{\n";
+			for (Offset i = 0; i < count; ++i)
+				if (_translated[i])
+					_out << "\t\tcase " << i << ": goto " << label(i) << ";\n";
+			_out << "\t\tdefault: return start;\n\t}\n\n";
+
+			for (Offset i = 0; i < count; ++i)
+			{
+				if (_labels[i])
+					_out << label(i) << ":\n";
+
+				if (_translated[i])
+				{
+					_out << "{\n";
+					instruction(i);
+					_out << "}\n";
+				}
+				else _out << "\treturn " << i << ";\n";
+			}
+
+			if (_labels[count])
+				_out << label(count) << ":\n";
+			_out << "\treturn " << count << ";\n}\n\n";
+		}
+	};
+
+	template<typename _Chunk>
+	static void collect(_Chunk& chunk, std::vector<_Chunk*>& chunks)
+	{
+		chunks.push_back(&chunk);
+		for (Offset i = 0; i < chunk.chunk_count(); ++i)
+			collect<_Chunk>(*chunk.chunk(i), chunks);
+	}
+
+	void emit(std::ostream& out, const Chunk& root, const std::string& name)
+	{
+		std::vector<const Chunk*> chunks;
+		collect(root, chunks);
+
+		out << "// Generated by kpl::aot::emit. Do not edit.\n\n#include \"aot.h\"\n\n";
+
+		for (Size i = 0; i < chunks.size(); ++i)
+			Emitter{ out, *chunks[i] }.emit(name + "_" + std::to_string(i));
+
+		out << "static const kpl::aot::CompiledChunk " << name << "_chunks[] =\n{\n";
+		for (Size i = 0; i < chunks.size(); ++i)
+			out << "\t{ &" << name << "_" << i << ", 0x" << std::hex << digest(*chunks[i]) << std::dec << "ULL },\n";
+		out << "};\n\n";
+
+		out << "bool " << name << "(kpl::Chunk& root)\n{\n"
+			<< "\treturn kpl::aot::install(root, " << name << "_chunks, " << chunks.size() << ");\n}\n";
+	}
+
+	bool install(Chunk& root, const CompiledChunk* compiled, Size count)
+	{
+		std::vector<Chunk*> chunks;
+		collect(root, chunks);
+		if (chunks.size() != count)
+			return false;
+
+		for (Size i = 0; i < count; ++i)
+			if (digest(*chunks[i]) != compiled[i].digest || !chunks[i]->is_verified() || chunks[i]->has_breakpoints())
+				return false;
+
+		for (Size i = 0; i < count; ++i)
+		{
+			Chunk& chunk = *chunks[i];
+			jit::discard(chunk);
+
+			chunk._native = new jit::NativeCode(compiled[i].entry, std::vector<opcode::id>(chunk._opcodes, chunk._opcodes + chunk._code_count));
+			for (Offset j = 0; j < chunk._code_count; ++j)
+				if (translated(chunk, j))
+					chunk._opcodes[j] = opcode::id::NATIVE;
+		}
+		return true;
+	}
+}
@@ -113,7 +113,7 @@ namespace kpl::assembler::parser
 	}
 
 	static const utils::EnumDict<Keyword> keywords(&keyword_name, Keyword::Chunks, Keyword::Code);
-	static const utils::EnumDict<opcode::id> opcodes(&opcode::name, opcode::id::NOP, opcode::id::RETURN);
+	static const utils::EnumDict<opcode::id> opcodes(&opcode::name, opcode::id::NOP, opcode::id::ARG_COUNT);
 
 	ParserException error(utils::DataReader& reader, const char* msg)
 	{
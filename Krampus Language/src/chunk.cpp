@@ -1,4 +1,8 @@
 #include "chunk.h"
+#include "optimizer.h"
+#include "verifier.h"
+#include "kplstate.h"
+#include "jit.h"
 
 namespace kpl
 {
@@ -157,6 +161,139 @@ namespace kpl
 
 namespace kpl
 {
+	// Property accesses by constant name get an inline cache slot.
+	static bool has_property_cache(const inst::Instruction& inst)
+	{
+		switch (inst.opcode())
+		{
+			case opcode::id::GET_PROP: return inst::arg::kc(inst);
+			case opcode::id::SET_PROP: return inst::arg::kb(inst);
+			case opcode::id::INVOKE: return inst::arg::kb(inst);
+			default: return false;
+		}
+	}
+
+	// Global accesses by a string constant name go through a slot of the running state.
+	static bool has_global_slot(const Chunk& chunk, const inst::Instruction& inst)
+	{
+		opcode::id op = inst.opcode();
+		if ((op != opcode::id::GET_GLOBAL && op != opcode::id::SET_GLOBAL) || !inst::arg::kb(inst))
+			return false;
+
+		return chunk.constant(inst::arg::b(inst)).isString();
+	}
+
+	// A ChunkSwitch reduced to unique keys, the first case winning like in a chain of EQ, with
+	// the run of integer keys that goes to the dense table picked out.
+	struct SwitchPlan
+	{
+		std::map<Int64, Offset> integers;
+		std::unordered_map<std::string_view, Offset> strings;
+		Int64 first = 0;
+		Size dense_count = 0;
+		Size dense_keys = 0;
+		Size capacity = 0;
+	};
+
+	static SwitchPlan plan_switch(const ChunkSwitch& table)
+	{
+		SwitchPlan plan;
+		for (const auto& c : table.cases)
+		{
+			switch (c.first.type())
+			{
+				case ChunkConstant::Type::Integer:
+					plan.integers.emplace(c.first.integral(), c.second);
+					break;
+
+				case ChunkConstant::Type::Float: {
+					const double value = c.first.floating();
+					if (value >= -0x1p63 && value < 0x1p63 && static_cast<double>(static_cast<Int64>(value)) == value)
+						plan.integers.emplace(static_cast<Int64>(value), c.second);
+				} break;
+
+				case ChunkConstant::Type::String:
+					plan.strings.emplace(c.first.string(), c.second);
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		// The run of keys with the most cases that still fills at least half of its range.
+		std::vector<Int64> keys;
+		keys.reserve(plan.integers.size());
+		for (const auto& c : plan.integers)
+			keys.push_back(c.first);
+
+		for (Size i = 0; i < keys.size() && keys.size() - i > plan.dense_keys; ++i)
+		{
+			for (Size j = i; j < keys.size(); ++j)
+			{
+				const UInt64 distance = static_cast<UInt64>(keys[j]) - static_cast<UInt64>(keys[i]);
+				if (distance >= 2 * (keys.size() - i))
+					break;
+
+				const Size count = j - i + 1;
+				if (distance < 2 * count && count > plan.dense_keys)
+				{
+					plan.first = keys[i];
+					plan.dense_count = static_cast<Size>(distance) + 1;
+					plan.dense_keys = count;
+				}
+			}
+		}
+
+		const Size hashed = plan.integers.size() - plan.dense_keys + plan.strings.size();
+		if (hashed > 0)
+			for (plan.capacity = 2; plan.capacity < hashed * 2; plan.capacity *= 2);
+
+		return plan;
+	}
+
+	static void insert_switch_entry(SwitchTable& table, UInt64 hash, const Value& key, Offset target)
+	{
+		Size slot = hash & table.mask;
+		while (!table.entries[slot].key.isNull())
+			slot = (slot + 1) & table.mask;
+
+		SwitchTable::Entry& entry = table.entries[slot];
+		entry.hash = hash;
+		entry.key = key;
+		entry.target = target;
+	}
+
+	static void build_switch(SwitchTable& table, const ChunkSwitch& source, const SwitchPlan& plan, SwitchTable::Entry* entries, Offset* targets)
+	{
+		table.default_target = source.default_target;
+		table.first = plan.first;
+		table.dense_count = plan.dense_count;
+		table.dense = plan.dense_count > 0 ? targets : nullptr;
+		table.mask = plan.capacity > 0 ? plan.capacity - 1 : 0;
+		table.entries = plan.capacity > 0 ? entries : nullptr;
+
+		for (Offset i = 0; i < plan.dense_count; ++i)
+			targets[i] = source.default_target;
+
+		for (Offset i = 0; i < plan.capacity; ++i)
+			utils::construct(entries[i], 0ULL, nullptr, 0ULL);
+
+		for (const auto& c : plan.integers)
+		{
+			const UInt64 index = static_cast<UInt64>(c.first) - static_cast<UInt64>(plan.first);
+			if (index < plan.dense_count)
+				targets[index] = c.second;
+			else insert_switch_entry(table, SwitchTable::hash(c.first), c.first, c.second);
+		}
+
+		for (const auto& c : plan.strings)
+		{
+			Value key = new type::String(c.first.data(), c.first.size());
+			insert_switch_entry(table, SwitchTable::hash(key.string()), key, c.second);
+		}
+	}
+
 	Chunk* ChunkBuilder::build(Chunk* chunk)
 	{
 		if (!chunk)
@@ -168,27 +305,126 @@ namespace kpl
 		utils::destroy(*chunk);
 		utils::construct(*chunk);
 
+		// The interpreter starts at the first instruction, so a chunk without any gets a lone NOP.
+		// It falls off the end of the chunk, which the verifier rejects like any other.
+		static const std::vector<inst::Instruction> lone_nop{ inst::Instruction::nop() };
+		const std::vector<inst::Instruction>& instructions = _instructions.empty() ? lone_nop : _instructions;
+
 		chunk->_constant_count = _constants.size();
 		chunk->_chunk_count = _chunks.size();
-		chunk->_code_count = _instructions.size();
+		chunk->_code_count = instructions.size();
 		chunk->_register_count = static_cast<unsigned int>(_registers);
 
-		chunk->_data = utils::malloc(Chunk::chunk_object_size(chunk->_constant_count, chunk->_chunk_count, chunk->_code_count));
+		chunk->_cache_count = 0;
+		for (const inst::Instruction& inst : instructions)
+			if (has_property_cache(inst))
+				chunk->_cache_count++;
+
+		std::vector<SwitchPlan> switches;
+		Size switch_entries = 0, switch_targets = 0;
+		switches.reserve(_switches.size());
+		for (const ChunkSwitch& table : _switches)
+		{
+			switches.push_back(plan_switch(table));
+			switch_entries += switches.back().capacity;
+			switch_targets += switches.back().dense_count;
+		}
+		chunk->_switch_count = _switches.size();
+		chunk->_handler_count = _handlers.size();
+
+		chunk->_data = utils::malloc(Chunk::chunk_object_size(chunk->_constant_count, chunk->_chunk_count, chunk->_code_count, chunk->_cache_count,
+			chunk->_register_count, chunk->_switch_count, switch_entries, switch_targets, chunk->_handler_count));
 
 		chunk->_constants = reinterpret_cast<Value*>(chunk->_data);
 		chunk->_chunks = reinterpret_cast<Chunk**>(chunk->_constants + chunk->_constant_count);
-		chunk->_code = reinterpret_cast<InstructionCode*>(chunk->_chunks + chunk->_chunk_count);
+		chunk->_caches = reinterpret_cast<PropertyCache*>(chunk->_chunks + chunk->_chunk_count);
+		chunk->_switches = reinterpret_cast<SwitchTable*>(chunk->_caches + chunk->_cache_count);
+		SwitchTable::Entry* const entries = reinterpret_cast<SwitchTable::Entry*>(chunk->_switches + chunk->_switch_count);
+		Offset* const targets = reinterpret_cast<Offset*>(entries + switch_entries);
+		chunk->_handlers = reinterpret_cast<ExceptionHandler*>(targets + switch_targets);
+		chunk->_code = reinterpret_cast<InstructionCode*>(chunk->_handlers + chunk->_handler_count);
+		chunk->_cache_index = reinterpret_cast<UInt32*>(chunk->_code + chunk->_code_count);
+		chunk->_global_slots = chunk->_cache_index + chunk->_code_count;
+		chunk->_opcodes = reinterpret_cast<opcode::id*>(chunk->_global_slots + chunk->_constant_count);
+		chunk->_register_flags = reinterpret_cast<UInt8*>(chunk->_opcodes + chunk->_code_count);
+		chunk->_entry_regs = chunk->_register_flags + chunk->_register_count;
+		chunk->_reference_regs = chunk->_entry_regs + chunk->_register_count;
 
 		Offset offset = 0;
 		for (const ChunkConstant& c : _constants)
-			chunk->_constants[offset++] = c.to_value();
+			utils::construct(chunk->_constants[offset++], c.to_value());
 
 		if(!_chunks.empty())
-			std::memcpy(chunk->_chunks, _chunks.data(), chunk->_chunk_count);
+			std::memcpy(chunk->_chunks, _chunks.data(), chunk->_chunk_count * Chunk::chunk_size);
 		
+		if (chunk->_cache_count > 0)
+			std::memset(chunk->_caches, 0, chunk->_cache_count * Chunk::cache_size);
+
+		if (!_handlers.empty())
+			std::memcpy(chunk->_handlers, _handlers.data(), chunk->_handler_count * Chunk::handler_size);
+
+		for (Offset i = 0, entry = 0, target = 0; i < chunk->_switch_count; ++i)
+		{
+			build_switch(chunk->_switches[i], _switches[i], switches[i], entries + entry, targets + target);
+			entry += switches[i].capacity;
+			target += switches[i].dense_count;
+		}
+
+		for (offset = 0; offset < chunk->_constant_count; ++offset)
+			chunk->_global_slots[offset] = GlobalsManager::no_slot;
+		chunk->_globals = 0;
+
 		offset = 0;
-		for (const inst::Instruction& inst : _instructions)
-			chunk->_code[offset++] = inst;
+		UInt32 cache = 0;
+		for (const inst::Instruction& inst : instructions)
+		{
+			chunk->_cache_index[offset] = has_property_cache(inst) ? cache++ : Chunk::no_cache;
+			chunk->_opcodes[offset] = inst.opcode();
+			chunk->_code[offset] = inst;
+
+			switch (inst.opcode())
+			{
+				case opcode::id::VARARG:
+				case opcode::id::VARARGS:
+				case opcode::id::ARG_COUNT:
+					chunk->_variadic = true;
+					break;
+
+				default:
+					break;
+			}
+			offset++;
+		}
+
+		// Everything below reads the operands, so it only looks at instructions that passed.
+		chunk->_verified = verifier::verify(*chunk);
+
+		for (offset = 0; offset < chunk->_code_count; ++offset)
+		{
+			const inst::Instruction inst = chunk->_code[offset];
+			if (chunk->_opcodes[offset] == opcode::id::INVALID)
+				continue;
+
+			if (has_global_slot(*chunk, inst))
+			{
+				// Any slot but no_slot until link_globals resolves it.
+				chunk->_global_slots[inst::arg::b(inst)] = 0;
+				chunk->_opcodes[offset] = inst.opcode() == opcode::id::GET_GLOBAL ? opcode::id::GET_GLOBAL_SLOT : opcode::id::SET_GLOBAL_SLOT;
+			}
+		}
+
+		optimizer::analyze_registers(*chunk, chunk->_register_flags);
+		for (unsigned int reg = 0; reg < chunk->_register_count; ++reg)
+		{
+			if (chunk->_register_flags[reg] & register_flag::read_on_entry)
+				chunk->_entry_regs[chunk->_entry_count++] = static_cast<UInt8>(reg);
+			if (chunk->_register_flags[reg] & register_flag::reference)
+				chunk->_reference_regs[chunk->_reference_count++] = static_cast<UInt8>(reg);
+		}
+
+		optimizer::select_tail_calls(*chunk);
+		optimizer::fuse_superinstructions(*chunk);
+		optimizer::specialize_operands(*chunk);
 
 		return chunk;
 	}
@@ -201,6 +437,10 @@ namespace kpl
 {
 	Chunk::~Chunk()
 	{
+		delete _native;
+		delete _traces;
+		delete[] _breakpoints;
+
 		if (_data)
 		{
 			for (Offset i = 0; i < _constant_count; ++i)
@@ -212,9 +452,81 @@ namespace kpl
 			for (Offset i = 0; i < _chunk_count; ++i)
 				delete _chunks[i];
 
+			for (Offset i = 0; i < _switch_count; ++i)
+			{
+				const SwitchTable& table = _switches[i];
+				if (table.entries)
+				{
+					for (Offset slot = 0; slot <= table.mask; ++slot)
+					{
+						table.entries[slot].key.force_destructor_call();
+						utils::destroy(table.entries[slot]);
+					}
+				}
+			}
+
 			utils::free(_data);
 		}
 
 		std::memset(this, 0, sizeof(*this));
 	}
+
+	void Chunk::link_globals(GlobalsManager& globals)
+	{
+		for (Offset i = 0; i < _constant_count; ++i)
+			if (_global_slots[i] != GlobalsManager::no_slot)
+				_global_slots[i] = globals.slot(_constants[i].string());
+		_globals = globals.serial();
+	}
+
+	bool Chunk::set_breakpoint(Offset offset)
+	{
+		if (offset >= _code_count || has_breakpoint(offset))
+			return false;
+
+		if (!_breakpoints)
+		{
+			jit::discard(*this);
+			_breakpoints = new opcode::id[_code_count];
+		}
+
+		optimizer::split_superinstruction(*this, offset);
+
+		_breakpoints[offset] = _opcodes[offset];
+		_opcodes[offset] = opcode::id::BREAK;
+		return true;
+	}
+
+	bool Chunk::clear_breakpoint(Offset offset)
+	{
+		if (offset >= _code_count || !has_breakpoint(offset))
+			return false;
+
+		_opcodes[offset] = _breakpoints[offset];
+		if (std::find(_opcodes, _opcodes + _code_count, opcode::id::BREAK) == _opcodes + _code_count)
+			release_breakpoints();
+		return true;
+	}
+
+	void Chunk::clear_breakpoints()
+	{
+		if (!_breakpoints)
+			return;
+
+		for (Offset i = 0; i < _code_count; ++i)
+			if (_opcodes[i] == opcode::id::BREAK)
+				_opcodes[i] = _breakpoints[i];
+
+		release_breakpoints();
+	}
+
+	void Chunk::release_breakpoints()
+	{
+		delete[] _breakpoints;
+		_breakpoints = nullptr;
+
+		// The counts went past the thresholds while the JIT had to leave the chunk alone.
+		_calls = 0;
+		_loops = 0;
+	}
 }
@@ -99,7 +99,7 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return _value.integral + right._value.integral;
+						return static_cast<type::Integer>(static_cast<UInt64>(_value.integral) + static_cast<UInt64>(right._value.integral));
 					case DataType::Float:
 						return static_cast<type::Float>(_value.integral) + right._value.floating;
 					default: goto error;
@@ -163,7 +163,7 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return _value.integral - right._value.integral;
+						return static_cast<type::Integer>(static_cast<UInt64>(_value.integral) - static_cast<UInt64>(right._value.integral));
 					case DataType::Float:
 						return static_cast<type::Float>(_value.integral) - right._value.floating;
 					default: goto error;
@@ -202,7 +202,7 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return _value.integral * right._value.integral;
+						return static_cast<type::Integer>(static_cast<UInt64>(_value.integral) * static_cast<UInt64>(right._value.integral));
 					case DataType::Float:
 						return static_cast<type::Float>(_value.integral) * right._value.floating;
 					default: goto error;
@@ -359,19 +359,19 @@ namespace kpl
 		throw op_error("mod", *this, right);
 	}
 
-	Value Value::runtime_eq(const Value& right, KPLState& state) const
+	bool Value::runtime_equals(const Value& right, KPLState& state) const
 	{
 		switch (_type)
 		{
 			case DataType::Null:
-				return static_cast<type::Boolean>(right._type == DataType::Null);
+				return right._type == DataType::Null;
 			case DataType::Integer: {
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.integral == right._value.integral);
+						return _value.integral == right._value.integral;
 					case DataType::Float:
-						return static_cast<type::Boolean>(static_cast<type::Float>(_value.integral) == right._value.floating);
+						return static_cast<type::Float>(_value.integral) == right._value.floating;
 					default:
 						return false;
 				}
@@ -380,9 +380,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.floating == static_cast<type::Float>(right._value.integral));
+						return _value.floating == static_cast<type::Float>(right._value.integral);
 					case DataType::Float:
-						return static_cast<type::Boolean>(_value.floating == right._value.floating);
+						return _value.floating == right._value.floating;
 					default:
 						return false;
 				}
@@ -401,7 +401,7 @@ namespace kpl
 					const Value& prop = _value.object->get_property(special_props::operator_eq);
 					if (prop.isNull())
 						return _value.object == right._value.object;
-					return prop.runtime_call(state, *this, right);
+					return prop.runtime_call(state, *this, right).to_bool();
 				}
 				return false;
 			case DataType::Function:
@@ -412,26 +412,26 @@ namespace kpl
 					const Value& prop = _value.userdata->get_property(special_props::operator_eq);
 					if (prop.isNull())
 						return _value.userdata == right._value.userdata;
-					return prop.runtime_call(state, *this, right);
+					return prop.runtime_call(state, *this, right).to_bool();
 				}
 				return false;
 		}
 
 		return false;
 	}
-	Value Value::runtime_ne(const Value& right, KPLState& state) const
+	bool Value::runtime_not_equals(const Value& right, KPLState& state) const
 	{
 		switch (_type)
 		{
 			case DataType::Null:
-				return static_cast<type::Boolean>(right._type != DataType::Null);
+				return right._type != DataType::Null;
 			case DataType::Integer: {
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.integral != right._value.integral);
+						return _value.integral != right._value.integral;
 					case DataType::Float:
-						return static_cast<type::Boolean>(static_cast<type::Float>(_value.integral) != right._value.floating);
+						return static_cast<type::Float>(_value.integral) != right._value.floating;
 					default:
 						return true;
 				}
@@ -440,9 +440,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.floating != static_cast<type::Float>(right._value.integral));
+						return _value.floating != static_cast<type::Float>(right._value.integral);
 					case DataType::Float:
-						return static_cast<type::Boolean>(_value.floating != right._value.floating);
+						return _value.floating != right._value.floating;
 					default:
 						return true;
 				}
@@ -464,9 +464,9 @@ namespace kpl
 						prop = &_value.object->get_property(special_props::operator_eq);
 						if(prop->isNull())
 							return _value.object != right._value.object;
-						return !prop->runtime_call(state, *this, right);
+						return !prop->runtime_call(state, *this, right).to_bool();
 					}
-					return prop->runtime_call(state, *this, right);
+					return prop->runtime_call(state, *this, right).to_bool();
 				}
 				return true;
 			case DataType::Function:
@@ -480,16 +480,16 @@ namespace kpl
 						prop = &_value.userdata->get_property(special_props::operator_eq);
 						if(prop->isNull())
 							return _value.userdata == right._value.userdata;
-						return !prop->runtime_call(state, *this, right);
+						return !prop->runtime_call(state, *this, right).to_bool();
 					}
-					return prop->runtime_call(state, *this, right);
+					return prop->runtime_call(state, *this, right).to_bool();
 				}
 				return true;
 		}
 
 		return true;
 	}
-	Value Value::runtime_gr(const Value& right, KPLState& state) const
+	bool Value::runtime_greater(const Value& right, KPLState& state) const
 	{
 		switch (_type)
 		{
@@ -498,9 +498,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.integral > right._value.integral);
+						return _value.integral > right._value.integral;
 					case DataType::Float:
-						return static_cast<type::Boolean>(static_cast<type::Float>(_value.integral) > right._value.floating);
+						return static_cast<type::Float>(_value.integral) > right._value.floating;
 					default:
 						return true;
 				}
@@ -509,9 +509,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.floating > static_cast<type::Float>(right._value.integral));
+						return _value.floating > static_cast<type::Float>(right._value.integral);
 					case DataType::Float:
-						return static_cast<type::Boolean>(_value.floating > right._value.floating);
+						return _value.floating > right._value.floating;
 					default:
 						return true;
 				}
@@ -522,16 +522,16 @@ namespace kpl
 			case DataType::Array: goto error;
 			case DataType::List: goto error;
 			case DataType::Object:
-				return invoke(state, special_props::operator_gr, right);
+				return invoke(state, special_props::operator_gr, right).to_bool();
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_gr, right);
+				return _value.userdata->invoke(state, special_props::operator_gr, right).to_bool();
 		}
 
 		error:
 		throw op_error("gr", *this, right);
 	}
-	Value Value::runtime_ls(const Value& right, KPLState& state) const
+	bool Value::runtime_less(const Value& right, KPLState& state) const
 	{
 		switch (_type)
 		{
@@ -540,9 +540,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.integral < right._value.integral);
+						return _value.integral < right._value.integral;
 					case DataType::Float:
-						return static_cast<type::Boolean>(static_cast<type::Float>(_value.integral) < right._value.floating);
+						return static_cast<type::Float>(_value.integral) < right._value.floating;
 					default:
 						return true;
 				}
@@ -551,9 +551,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.floating < static_cast<type::Float>(right._value.integral));
+						return _value.floating < static_cast<type::Float>(right._value.integral);
 					case DataType::Float:
-						return static_cast<type::Boolean>(_value.floating < right._value.floating);
+						return _value.floating < right._value.floating;
 					default:
 						return true;
 				}
@@ -564,16 +564,16 @@ namespace kpl
 			case DataType::Array: goto error;
 			case DataType::List: goto error;
 			case DataType::Object:
-				return invoke(state, special_props::operator_ls, right);
+				return invoke(state, special_props::operator_ls, right).to_bool();
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_ls, right);
+				return _value.userdata->invoke(state, special_props::operator_ls, right).to_bool();
 		}
 
 		error:
 		throw op_error("ls", *this, right);
 	}
-	Value Value::runtime_ge(const Value& right, KPLState& state) const
+	bool Value::runtime_greater_equals(const Value& right, KPLState& state) const
 	{
 		switch (_type)
 		{
@@ -582,9 +582,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.integral >= right._value.integral);
+						return _value.integral >= right._value.integral;
 					case DataType::Float:
-						return static_cast<type::Boolean>(static_cast<type::Float>(_value.integral) >= right._value.floating);
+						return static_cast<type::Float>(_value.integral) >= right._value.floating;
 					default:
 						return true;
 				}
@@ -593,9 +593,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.floating >= static_cast<type::Float>(right._value.integral));
+						return _value.floating >= static_cast<type::Float>(right._value.integral);
 					case DataType::Float:
-						return static_cast<type::Boolean>(_value.floating >= right._value.floating);
+						return _value.floating >= right._value.floating;
 					default:
 						return true;
 				}
@@ -606,16 +606,16 @@ namespace kpl
 			case DataType::Array: goto error;
 			case DataType::List: goto error;
 			case DataType::Object:
-				return invoke(state, special_props::operator_ge, right);
+				return invoke(state, special_props::operator_ge, right).to_bool();
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_ge, right);
+				return _value.userdata->invoke(state, special_props::operator_ge, right).to_bool();
 		}
 
 		error:
 		throw op_error("ge", *this, right);
 	}
-	Value Value::runtime_le(const Value& right, KPLState& state) const
+	bool Value::runtime_less_equals(const Value& right, KPLState& state) const
 	{
 		switch (_type)
 		{
@@ -624,9 +624,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.integral <= right._value.integral);
+						return _value.integral <= right._value.integral;
 					case DataType::Float:
-						return static_cast<type::Boolean>(static_cast<type::Float>(_value.integral) <= right._value.floating);
+						return static_cast<type::Float>(_value.integral) <= right._value.floating;
 					default:
 						return true;
 				}
@@ -635,9 +635,9 @@ namespace kpl
 				switch (right._type)
 				{
 					case DataType::Integer:
-						return static_cast<type::Boolean>(_value.floating <= static_cast<type::Float>(right._value.integral));
+						return _value.floating <= static_cast<type::Float>(right._value.integral);
 					case DataType::Float:
-						return static_cast<type::Boolean>(_value.floating <= right._value.floating);
+						return _value.floating <= right._value.floating;
 					default:
 						return true;
 				}
@@ -648,10 +648,10 @@ namespace kpl
 			case DataType::Array: goto error;
 			case DataType::List: goto error;
 			case DataType::Object:
-				return invoke(state, special_props::operator_le, right);
+				return invoke(state, special_props::operator_le, right).to_bool();
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_le, right);
+				return _value.userdata->invoke(state, special_props::operator_le, right).to_bool();
 		}
 
 		error:
@@ -945,7 +945,7 @@ namespace kpl
 		{
 			case DataType::Null: goto error;
 			case DataType::Integer:
-				return -_value.integral;
+				return static_cast<type::Integer>(0 - static_cast<UInt64>(_value.integral));
 			case DataType::Float: 
 				return -_value.floating;
 			case DataType::Boolean: goto error;
@@ -978,10 +978,10 @@ namespace kpl
 			case DataType::List:
 				return type::List::runtime_in(*_value.list, right, state);
 			case DataType::Object:
-				return invoke(state, special_props::operator_in);
+				return invoke(state, special_props::operator_in, right);
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_in);
+				return _value.userdata->invoke(state, special_props::operator_in, right);
 		}
 
 		error:
@@ -1016,10 +1016,10 @@ namespace kpl
 				return *it;
 			} break;
 			case DataType::Object:
-				return invoke(state, special_props::operator_get);
+				return invoke(state, special_props::operator_get, index);
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_get);
+				return _value.userdata->invoke(state, special_props::operator_get, index);
 		}
 
 		error:
@@ -1046,10 +1046,10 @@ namespace kpl
 				return (*it) = right;
 			} break;
 			case DataType::Object:
-				return invoke(state, special_props::operator_set, right);
+				return invoke(state, special_props::operator_set, { index, right });
 			case DataType::Function: goto error;
 			case DataType::Userdata:
-				return _value.userdata->invoke(state, special_props::operator_set, right);
+				return _value.userdata->invoke(state, special_props::operator_set, { index, right });
 		}
 
 		error:
@@ -1361,7 +1361,7 @@ namespace kpl::type
 
 		Size len = left._length;
 		for (Offset i = 0; i < len; ++i)
-			if (!left._array[i].runtime_eq(right._array[i], state))
+			if (!left._array[i].runtime_equals(right._array[i], state))
 				return false;
 
 		return true;
@@ -1374,7 +1374,7 @@ namespace kpl::type
 
 		Size len = left._length;
 		for (Offset i = 0; i < len; ++i)
-			if (!left._array[i].runtime_eq(right._array[i], state))
+			if (!left._array[i].runtime_equals(right._array[i], state))
 				return true;
 
 		return false;
@@ -1384,7 +1384,7 @@ namespace kpl::type
 	{
 		Size len = left._length;
 		for (Offset i = 0; i < len; ++i)
-			if (left._array[i].runtime_eq(right, state))
+			if (left._array[i].runtime_equals(right, state))
 				return true;
 		return false;
 	}
@@ -1416,6 +1416,29 @@ namespace kpl::type
 		return ss << "]", ss.str();
 	}
 
+	const Value* List::step(Size index)
+	{
+		if (index >= size())
+			return nullptr;
+
+		Cursor* cursor = nullptr;
+		for (Cursor& candidate : _cursors)
+			if (candidate.position == index && candidate.element != cend())
+				cursor = &candidate;
+
+		if (!cursor)
+		{
+			cursor = &_cursors[_next_cursor];
+			_next_cursor = (_next_cursor + 1) % cursor_count;
+			cursor->element = std::next(cbegin(), index);
+		}
+
+		const Value* element = &*cursor->element;
+		++cursor->element;
+		cursor->position = index + 1;
+		return element;
+	}
+
 	Value List::runtime_concat(const List& left, const List& right, MemoryHeap& heap)
 	{
 		Value value = heap.make_list(left);
@@ -1450,7 +1473,7 @@ namespace kpl::type
 		const auto lend = left.end();
 		const auto rend = right.end();
 		for (auto lit = left.begin(), rit = right.begin(); lit != lend && rit != rend; ++lit, ++rit)
-			if (!lit->runtime_eq(*rit, state))
+			if (!lit->runtime_equals(*rit, state))
 				return false;
 
 		return true;
@@ -1464,7 +1487,7 @@ namespace kpl::type
 		const auto lend = left.end();
 		const auto rend = right.end();
 		for (auto lit = left.begin(), rit = right.begin(); lit != lend && rit != rend; ++lit, ++rit)
-			if (!lit->runtime_eq(*rit, state))
+			if (!lit->runtime_equals(*rit, state))
 				return true;
 
 		return false;
@@ -1472,7 +1495,7 @@ namespace kpl::type
 
 	type::Boolean List::runtime_in(const List& left, const Value& right, KPLState& state)
 	{
-		return std::find_if(left.begin(), left.end(), [&right, &state](const Value& value) { return value.runtime_eq(right, state); }) != left.end();
+		return std::find_if(left.begin(), left.end(), [&right, &state](const Value& value) { return value.runtime_equals(right, state); }) != left.end();
 	}
 }
 
@@ -1482,11 +1505,35 @@ namespace kpl::type
 {
 	void Object::_mheap_delete(void* block) { reinterpret_cast<Object*>(block)->~Object(); }
 
+	ObjectLayout* ObjectLayout::root()
+	{
+		static ObjectLayout layout;
+		return &layout;
+	}
+
+	ObjectLayout* ObjectLayout::with(const std::string& name)
+	{
+		std::unique_ptr<ObjectLayout>& next = _transitions[name];
+		if (!next)
+			next = std::make_unique<ObjectLayout>();
+		return next.get();
+	}
+
+
+
+	UInt64 Object::next_serial()
+	{
+		static UInt64 serial = 0;
+		return ++serial;
+	}
+
 	Object::Object(const Value* parents, const Size count) :
 		unordered_map(),
 		_class(),
 		_parents{ count > 0 ? new Value[count] : nullptr },
-		_parentSize{ count }
+		_parentSize{ count },
+		_layout{ ObjectLayout::root() },
+		_serial{ next_serial() }
 	{
 		if (_parents)
 			for (Offset i = 0; i < _parentSize; ++i)
@@ -1574,6 +1621,48 @@ namespace kpl::type
 
 		return literal::Null;
 	}
+
+	std::pair<Object::iterator, bool> Object::insert(const value_type& property)
+	{
+		auto result = unordered_map::insert(property);
+		if (result.second && _layout)
+			_layout = _layout->with(property.first);
+		return result;
+	}
+
+	std::pair<Object::iterator, bool> Object::insert_or_assign(const std::string& name, const Value& value)
+	{
+		auto result = unordered_map::insert_or_assign(name, value);
+		if (result.second && _layout)
+			_layout = _layout->with(name);
+		return result;
+	}
+
+	Value& Object::operator[] (const std::string& name)
+	{
+		auto result = unordered_map::try_emplace(name);
+		if (result.second && _layout)
+			_layout = _layout->with(name);
+		return result.first->second;
+	}
+
+	Object::size_type Object::erase(const std::string& name)
+	{
+		size_type count = unordered_map::erase(name);
+		if (count > 0)
+		{
+			_layout = nullptr;
+			_serial = next_serial();
+		}
+		return count;
+	}
+
+	void Object::clear()
+	{
+		unordered_map::clear();
+		_layout = ObjectLayout::root();
+		_serial = next_serial();
+	}
 }
 
 
@@ -1646,4 +1735,9 @@ namespace kpl::type
 	{
 		return get_property(property_name).runtime_call(state, this, args);
 	}
+
+	bool Userdata::iterate(KPLState&, Value&, Value&, Value&)
+	{
+		throw BadValueOperation("Userdata is not iterable");
+	}
 }
@@ -0,0 +1,10 @@
+#include "hooks.h"
+#include "instruction.h"
+
+namespace kpl
+{
+	void InstructionTraceHooks::on_instruction(KPLState& /*state*/, const Chunk& /*chunk*/, Offset /*offset*/, InstructionCode inst)
+	{
+		*_os << static_cast<inst::Instruction>(inst) << '\n';
+	}
+}
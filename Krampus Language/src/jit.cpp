@@ -0,0 +1,518 @@
+#include "jit_x64.h"
+
+namespace kpl::jit
+{
+	NativeCode::NativeCode(const std::vector<UInt8>& code, std::vector<opcode::id>&& opcodes) :
+		_code{ std::make_unique<utils::ExecutableBlock>(code.size()) },
+		_entry{ reinterpret_cast<Entry>(_code->data()) },
+		_opcodes{ std::move(opcodes) }
+	{
+		std::memcpy(_code->data(), code.data(), code.size());
+		_code->seal();
+	}
+
+	NativeCode::NativeCode(Entry entry, std::vector<opcode::id>&& opcodes) :
+		_code{},
+		_entry{ entry },
+		_opcodes{ std::move(opcodes) }
+	{}
+}
+
+
+
+#if KPL_JIT
+namespace kpl::jit
+{
+	using namespace x64;
+
+	class Compiler
+	{
+	private:
+		typedef Assembler::Label Label;
+
+		const Chunk& _chunk;
+		const Offset _count;
+		Assembler _asm;
+		std::vector<Label> _instructions;
+		std::map<Offset, Label> _exits;
+		Label _epilogue;
+
+		inline Operand operand(unsigned int index, bool constant) const
+		{
+			return constant ? Operand{ &_chunk.constant(index), 0 } : Operand{ nullptr, index };
+		}
+
+		// Returns to the interpreter at offset.
+		inline Label exit(Offset offset)
+		{
+			auto it = _exits.find(offset);
+			if (it == _exits.end())
+				it = _exits.emplace(offset, _asm.label()).first;
+			return it->second;
+		}
+
+		// Where execution continues at offset: its template, or the interpreter if it is past the code.
+		inline Label target(Offset offset) { return offset < _count ? _instructions[offset] : exit(offset); }
+
+		inline void guard_type(unsigned int reg, DataType type, Offset offset)
+		{
+			_asm.cmp_type(reg, type_code(type));
+			_asm.jcc(Condition::not_equal, exit(offset));
+		}
+
+		// R(reg) is about to be overwritten without releasing what it holds.
+		inline void guard_scalar(unsigned int reg, Offset offset)
+		{
+			_asm.cmp_type(reg, last_scalar_type);
+			_asm.jcc(Condition::above, exit(offset));
+		}
+
+		inline void guard_operand(const Operand& op, DataType type, Offset offset)
+		{
+			if (!op.constant)
+				guard_type(op.reg, type, offset);
+		}
+
+		inline void load_integer(Reg dst, const Operand& op)
+		{
+			if (op.constant)
+				_asm.mov(dst, payload_bits(*op.constant));
+			else _asm.load_payload(dst, op.reg);
+		}
+
+		inline void load_float(Xmm dst, const Operand& op)
+		{
+			if (op.constant)
+			{
+				_asm.mov(Reg::rax, payload_bits(*op.constant));
+				_asm.movq(dst, Reg::rax);
+			}
+			else _asm.load_float(dst, op.reg);
+		}
+
+		// rax op= right, right being an Integer.
+		inline void integer_op(Alu op, const Operand& right)
+		{
+			if (right.constant)
+			{
+				_asm.mov(Reg::rcx, payload_bits(*right.constant));
+				_asm.alu(op, Reg::rax, Reg::rcx);
+			}
+			else _asm.alu(op, Reg::rax, right.reg);
+		}
+
+		// Runs integer_path or float_path depending on the types of left and right, exiting on
+		// any other pair. At most one of them can apply once a constant is involved.
+		template<typename _IntPath, typename _FloatPath>
+		bool numeric(Offset offset, const Operand& left, const Operand& right, bool floats_allowed, _IntPath&& integer_path, _FloatPath&& float_path)
+		{
+			const bool ints = left.can_be(DataType::Integer) && right.can_be(DataType::Integer);
+			const bool floats = floats_allowed && left.can_be(DataType::Float) && right.can_be(DataType::Float);
+			if (!ints && !floats)
+				return false;
+
+			if (left.constant || right.constant || !floats)
+			{
+				const DataType type = ints ? DataType::Integer : DataType::Float;
+				guard_operand(left, type, offset);
+				guard_operand(right, type, offset);
+				if (ints)
+					integer_path();
+				else float_path();
+				return true;
+			}
+
+			const Label float_check = _asm.label();
+			_asm.load_type(Reg::rax, left.reg);
+			_asm.load_type(Reg::rcx, right.reg);
+			_asm.type_pair();
+			_asm.cmp_eax((type_code(DataType::Integer) << 4) | type_code(DataType::Integer));
+			_asm.jcc(Condition::not_equal, float_check);
+			integer_path();
+			_asm.jmp(target(offset + 1));
+
+			_asm.bind(float_check);
+			_asm.cmp_eax((type_code(DataType::Float) << 4) | type_code(DataType::Float));
+			_asm.jcc(Condition::not_equal, exit(offset));
+			float_path();
+			return true;
+		}
+
+		bool arithmetic(Offset offset, opcode::id op, unsigned int dst, const Operand& left, const Operand& right)
+		{
+			guard_scalar(dst, offset);
+
+			Alu int_op = Alu::add;
+			Sse float_op = Sse::div;
+			switch (op)
+			{
+				case opcode::id::ADD: int_op = Alu::add; float_op = Sse::add; break;
+				case opcode::id::SUB: int_op = Alu::sub; float_op = Sse::sub; break;
+				case opcode::id::MUL: int_op = Alu::imul; float_op = Sse::mul; break;
+				default: break;
+			}
+
+			auto store_float = [&] {
+				_asm.store_float(dst, Xmm::xmm0);
+				_asm.store_type(dst, DataType::Float);
+			};
+
+			return numeric(offset, left, right, true,
+				[&] {
+					if (op == opcode::id::DIV)
+					{
+						// DIV of two Integers is a Float division, like DIV_II.
+						load_integer(Reg::rax, left);
+						_asm.cvtsi2sd(Xmm::xmm0, Reg::rax);
+						load_integer(Reg::rax, right);
+						_asm.cvtsi2sd(Xmm::xmm1, Reg::rax);
+						_asm.sse(float_op, Xmm::xmm0, Xmm::xmm1);
+						store_float();
+						return;
+					}
+
+					load_integer(Reg::rax, left);
+					integer_op(int_op, right);
+					_asm.store_payload(dst, Reg::rax);
+					_asm.store_type(dst, DataType::Integer);
+				},
+				[&] {
+					load_float(Xmm::xmm0, left);
+					load_float(Xmm::xmm1, right);
+					_asm.sse(float_op, Xmm::xmm0, Xmm::xmm1);
+					store_float();
+				});
+		}
+
+		// Skips the next instruction when the comparison holds.
+		bool compare(Offset offset, opcode::id op, const Operand& left, const Operand& right)
+		{
+			Condition int_condition;
+			switch (op)
+			{
+				case opcode::id::EQ: int_condition = Condition::equal; break;
+				case opcode::id::NE: int_condition = Condition::not_equal; break;
+				case opcode::id::GR: int_condition = Condition::greater; break;
+				case opcode::id::LS: int_condition = Condition::less; break;
+				case opcode::id::GE: int_condition = Condition::greater_equal; break;
+				default: int_condition = Condition::less_equal; break;
+			}
+
+			const Label skip = target(offset + 2);
+			return numeric(offset, left, right, true,
+				[&] {
+					load_integer(Reg::rax, left);
+					integer_op(Alu::cmp, right);
+					_asm.jcc(int_condition, skip);
+				},
+				[&] {
+					load_float(Xmm::xmm0, left);
+					load_float(Xmm::xmm1, right);
+					if (op == opcode::id::LS || op == opcode::id::LE)
+						_asm.ucomisd(Xmm::xmm1, Xmm::xmm0);
+					else _asm.ucomisd(Xmm::xmm0, Xmm::xmm1);
+					float_guard(_asm, op, false, skip);
+				});
+		}
+
+		// Skips the next instruction when the truth of value is expected. Only Null, Boolean
+		// and Integer registers are tested here.
+		bool test(Offset offset, const Operand& value, bool expected)
+		{
+			const Label skip = target(offset + 2);
+			const Label next = target(offset + 1);
+			if (value.constant)
+			{
+				if (!is_scalar(*value.constant) || value.constant->isFloat())
+					return false;
+				_asm.jmp(value.constant->to_bool() == expected ? skip : next);
+				return true;
+			}
+
+			const Label boolean = _asm.label();
+			const Label is_true = _asm.label();
+			const Label is_false = _asm.label();
+
+			_asm.load_type(Reg::rax, value.reg);
+			_asm.test_eax();
+			_asm.jcc(Condition::equal, is_false);
+			_asm.cmp_eax(type_code(DataType::Boolean));
+			_asm.jcc(Condition::equal, boolean);
+			_asm.cmp_eax(type_code(DataType::Integer));
+			_asm.jcc(Condition::not_equal, exit(offset));
+			_asm.cmp_payload_zero(value.reg);
+			_asm.jcc(Condition::equal, is_false);
+			_asm.jmp(is_true);
+
+			_asm.bind(boolean);
+			_asm.cmp_payload_byte_zero(value.reg);
+			_asm.jcc(Condition::equal, is_false);
+
+			_asm.bind(is_true);
+			_asm.jmp(expected ? skip : next);
+
+			_asm.bind(is_false);
+			_asm.jmp(expected ? next : skip);
+			return true;
+		}
+
+		// Leaves at offset, before the jump, if it is backward and fuel is out, so the interpreter
+		// runs the jump itself and preempts or throws exactly where it would have.
+		inline void check_fuel(Offset offset, Offset destination)
+		{
+			if (destination <= offset)
+			{
+				_asm.cmp_fuel_zero();
+				_asm.jcc(Condition::less_equal, exit(offset));
+			}
+		}
+
+		inline void jump(Offset offset, Offset destination)
+		{
+			if (destination <= offset)
+				_asm.dec_fuel();
+			_asm.jmp(target(destination));
+		}
+
+		// Integer FORLOOP as run by int_for_loop; float loops are left to the interpreter.
+		bool for_loop(Offset offset, unsigned int base, Offset body)
+		{
+			guard_type(base, DataType::Integer, offset);
+			guard_type(base + 1, DataType::Integer, offset);
+			guard_type(base + 2, DataType::Integer, offset);
+			guard_scalar(base + 3, offset);
+
+			_asm.load_payload(Reg::rax, base + 1);
+			_asm.test(Reg::rax);
+			_asm.jcc(Condition::equal, target(offset + 1));
+			check_fuel(offset, body);
+
+			_asm.dec(Reg::rax);
+			_asm.store_payload(base + 1, Reg::rax);
+			_asm.load_payload(Reg::rax, base);
+			_asm.alu(Alu::add, Reg::rax, base + 2);
+			_asm.store_payload(base, Reg::rax);
+			_asm.store_payload(base + 3, Reg::rax);
+			_asm.store_type(base + 3, DataType::Integer);
+
+			jump(offset, body);
+			return true;
+		}
+
+		// Emits the template of the instruction at offset. Returns false if there is none.
+		bool instruction(Offset offset, InstructionCode code)
+		{
+			using opcode::id;
+
+			const unsigned int a = inst::arg::a(code);
+			const unsigned int b = inst::arg::b(code);
+			const unsigned int c = inst::arg::c(code);
+			const Operand rkb = operand(b, inst::arg::kb(code));
+			const Operand rkc = operand(c, inst::arg::kc(code));
+
+			switch (inst::arg::opcode(code))
+			{
+				case id::NOP:
+					return true;
+
+				case id::MOVE:
+					guard_scalar(a, offset);
+					_asm.load_type(Reg::rax, b);
+					_asm.cmp_eax(last_scalar_type);
+					_asm.jcc(Condition::above, exit(offset));
+					_asm.load_payload(Reg::rcx, b);
+					_asm.store_payload(a, Reg::rcx);
+					_asm.store_type(a, Reg::rax);
+					return true;
+
+				case id::LOAD_K: {
+					const Value& constant = _chunk.constant(inst::arg::bx(code));
+					if (!is_scalar(constant))
+						return false;
+
+					guard_scalar(a, offset);
+					_asm.store_payload(a, payload_bits(constant));
+					_asm.store_type(a, constant.type());
+					return true;
+				}
+
+				case id::LOAD_BOOL:
+					guard_scalar(a, offset);
+					_asm.store_payload(a, static_cast<UInt64>(b ? 1 : 0));
+					_asm.store_type(a, DataType::Boolean);
+					if (c)
+						_asm.jmp(target(offset + 2));
+					return true;
+
+				case id::LOAD_NULL:
+					for (unsigned int reg = a; reg <= b; ++reg)
+						guard_scalar(reg, offset);
+					for (unsigned int reg = a; reg <= b; ++reg)
+					{
+						_asm.store_payload(reg, static_cast<UInt64>(0));
+						_asm.store_type(reg, DataType::Null);
+					}
+					return true;
+
+				case id::LOAD_INT:
+					guard_scalar(a, offset);
+					_asm.store_payload(a, static_cast<UInt64>(static_cast<Int64>(inst::arg::sbx(code))));
+					_asm.store_type(a, DataType::Integer);
+					return true;
+
+				case id::ADD:
+				case id::SUB:
+				case id::MUL:
+				case id::DIV:
+					return arithmetic(offset, inst::arg::opcode(code), a, rkb, rkc);
+
+				case id::EQ:
+				case id::NE:
+				case id::GR:
+				case id::LS:
+				case id::GE:
+				case id::LE:
+					return compare(offset, inst::arg::opcode(code), rkb, rkc);
+
+				case id::JP: {
+					const Offset destination = inst::arg::ax(code);
+					check_fuel(offset, destination);
+					jump(offset, destination);
+					return true;
+				}
+
+				case id::TEST:
+					return test(offset, rkb, c != 0);
+
+				case id::FORLOOP:
+					return for_loop(offset, a, inst::arg::bx(code));
+
+				default:
+					return false;
+			}
+		}
+
+	public:
+		inline explicit Compiler(const Chunk& chunk) :
+			_chunk{ chunk },
+			_count{ chunk.instruction_count() },
+			_asm{},
+			_instructions{},
+			_exits{},
+			_epilogue{ 0 }
+		{
+			_instructions.reserve(_count);
+			for (Offset i = 0; i < _count; ++i)
+				_instructions.push_back(_asm.label());
+			_epilogue = _asm.label();
+		}
+
+		// Generates the code and marks in compiled which instructions have a template.
+		// Returns false if none of them has.
+		bool compile(std::vector<bool>& compiled)
+		{
+			const Label table = _asm.label();
+			// Frame and fuel pointers stay in rbx and r12 throughout.
+			_asm.push(Reg::rbx);
+			_asm.push(Reg::r12);
+			_asm.mov(Reg::rbx, args[0]);
+			_asm.mov(Reg::r12, args[2]);
+			_asm.mov(Reg::rcx, args[1]);
+			_asm.jump_table(table);
+
+			bool any = false;
+			compiled.assign(_count, false);
+			for (Offset offset = 0; offset < _count; ++offset)
+			{
+				// A template that gives up half way is rolled back to a plain exit.
+				const Offset start = _asm.size();
+				_asm.bind(_instructions[offset]);
+				if (instruction(offset, _chunk.instruction(offset)))
+					compiled[offset] = any = true;
+				else
+				{
+					_asm.rewind(start);
+					_asm.jmp(exit(offset));
+				}
+			}
+			_asm.jmp(exit(_count));
+
+			if (!any)
+				return false;
+
+			for (const auto& [offset, label] : _exits)
+			{
+				_asm.bind(label);
+				_asm.mov_eax(static_cast<UInt32>(offset));
+				_asm.jmp(_epilogue);
+			}
+
+			_asm.bind(_epilogue);
+			_asm.pop(Reg::r12);
+			_asm.pop(Reg::rbx);
+			_asm.ret();
+
+			_asm.align(4);
+			_asm.bind(table);
+			for (Offset offset = 0; offset < _count; ++offset)
+				_asm.int32(static_cast<Int32>(_asm.position(_instructions[offset]) - _asm.position(table)));
+
+			_asm.link();
+			return true;
+		}
+
+		inline const std::vector<UInt8>& code() const { return _asm.code(); }
+	};
+}
+#endif
+
+
+
+namespace kpl::jit
+{
+	bool compile(Chunk& chunk)
+	{
+#if KPL_JIT
+		// A recording relies on every instruction of its loop dispatching through it, and a
+		// breakpoint on its instruction dispatching through BREAK.
+		if (!chunk._verified || chunk._native || chunk._breakpoints || (chunk._traces && chunk._traces->recording()))
+			return false;
+
+		Compiler compiler{ chunk };
+		std::vector<bool> compiled;
+		if (!compiler.compile(compiled))
+			return false;
+
+		chunk._native = new NativeCode(compiler.code(), std::vector<opcode::id>(chunk._opcodes, chunk._opcodes + chunk._code_count));
+
+		// Instructions without a template keep their opcode, so the interpreter runs them
+		// without going through the machine code.
+		for (Offset i = 0; i < chunk._code_count; ++i)
+			if (compiled[i])
+				chunk._opcodes[i] = opcode::id::NATIVE;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void discard(Chunk& chunk)
+	{
+		if (chunk._native)
+		{
+			for (Offset i = 0; i < chunk._code_count; ++i)
+				if (chunk._opcodes[i] == opcode::id::NATIVE)
+					chunk._opcodes[i] = chunk._native->opcode(i);
+
+			delete chunk._native;
+			chunk._native = nullptr;
+		}
+
+		if (chunk._traces)
+		{
+			chunk._traces->restore(chunk);
+			delete chunk._traces;
+			chunk._traces = nullptr;
+		}
+	}
+}
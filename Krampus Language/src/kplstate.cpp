@@ -1,10 +1,67 @@
 #include "kplstate.h"
 
+#include <atomic>
+
 namespace kpl
 {
+	UInt64 GlobalsManager::next_serial()
+	{
+		static std::atomic<UInt64> serial = 0;
+		return ++serial;
+	}
+
+	GlobalsManager::GlobalsManager(GlobalsManager&& globals) noexcept :
+		_names{ std::move(globals._names) },
+		_slots{ std::move(globals._slots) },
+		_serial{ globals._serial }
+	{
+		globals._names.clear();
+		globals._slots.clear();
+		globals._serial = next_serial();
+	}
+
+	GlobalsManager& GlobalsManager::operator= (const GlobalsManager& right)
+	{
+		_names = right._names;
+		_slots = right._slots;
+		_serial = next_serial();
+		return *this;
+	}
+
+	GlobalsManager& GlobalsManager::operator= (GlobalsManager&& right) noexcept
+	{
+		_names = std::move(right._names);
+		_slots = std::move(right._slots);
+		_serial = right._serial;
+		right._names.clear();
+		right._slots.clear();
+		right._serial = next_serial();
+		return *this;
+	}
+
+	UInt32 GlobalsManager::slot(const std::string& name)
+	{
+		auto result = _names.try_emplace(name, static_cast<UInt32>(_slots.size()));
+		if (result.second)
+			_slots.emplace_back();
+		return result.first->second;
+	}
+
+	UInt32 GlobalsManager::find_slot(const std::string& name) const
+	{
+		auto it = _names.find(name);
+		return it == _names.end() ? no_slot : it->second;
+	}
+
 	const Value& GlobalsManager::get_value(const std::string& name) const
 	{
-		auto it = _values.find(name);
-		return it == _values.end() ? _nullvalue : it->second;
+		return get_slot(find_slot(name));
+	}
+
+	void GlobalsManager::delete_value(const std::string& name)
+	{
+		UInt32 slot = find_slot(name);
+		if (slot < _slots.size())
+			_slots[slot] = nullptr;
 	}
 }
@@ -23,6 +23,8 @@ int main(int argc, char** argv)
 	obj.object()["power"] = 50;
 
 	KPLState state;
+	InstructionTraceHooks tracer;
+	state.set_hooks(&tracer);
 
 	InstructionList insts = program_code();
 
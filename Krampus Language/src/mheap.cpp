@@ -6,7 +6,8 @@ namespace kpl
 {
 	MemoryHeap::MemoryHeap() :
 		_front{ nullptr },
-		_back{ nullptr }
+		_back{ nullptr },
+		_hooks{ nullptr }
 	{}
 
 	MemoryHeap::~MemoryHeap()
@@ -35,6 +36,8 @@ namespace kpl
 			_front = block;
 		}
 
+		__KPL_HOOK(_hooks, on_allocation(block + 1, size));
+
 		return block;
 	}
 
@@ -0,0 +1,540 @@
+#include "optimizer.h"
+
+namespace kpl::optimizer
+{
+	typedef std::bitset<256> RegisterSet;
+
+	// What kind of value an instruction leaves in its target register.
+	enum class Result : UInt8
+	{
+		None,
+		Scalar,
+		Operands,		// A heap reference only if one of the operands is (arithmetic, MOVE, TEST_SET ...)
+		Reference
+	};
+
+	struct RegisterAccess
+	{
+		RegisterSet reads;
+		RegisterSet writes;			// Written on every path through the instruction
+		unsigned int target;		// Register the result goes to, written or not
+		Result result;
+		bool reference_constant;	// One of the constant operands is a heap reference
+		RegisterSet reference_writes;	// Registers besides the target that may receive a heap reference
+	};
+
+	static inline bool is_reference(const Value& value)
+	{
+		return !value.isNull() && !value.isInteger() && !value.isFloat() && !value.isBoolean();
+	}
+
+	static RegisterAccess register_access(const Chunk& chunk, InstructionCode code)
+	{
+		using opcode::id;
+
+		RegisterAccess access{ {}, {}, 0, Result::None, false, {} };
+		const unsigned int registers = static_cast<unsigned int>(chunk.register_count());
+		const unsigned int a = inst::arg::a(code);
+		const unsigned int b = inst::arg::b(code);
+		const unsigned int c = inst::arg::c(code);
+
+		auto read = [&](unsigned int reg) {
+			if (reg < registers)
+				access.reads.set(reg);
+		};
+		auto read_range = [&](unsigned int first, unsigned int last) {
+			for (unsigned int reg = first; reg <= last; ++reg)
+				read(reg);
+		};
+		auto read_rk = [&](unsigned int operand, bool constant) {
+			if (!constant)
+				read(operand);
+			else if (is_reference(chunk.constant(operand)))
+				access.reference_constant = true;
+		};
+		auto write = [&](unsigned int reg, Result result) {
+			if (reg < registers)
+				access.writes.set(reg);
+			access.target = reg;
+			access.result = result;
+		};
+
+		switch (inst::arg::opcode(code))
+		{
+			case id::MOVE:
+				read(b);
+				write(a, Result::Operands);
+				break;
+
+			case id::LOAD_K:
+				write(a, is_reference(chunk.constant(inst::arg::bx(code))) ? Result::Reference : Result::Scalar);
+				break;
+
+			case id::LOAD_BOOL:
+			case id::LOAD_INT:
+				write(a, Result::Scalar);
+				break;
+
+			case id::LOAD_NULL:
+				for (unsigned int reg = a; reg <= b && reg < registers; ++reg)
+					access.writes.set(reg);
+				break;
+
+			case id::GET_GLOBAL:
+			case id::GET_LOCAL:
+			case id::NEW_ARRAY:
+				read_rk(b, inst::arg::kb(code));
+				write(a, Result::Reference);
+				break;
+
+			case id::GET_PROP:
+				read_rk(b, inst::arg::kb(code));
+				read_rk(c, inst::arg::kc(code));
+				write(a, Result::Reference);
+				break;
+
+			case id::SET_GLOBAL:
+			case id::SET_LOCAL:
+			case id::EQ:
+			case id::NE:
+			case id::GR:
+			case id::LS:
+			case id::GE:
+			case id::LE:
+				read_rk(b, inst::arg::kb(code));
+				read_rk(c, inst::arg::kc(code));
+				break;
+
+			case id::SET_PROP:
+			case id::SET:
+				read(a);
+				read_rk(b, inst::arg::kb(code));
+				read_rk(c, inst::arg::kc(code));
+				break;
+
+			case id::NEW_LIST:
+			case id::SELF:
+				write(a, Result::Reference);
+				break;
+
+			case id::NEW_OBJECT:
+				if (c)
+					read_rk(b, inst::arg::kb(code));
+				write(a, Result::Reference);
+				break;
+
+			case id::SET_AL:
+				read(a);
+				read_range(b, c);
+				break;
+
+			case id::ADD:
+			case id::SUB:
+			case id::MUL:
+			case id::DIV:
+			case id::IDIV:
+			case id::MOD:
+			case id::SHL:
+			case id::SHR:
+			case id::BAND:
+			case id::BOR:
+			case id::XOR:
+			case id::IN:
+			case id::GET:
+				read_rk(b, inst::arg::kb(code));
+				read_rk(c, inst::arg::kc(code));
+				write(a, Result::Operands);
+				break;
+
+			case id::INSTANCEOF:
+				read_rk(b, inst::arg::kb(code));
+				read_rk(c, inst::arg::kc(code));
+				write(a, Result::Scalar);
+				break;
+
+			case id::BNOT:
+			case id::NOT:
+			case id::NEG:
+			case id::LEN:
+				read_rk(b, inst::arg::kb(code));
+				write(a, Result::Operands);
+				break;
+
+			case id::TEST:
+			case id::SWITCH:
+			case id::THROW:
+				read_rk(b, inst::arg::kb(code));
+				break;
+
+			case id::TEST_SET:
+				// R(A) is only written when the next instruction is not skipped.
+				read_rk(b, inst::arg::kb(code));
+				access.target = a;
+				access.result = Result::Operands;
+				break;
+
+			case id::CALL:
+				read_range(a, a + b);
+				for (unsigned int reg = a + 1; reg < a + c && reg < registers; ++reg)
+				{
+					access.writes.set(reg);
+					access.reference_writes.set(reg);
+				}
+				write(a, Result::Reference);
+				break;
+
+			case id::INVOKE:
+				read_range(a, a + c);
+				read_rk(b, inst::arg::kb(code));
+				write(a, Result::Reference);
+				break;
+
+			case id::RETURN:
+				if (a)
+					read_rk(b, inst::arg::kb(code));
+				break;
+
+			case id::YIELD:
+				read_rk(b, inst::arg::kb(code));
+				write(a, Result::Reference);
+				break;
+
+			case id::RESUME:
+				read_rk(b, inst::arg::kb(code));
+				read_rk(c, inst::arg::kc(code));
+				write(a, Result::Reference);
+				break;
+
+			case id::FORPREP:
+				read_range(a, a + 2);
+				for (unsigned int reg = a; reg <= a + 3 && reg < registers; ++reg)
+					access.writes.set(reg);
+				break;
+
+			case id::FORLOOP:
+				read_range(a, a + 2);
+				break;
+
+			case id::ITER_PREP:
+				read(a);
+				for (unsigned int reg = a + 1; reg <= a + 2 && reg < registers; ++reg)
+					access.writes.set(reg);
+				break;
+
+			case id::RETURN_MULTI:
+				if (b)
+					read_range(a, a + b - 1);
+				break;
+
+			case id::VARARG:
+				for (unsigned int reg = a; reg < a + c && reg < registers; ++reg)
+				{
+					access.writes.set(reg);
+					access.reference_writes.set(reg);
+				}
+				break;
+
+			case id::VARARGS:
+				write(a, Result::Reference);
+				break;
+
+			case id::ARG_COUNT:
+				write(a, Result::Scalar);
+				break;
+
+			case id::ITER_NEXT:
+				// The key and value registers are cleared once the container is exhausted, and
+				// a Userdata may keep any value as its cursor.
+				read_range(a, a + 2);
+				for (unsigned int reg = a + 1; reg <= a + 4 && reg < registers; ++reg)
+				{
+					if (reg >= a + 3)
+						access.writes.set(reg);
+					if (reg != a + 2)
+						access.reference_writes.set(reg);
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		return access;
+	}
+
+	// Calls fn with each instruction that may run after the one at offset.
+	template<typename _Fn>
+	static void for_each_successor(const Chunk& chunk, Offset offset, _Fn&& fn)
+	{
+		using opcode::id;
+
+		const InstructionCode code = chunk.instruction(offset);
+		auto add = [&](Offset target) {
+			if (target < chunk.instruction_count())
+				fn(target);
+		};
+
+		switch (inst::arg::opcode(code))
+		{
+			case id::JP:
+				add(inst::arg::ax(code));
+				break;
+
+			case id::RETURN:
+			case id::RETURN_MULTI:
+			case id::THROW:
+				break;
+
+			case id::LOAD_BOOL:
+				add(offset + (inst::arg::c(code) ? 2 : 1));
+				break;
+
+			case id::FORPREP:
+				add(offset + 1);
+				add(inst::arg::bx(code) + 1);
+				break;
+
+			case id::FORLOOP:
+			case id::ITER_NEXT:
+				add(offset + 1);
+				add(inst::arg::bx(code));
+				break;
+
+			case id::ITER_PREP:
+				add(inst::arg::bx(code));
+				break;
+
+			case id::SWITCH: {
+				if (inst::arg::c(code) >= chunk.switch_count())
+					break;
+
+				const SwitchTable& table = chunk.switch_table(inst::arg::c(code));
+				add(table.default_target);
+				for (Offset i = 0; i < table.dense_count; ++i)
+					add(table.dense[i]);
+				if (table.entries)
+					for (Offset slot = 0; slot <= table.mask; ++slot)
+						if (!table.entries[slot].key.isNull())
+							add(table.entries[slot].target);
+			} break;
+
+			case id::EQ:
+			case id::NE:
+			case id::GR:
+			case id::LS:
+			case id::GE:
+			case id::LE:
+			case id::TEST:
+			case id::TEST_SET:
+				add(offset + 1);
+				add(offset + 2);
+				break;
+
+			default:
+				add(offset + 1);
+				break;
+		}
+
+	}
+
+	void analyze_registers(const Chunk& chunk, UInt8* flags)
+	{
+		const Size count = chunk.instruction_count();
+		const unsigned int registers = static_cast<unsigned int>(chunk.register_count());
+		std::fill(flags, flags + registers, 0);
+		if (count == 0)
+			return;
+
+		std::vector<RegisterAccess> accesses;
+		accesses.reserve(count);
+		for (Offset offset = 0; offset < count; ++offset)
+			accesses.push_back(chunk.dispatch_opcode(offset) != opcode::id::INVALID ? register_access(chunk, chunk.instruction(offset)) : RegisterAccess{});
+
+		// Registers written on every path from the entry to each reachable instruction.
+		std::vector<RegisterSet> written(count);
+		std::vector<bool> reached(count, false);
+		std::vector<Offset> pending{ 0 };
+		reached[0] = true;
+		while (!pending.empty())
+		{
+			const Offset offset = pending.back();
+			pending.pop_back();
+
+			auto flow = [&](Offset next, const RegisterSet& out) {
+				RegisterSet& in = written[next];
+				if (!reached[next])
+				{
+					reached[next] = true;
+					in = out;
+				}
+				else if ((in & out) != in)
+					in &= out;
+				else return;
+
+				pending.push_back(next);
+			};
+
+			// An instruction that failed verification raises an error before doing anything.
+			const RegisterSet out = written[offset] | accesses[offset].writes;
+			if (chunk.dispatch_opcode(offset) != opcode::id::INVALID)
+				for_each_successor(chunk, offset, [&](Offset next) { flow(next, out); });
+
+			// The instruction may raise an error before writing anything.
+			if (const ExceptionHandler* handler = chunk.handler(offset); handler && handler->target < count)
+				flow(handler->target, RegisterSet{ written[offset] }.set(handler->reg));
+		}
+
+		// A register read before it is written may hold an argument, which can be anything.
+		RegisterSet references;
+		for (Offset offset = 0; offset < count; ++offset)
+			if (reached[offset])
+				references |= accesses[offset].reads & ~written[offset];
+
+		for (unsigned int reg = 0; reg < registers; ++reg)
+			if (references.test(reg))
+				flags[reg] = register_flag::read_on_entry;
+
+		for (Offset offset = 0; offset < count; ++offset)
+			if (reached[offset])
+				references |= accesses[offset].reference_writes;
+
+		for (Offset i = 0; i < chunk.handler_count(); ++i)
+			if (chunk.handlers()[i].reg < registers)
+				references.set(chunk.handlers()[i].reg);
+
+		bool changed;
+		do
+		{
+			changed = false;
+			for (Offset offset = 0; offset < count; ++offset)
+			{
+				const RegisterAccess& access = accesses[offset];
+				if (!reached[offset] || access.target >= registers || references.test(access.target))
+					continue;
+
+				if (access.result == Result::Reference || (access.result == Result::Operands && (access.reference_constant || (access.reads & references).any())))
+				{
+					references.set(access.target);
+					changed = true;
+				}
+			}
+		} while (changed);
+
+		for (unsigned int reg = 0; reg < registers; ++reg)
+			if (references.test(reg))
+				flags[reg] |= register_flag::reference;
+	}
+
+	static constexpr opcode::id fused_opcode(opcode::id first, opcode::id second)
+	{
+		using opcode::id;
+
+		switch (first)
+		{
+			case id::EQ: return second == id::JP ? id::EQ_JP : first;
+			case id::NE: return second == id::JP ? id::NE_JP : first;
+			case id::GR: return second == id::JP ? id::GR_JP : first;
+			case id::LS: return second == id::JP ? id::LS_JP : first;
+			case id::GE: return second == id::JP ? id::GE_JP : first;
+			case id::LE: return second == id::JP ? id::LE_JP : first;
+			case id::TEST: return second == id::JP ? id::TEST_JP : first;
+
+			case id::LOAD_K:
+				switch (second)
+				{
+					case id::ADD: return id::LOAD_K_ADD;
+					case id::SUB: return id::LOAD_K_SUB;
+					case id::GET: return id::LOAD_K_GET;
+					default: return first;
+				}
+
+			case id::LOAD_INT:
+				switch (second)
+				{
+					case id::ADD: return id::LOAD_INT_ADD;
+					case id::SUB: return id::LOAD_INT_SUB;
+					case id::GET: return id::LOAD_INT_GET;
+					default: return first;
+				}
+
+			case id::GET_PROP:
+				return second == id::CALL ? id::GET_PROP_CALL : first;
+
+			default:
+				return first;
+		}
+	}
+
+	void select_tail_calls(Chunk& chunk)
+	{
+		const Size count = chunk.instruction_count();
+		for (Offset i = 0; i + 1 < count; ++i)
+		{
+			if (chunk.dispatch_opcode(i) != opcode::id::CALL || chunk.dispatch_opcode(i + 1) != opcode::id::RETURN)
+				continue;
+
+			// Errors of the callee have to find the try region around the call in this frame,
+			// and the arguments of a variadic frame live below it where the callee would not release them.
+			if (chunk.handler(i) || chunk.is_variadic())
+				continue;
+
+			// The RETURN is left in place, so a jump that lands on it still returns normally.
+			const InstructionCode call = chunk.instruction(i);
+			const InstructionCode ret = chunk.instruction(i + 1);
+			if (inst::arg::a(ret) && !inst::arg::kb(ret) && inst::arg::b(ret) == inst::arg::a(call))
+				chunk.set_dispatch_opcode(i, opcode::id::TAILCALL);
+		}
+	}
+
+	void fuse_superinstructions(Chunk& chunk)
+	{
+		const Size count = chunk.instruction_count();
+		for (Offset i = 0; i + 1 < count; ++i)
+		{
+			opcode::id first = chunk.dispatch_opcode(i);
+			opcode::id fused = fused_opcode(first, chunk.dispatch_opcode(i + 1));
+			if (fused != first)
+			{
+				// The second instruction keeps its opcode and is never fused again,
+				// so a jump that lands on it still executes it alone.
+				chunk.set_dispatch_opcode(i, fused);
+				++i;
+			}
+		}
+	}
+
+	static constexpr opcode::operands operand_kind(InstructionCode inst)
+	{
+		const bool kb = inst::arg::kb(inst);
+		const bool kc = inst::arg::kc(inst);
+
+		if (!kb)
+			return kc ? opcode::operands::RK : opcode::operands::RR;
+		return kc ? opcode::operands::Any : opcode::operands::KR;
+	}
+
+	void split_superinstruction(Chunk& chunk, Offset offset)
+	{
+		if (offset == 0)
+			return;
+
+		const Offset first = offset - 1;
+		const opcode::id op = chunk.has_breakpoint(first) ? chunk.breakpoint_opcode(first) : chunk.dispatch_opcode(first);
+		if (!opcode::is_superinstruction(op))
+			return;
+
+		// The first half of every pair is encoded with its generic opcode.
+		const InstructionCode code = chunk.instruction(first);
+		chunk.set_dispatch_opcode(first, opcode::operand_variant(inst::arg::opcode(code), operand_kind(code)));
+	}
+
+	void specialize_operands(Chunk& chunk)
+	{
+		const Size count = chunk.instruction_count();
+		for (Offset i = 0; i < count; ++i)
+		{
+			opcode::id op = chunk.dispatch_opcode(i);
+			chunk.set_dispatch_opcode(i, opcode::operand_variant(op, operand_kind(chunk.instruction(i))));
+		}
+	}
+}
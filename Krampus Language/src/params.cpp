@@ -3,45 +3,51 @@
 
 namespace kpl
 {
+	Value* CallArguments::allocate()
+	{
+		if (_size == 0)
+			return nullptr;
+		if (_size <= inline_capacity)
+			return reinterpret_cast<Value*>(_inline);
+		return utils::malloc<Value>(_size * sizeof(Value));
+	}
+
 	CallArguments::CallArguments(const std::initializer_list<ConstWeakValueReference>& list) :
 		_size{ list.size() },
-		_args{ _size > 0 ? new Value[_size] : nullptr },
+		_args{ allocate() },
 		_allocated{ true }
 	{
-		if (_args)
-		{
-			auto it = list.begin();
-			const auto end = list.end();
-			for (Offset i = 0; i < _size; ++i, ++it)
-				_args[i] = *it;
-		}
+		auto it = list.begin();
+		for (Offset i = 0; i < _size; ++i, ++it)
+			utils::construct(_args[i], static_cast<const Value&>(*it));
 	}
 
 	CallArguments::CallArguments(const std::vector<ConstWeakValueReference>& vector) :
 		_size{ vector.size() },
-		_args{ _size > 0 ? new Value[_size] : nullptr },
+		_args{ allocate() },
 		_allocated{ true }
 	{
-		if (_args)
-		{
-			const ConstWeakValueReference* data = vector.data();
-			for (Offset i = 0; i < _size; ++i, ++data)
-				_args[i] = *data;
-		}
+		const ConstWeakValueReference* data = vector.data();
+		for (Offset i = 0; i < _size; ++i, ++data)
+			utils::construct(_args[i], static_cast<const Value&>(*data));
 	}
 
 	CallArguments::CallArguments(const Value& arg) :
-		_args{ new Value[1] },
 		_size{ 1 },
-		_allocated{ true }
-	{
-		_args[0] = arg;
-	}
+		_args{ const_cast<Value*>(&arg) },
+		_allocated{ false }
+	{}
 
 	CallArguments::~CallArguments()
 	{
-		if (_allocated && _args)
-			delete[] _args;
+		if (!_allocated || !_args)
+			return;
+
+		for (Offset i = 0; i < _size; ++i)
+			utils::destroy(_args[i]);
+
+		if (_args != reinterpret_cast<Value*>(_inline))
+			utils::free(_args);
 	}
 
 	const Value& CallArguments::operator[] (Offset index) const
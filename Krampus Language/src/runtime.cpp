@@ -1,31 +1,47 @@
 #include "runtime.h"
 #include "chunk.h"
 #include "kplstate.h"
+#include "object_utils.h"
+#include "jit.h"
 
 namespace kpl::runtime
 {
 	CallStack::CallStack(Size size) :
-		_base{ utils::malloc<CallInfo>(size) },
-		_top{ nullptr }
+		_memory{ size },
+		_base{ reinterpret_cast<CallInfo*>(_memory.data()) },
+		_top{ nullptr },
+		_end{ _base }
 	{}
 
 	CallStack::~CallStack()
 	{
-		if (_base)
-			utils::free(_base);
+		_base = _top = _end = nullptr;
+	}
+
+	void CallStack::grow(const CallInfo* info)
+	{
+		if (!_memory.commit((info - _base + 1) * sizeof(CallInfo)))
+			throw StackOverflow();
 
-		_base = _top = nullptr;
+		_end = _base + _memory.committed() / sizeof(CallInfo);
 	}
 
-	CallInfo* CallStack::push(RegisterStack& regs, Function& function, Offset instruction)
+	CallInfo* CallStack::push(RegisterStack& regs, Function& function, Offset instruction, Register* ret, ReturnAction action,
+		unsigned int args, unsigned int results)
 	{
 		CallInfo* info = _top + 1;
+		if (info >= _end) [[unlikely]]
+			grow(info);
 
 		info->prev = _top;
 		info->function = &function;
 		info->bottom = regs._bottom;
 		info->top = regs._top;
 		info->instruction = instruction;
+		info->ret = ret;
+		info->args = args;
+		info->results = static_cast<UInt8>(results);
+		info->action = action;
 
 		_top = info;
 
@@ -40,15 +56,21 @@ namespace kpl::runtime
 		return info;
 	}
 
-	void CallStack::push_native()
+	void CallStack::push_native(RegisterStack& regs, unsigned int args)
 	{
 		CallInfo* info = !_top ? _base : _top + 1;
+		if (info >= _end) [[unlikely]]
+			grow(info);
 
 		info->prev = _top;
 		info->function = nullptr;
-		info->bottom = nullptr;
-		info->top = nullptr;
+		info->bottom = regs._bottom;
+		info->top = regs._top;
 		info->instruction = 0;
+		info->ret = nullptr;
+		info->args = args;
+		info->results = 1;
+		info->action = ReturnAction::Store;
 
 		_top = info;
 	}
@@ -58,88 +80,176 @@ namespace kpl::runtime
 
 namespace kpl::runtime
 {
+	// A frame only ever releases the registers its chunk may store a reference in. Any other
+	// register keeps whatever scalar or caller value was there, which the frame overwrites before
+	// reading it, so opening a frame only has to reset the registers it reads before writing.
+	// Freshly committed pages are zero, which is Null.
 	RegisterStack::RegisterStack(Size size) :
-		_base{ utils::malloc<Register>(size) },
-		_bottom{ nullptr },
+		_memory{ size },
+		_base{ reinterpret_cast<Register*>(_memory.data()) },
+		_end{ _base },
+		_top{ nullptr },
 		_regs{ nullptr },
-		_top{ nullptr }
+		_bottom{ nullptr }
 	{}
 
 	RegisterStack::~RegisterStack()
 	{
-		if (_base)
-			utils::free(_base);
+		_base = _end = _bottom = _regs = _top = nullptr;
+	}
+
+	void RegisterStack::grow(const Register* top)
+	{
+		if (!_memory.commit((top - _base + 1) * sizeof(Register)))
+			throw StackOverflow();
+
+		_end = _base + _memory.committed() / sizeof(Register);
+	}
+
+	// Prepares the registers of chunk in the current window, whose first args registers hold
+	// arguments. Arguments chunk never reads are dropped and registers it may read before
+	// writing start as Null.
+	inline void RegisterStack::open(const Chunk& chunk, unsigned int args)
+	{
+		const UInt8* const flags = chunk.register_flags();
+		const unsigned int passed = std::min(args, static_cast<unsigned int>(chunk.register_count()));
+
+		for (unsigned int i = 0; i < passed; ++i)
+			if (!(flags[i] & register_flag::read_on_entry))
+				_regs[i] = nullptr;
 
-		_base = _bottom = _regs = _top = nullptr;
+		for (const UInt8* reg = chunk.entry_registers(), *end = reg + chunk.entry_register_count(); reg != end; ++reg)
+			if (*reg >= passed)
+				_regs[*reg] = nullptr;
 	}
 
 	void RegisterStack::set(const CallInfo& info)
 	{
-		if (info.function)
-		{
-			_bottom = info.bottom;
-			_regs = _bottom + 1;
-			_top = info.top;
-		}
-		else
+		_bottom = info.bottom;
+		_regs = _bottom ? _bottom + 1 : nullptr;
+		_top = info.top;
+	}
+
+	// Moves the window to the frame of chunk with its self slot at bottom. The args arguments
+	// are either in R(0) .. already or, for a variadic chunk, right below bottom, from where the
+	// ones that fit are copied up to their registers.
+	inline void RegisterStack::open_frame(const Chunk& chunk, const Value& self, Register* bottom, unsigned int args)
+	{
+		const unsigned int regs = static_cast<unsigned int>(chunk.register_count());
+
+		Register* const top = bottom + 1 + (regs > 0 ? regs - 1 : 0);
+		reserve(top);
+
+		_bottom = bottom;
+		_regs = _bottom + 1;
+		_top = top;
+
+		if (&self != _bottom)
+			*_bottom = self;
+
+		if (chunk.is_variadic())
 		{
-			CallInfo* prev = info.prev;
-			if (prev)
-			{
-				_bottom = prev->bottom;
-				_regs = _bottom + 1;
-				_top = prev->top;
-			}
-			else _bottom = _regs = _top = nullptr;
+			const Register* const first = _bottom - args;
+			args = std::min(args, regs);
+			for (unsigned int i = 0; i < args; ++i)
+				_regs[i] = first[i];
 		}
+
+		open(chunk, args);
 	}
 
 	void RegisterStack::set(const Function& func, const Value& self, int bottom_reg, unsigned int args)
 	{
-		unsigned int regs = func.chunk().register_count();
-		if (regs > 0)
-		{
-			if (!_top)
-			{
-				_bottom = _base;
-				_regs = _bottom + 1;
-				_top = _regs + (regs - 1);
-			}
-			else
-			{
-				_bottom = bottom_reg < 0 ? (_top + 1) : _bottom + bottom_reg;
-				_regs = _bottom + 1;
-				_top = _regs + (regs - 1);
-			}
+		const Chunk& chunk = func.chunk();
+		Register* bottom = !_top ? _base : (bottom_reg < 0 ? (_top + 1) : _regs + bottom_reg);
+		if (chunk.is_variadic())
+			bottom += 1 + args;
 
-			if(args < regs)
-				std::memset(_regs + args, 0, sizeof(*_regs) * (regs - args));
-		}
-		else if(_top)
+		open_frame(chunk, self, bottom, args);
+	}
+
+	void RegisterStack::set(const Function& func, const Value& self, std::span<const Value> args)
+	{
+		const Chunk& chunk = func.chunk();
+		const unsigned int count = static_cast<unsigned int>(args.size());
+		if (!chunk.is_variadic())
 		{
-			_bottom = bottom_reg < 0 ? (_top + 1) : _bottom + bottom_reg;
-			_regs = _bottom + 1;
-			_top = _regs;
+			set(func, self);
+			for (unsigned int i = 0; i < count; ++i)
+				write_arg(chunk, i, args[i]);
+			return;
 		}
 
-		*_bottom = self;
+		Register* const first = !_top ? _base : _top + 1;
+		reserve(first + count);
+		for (unsigned int i = 0; i < count; ++i)
+			first[i] = args[i];
+
+		open_frame(chunk, self, first + count, count);
 	}
 
-	void RegisterStack::push_args(const CallArguments& args, unsigned int max_args)
+	void RegisterStack::rebind(const Chunk& chunk, std::span<const Value> args)
+	{
+		const unsigned int count = static_cast<unsigned int>(args.size());
+		if (chunk.is_variadic())
+			std::copy(args.begin(), args.end(), _bottom - count);
+
+		const unsigned int passed = std::min(count, static_cast<unsigned int>(chunk.register_count()));
+		std::copy_n(args.begin(), passed, _regs);
+		open(chunk, passed);
+	}
+
+	void RegisterStack::replace(const Chunk& current, const Function& func, const Value& self, unsigned int first_arg, unsigned int args)
+	{
+		const Chunk& chunk = func.chunk();
+		const unsigned int regs = static_cast<unsigned int>(chunk.register_count());
+
+		Register* const top = _regs + (regs > 0 ? regs - 1 : 0);
+		reserve(top);
+
+		if (&self != _bottom)
+			*_bottom = self;
+
+		// Arguments past the registers of func would sit above its window with nobody to release them.
+		const unsigned int passed = std::min(args, regs);
+		for (unsigned int i = 0; i < passed; ++i)
+			_regs[i] = _regs[first_arg + i];
+
+		// What is left of the current frame above the arguments is released like on close.
+		for (const UInt8* reg = current.reference_registers(), *end = reg + current.reference_register_count(); reg != end; ++reg)
+			if (*reg >= passed)
+				_regs[*reg].invalidate();
+
+		_top = top;
+
+		open(chunk, passed);
+	}
+
+	void RegisterStack::push_args(const CallArguments& args, const Chunk& chunk)
 	{
 		if (args)
 		{
 			const Value* args_data = args.data();
 			const Size len = args.size();
-			for (Offset i = 0; i < max_args && i < len; ++i)
-				_regs[i] = args_data[i];
+			for (Offset i = 0; i < len; ++i)
+				write_arg(chunk, static_cast<unsigned int>(i), args_data[i]);
 		}
 	}
 
-	void RegisterStack::close()
+	void RegisterStack::close(const Chunk& chunk, unsigned int args, const Register* keep)
 	{
-		for (Register* r = _bottom; r <= _top; ++r)
-			r->invalidate();
+		if (_bottom >= keep)
+			_bottom->invalidate();
+
+		// A frame that only ever holds scalars has nothing else to release.
+		for (const UInt8* reg = chunk.reference_registers(), *end = reg + chunk.reference_register_count(); reg != end; ++reg)
+			if (_regs + *reg >= keep)
+				_regs[*reg].invalidate();
+
+		if (chunk.is_variadic())
+			for (Register* arg = _bottom - args; arg < _bottom; ++arg)
+				if (arg >= keep)
+					arg->invalidate();
 	}
 }
 
@@ -150,6 +260,11 @@ namespace kpl::runtime
 {
 	struct RuntimeState
 	{
+		MemoryHeap& heap;
+		GlobalsManager& globals;
+		CallStack& calls;
+		RegisterStack& regs;
+
 		InstructionCode inst;
 		Offset inst_offset;
 
@@ -158,12 +273,62 @@ namespace kpl::runtime
 
 		Value* ret_value;
 		bool end;
-	};
 
+		Int64& fuel;
+		Coroutine* coroutine;
+
+		inline RuntimeState(KPLState& state, CallStack& calls, RegisterStack& regs, Function& function, Value& ret_value, Coroutine* coroutine = nullptr) :
+			heap{ state._heap },
+			globals{ state._globals },
+			calls{ calls },
+			regs{ regs },
+			inst{ 0 },
+			inst_offset{ 0 },
+			function{ &function },
+			chunk{ &function.chunk() },
+			ret_value{ &ret_value },
+			end{ false },
+			fuel{ state._fuel },
+			coroutine{ coroutine }
+		{}
+
+		inline RuntimeState(KPLState& state, Function& function, Value& ret_value) :
+			RuntimeState{ state, state._calls, state._regs, function, ret_value }
+		{}
+
+		// Parks the running coroutine after the current instruction. value goes to the resumer
+		// and the value of the next resume to resume_reg.
+		inline void suspend(const Value& value, Register& resume_reg)
+		{
+			if (!coroutine)
+				throw BadValueOperation("Cannot yield outside of a coroutine");
+
+			coroutine->_function = function;
+			coroutine->_inst_offset = inst_offset;
+			coroutine->_resume_reg = &resume_reg;
+			coroutine->_status = Coroutine::Status::Suspended;
+
+			*ret_value = value;
+			end = true;
+		}
+
+		// Parks the running coroutine at the next instruction once fuel runs out.
+		inline void preempt()
+		{
+			if (!coroutine)
+				throw OutOfFuel();
+
+			coroutine->_function = function;
+			coroutine->_inst_offset = inst_offset;
+			coroutine->_resume_reg = nullptr;
+			coroutine->_status = Coroutine::Status::Preempted;
+
+			*ret_value = nullptr;
+			end = true;
+		}
+	};
 
 
-#define end_inst goto next_instruction
-#define to_end goto runtime_end
 
 #define A __KPL_INST_ARG_A(runtime.inst)
 #define B __KPL_INST_ARG_B(runtime.inst)
@@ -178,7 +343,7 @@ namespace kpl::runtime
 #define Ax __KPL_INST_ARG_AX(runtime.inst)
 #define sAx __KPL_INST_ARG_SAX(runtime.inst)
 
-#define REGS state._regs
+#define REGS runtime.regs
 #define R(_Index) REGS.reg(_Index)
 
 #define Kst(_Index) runtime.chunk->constant(_Index)
@@ -187,295 +352,1154 @@ namespace kpl::runtime
 #define RKB RK(B, KB)
 #define RKC RK(C, KC)
 
+#define fetch_inst do { \
+	runtime.inst = runtime.chunk->instruction(runtime.inst_offset++); \
+	__KPL_HOOK(state.hooks(), on_instruction(state, *runtime.chunk, runtime.inst_offset - 1, runtime.inst)); \
+} while(0)
+#define jump_fused do { fetch_inst; jump_to(Ax); } while(0)
+#define jump_to(_Target) do { \
+	const Offset target = (_Target); \
+	const Offset source = runtime.inst_offset - 1; \
+	const bool backward = target < runtime.inst_offset; \
+	runtime.inst_offset = target; \
+	if (backward) \
+	{ \
+		consume_fuel; \
+		count_loop(state, runtime, target, source); \
+	} \
+} while(0)
+#define consume_fuel do { if (--runtime.fuel < 0) [[unlikely]] { runtime.preempt(); to_end; } } while(0)
+#define inst_opcode static_cast<unsigned int>(runtime.chunk->dispatch_opcode(runtime.inst_offset - 1))
+
+
+	namespace special_props
+	{
+		static const std::string operator_add = obj::special_property::operator_add;
+		static const std::string operator_sub = obj::special_property::operator_sub;
+		static const std::string operator_mul = obj::special_property::operator_mul;
+		static const std::string operator_div = obj::special_property::operator_div;
+		static const std::string operator_idiv = obj::special_property::operator_idiv;
+		static const std::string operator_mod = obj::special_property::operator_mod;
+
+		static const std::string operator_eq = obj::special_property::operator_eq;
+		static const std::string operator_noeq = obj::special_property::operator_noeq;
+		static const std::string operator_gr = obj::special_property::operator_gr;
+		static const std::string operator_ls = obj::special_property::operator_ls;
+		static const std::string operator_ge = obj::special_property::operator_ge;
+		static const std::string operator_le = obj::special_property::operator_le;
+
+		static const std::string operator_shl = obj::special_property::operator_shl;
+		static const std::string operator_shr = obj::special_property::operator_shr;
+		static const std::string operator_band = obj::special_property::operator_band;
+		static const std::string operator_bor = obj::special_property::operator_bor;
+		static const std::string operator_bnot = obj::special_property::operator_bnot;
+
+		static const std::string operator_len = obj::special_property::operator_len;
+		static const std::string operator_not = obj::special_property::operator_not;
+		static const std::string operator_neg = obj::special_property::operator_neg;
+		static const std::string operator_xor = obj::special_property::operator_xor;
+
+		static const std::string operator_in = obj::special_property::operator_in;
+
+		static const std::string operator_get = obj::special_property::operator_get;
+		static const std::string operator_set = obj::special_property::operator_set;
+
+		static const std::string operator_call = obj::special_property::operator_call;
+	}
+
+
+	// Sets the results the caller of a frame expects at info.ret past the first stored ones to Null.
+	static inline void clear_results(const CallInfo& info, unsigned int stored)
+	{
+		for (unsigned int i = stored; i < info.results; ++i)
+			info.ret[i] = type::literal::Null;
+	}
 
-	static inline bool end_call(RuntimeState& runtime, CallStack& calls, RegisterStack& regs, const Register* ret_reg)
+	// Pops the current frame and hands its result to the caller. Returns true when the caller
+	// is native, meaning runtime::execute has to return.
+	static inline bool end_call(KPLState& state, RuntimeState& runtime, const Register* ret_reg)
 	{
-		CallInfo* info = calls.top();
+		CallInfo* info = runtime.calls.top();
+		if (info->action == ReturnAction::Keep) [[unlikely]]
+		{
+			// execute_batch rebinds the arguments of the frame for the next row.
+			*runtime.ret_value = ret_reg ? *ret_reg : type::literal::Null;
+			return runtime.end = true;
+		}
+
+		__KPL_HOOK(state.hooks(), on_call_exit(state, *runtime.function));
+
+		const Value result = ret_reg ? *ret_reg : type::literal::Null;
+
+		runtime.regs.close(*runtime.chunk, info->args);
+		runtime.regs.set(*info);
+		runtime.calls.pop();
+
 		runtime.function = info->function;
 		runtime.chunk = runtime.function ? &runtime.function->chunk() : nullptr;
 		runtime.inst_offset = info->instruction;
 		if (runtime.end = !runtime.function)
 		{
-			if (ret_reg)
-				*runtime.ret_value = *ret_reg;
-			else *runtime.ret_value = nullptr;
+			*runtime.ret_value = result;
+			return true;
+		}
+
+		switch (info->action)
+		{
+			case ReturnAction::Store:
+				if (info->ret)
+				{
+					*info->ret = result;
+					clear_results(*info, 1);
+				}
+				break;
+
+			case ReturnAction::SkipIfTrue:
+				if (result.to_bool())
+					++runtime.inst_offset;
+				break;
+
+			case ReturnAction::SkipIfFalse:
+				if (!result.to_bool())
+					++runtime.inst_offset;
+				break;
+
+			case ReturnAction::Keep:
+				// Unreachable: a kept frame returns above without being popped.
+				break;
 		}
 
-		regs.close();
-		regs.set(*info);
-		calls.pop();
+		return false;
+	}
+
+	// Pops the current frame returning first[0] .. first[count - 1] to a CALL that expects
+	// several results. The values go straight to the caller registers; the ones it does not
+	// expect are dropped and those it expects past count are Null. Anything else, including
+	// a single result, is returned like end_call does.
+	static inline bool end_call_multi(KPLState& state, RuntimeState& runtime, const Register* first, unsigned int count)
+	{
+		CallInfo* info = runtime.calls.top();
+		if (count < 2 || info->results < 2 || !info->ret || info->action != ReturnAction::Store)
+			return end_call(state, runtime, count > 0 ? first : nullptr);
+
+		__KPL_HOOK(state.hooks(), on_call_exit(state, *runtime.function));
 
-		return runtime.end;
+		// ret is the self slot of the frame or below it and first is above, so copying upwards
+		// only ever overwrites values that were already copied. Frame registers the results
+		// landed on are not released again.
+		const unsigned int stored = std::min(count, static_cast<unsigned int>(info->results));
+		for (unsigned int i = 0; i < stored; ++i)
+			info->ret[i] = first[i];
+
+		runtime.regs.close(*runtime.chunk, info->args, info->ret + stored);
+		runtime.regs.set(*info);
+		runtime.calls.pop();
+		clear_results(*info, stored);
+
+		runtime.function = info->function;
+		runtime.chunk = &runtime.function->chunk();
+		runtime.inst_offset = info->instruction;
+		return false;
 	}
 
-	Value execute(KPLState& state, Function& function, const Value& self, const CallArguments& args)
+	// Counts the backward jump at end to head and starts recording that loop once the chunk
+	// has taken enough of them. Chunks compiled as a whole are not traced.
+	static inline void count_loop(KPLState& state, RuntimeState& runtime, Offset head, Offset end)
 	{
-		Value ret_value;
-		RuntimeState runtime;
-		state._calls.push_native();
-		state._regs.set(function, self);
+		if (runtime.chunk->count_loop() != jit::loop_threshold) [[likely]]
+			return;
+
+#if KPL_ENABLE_HOOKS
+		if (state.hooks())
+			return;
+#endif
+		if (state.jit_enabled() && !runtime.chunk->native_code())
+			jit::record_loop(*runtime.chunk, head, end);
+	}
+
+	// Counts a call of chunk and compiles it to machine code once it gets hot.
+	static inline void count_call(KPLState& state, Chunk& chunk)
+	{
+		if (chunk.count_call() == jit::call_threshold && state.jit_enabled()) [[unlikely]]
+			jit::compile(chunk);
+	}
+
+	// Counts calls calls of chunk at once, compiling it if one of them is the call that makes it hot.
+	static inline void count_calls(KPLState& state, Chunk& chunk, Size calls)
+	{
+		const UInt32 counted = static_cast<UInt32>(std::min<Size>(calls, jit::call_threshold));
+		const UInt32 count = chunk.count_call(counted);
+		if (count >= jit::call_threshold && count - counted < jit::call_threshold && state.jit_enabled()) [[unlikely]]
+			jit::compile(chunk);
+	}
+
+	// Pushes a frame for a script function and continues in the same dispatch loop. bottom is
+	// the caller register that becomes the self slot, or -1 to open the frame above the caller's.
+	static inline void enter(KPLState& state, RuntimeState& runtime, Function& function, const Value& self,
+		int bottom, unsigned int args, Register* ret, ReturnAction action, unsigned int results = 1)
+	{
+		runtime.calls.push(REGS, *runtime.function, runtime.inst_offset, ret, action, args, results);
 
+		runtime.function = &function;
 		runtime.chunk = &function.chunk();
+		runtime.inst_offset = 0;
+
+		REGS.set(function, self, bottom, args);
+		count_call(state, *runtime.chunk);
+
+		__KPL_HOOK(state.hooks(), on_call_enter(state, function));
+	}
+
+	// Pushes a frame above the current one for a script function taking args.
+	static inline void enter(KPLState& state, RuntimeState& runtime, Function& function, const Value& self,
+		const CallArguments& args, Register* ret, ReturnAction action)
+	{
+		runtime.calls.push(REGS, *runtime.function, runtime.inst_offset, ret, action, static_cast<unsigned int>(args.size()));
+
 		runtime.function = &function;
+		runtime.chunk = &function.chunk();
 		runtime.inst_offset = 0;
-		runtime.ret_value = &ret_value;
-		runtime.end = false;
 
-		state._regs.push_args(args, runtime.chunk->register_count());
-		state._regs.set_self(self);
+		REGS.set(function, self, args);
+		count_call(state, *runtime.chunk);
 
-	next_instruction:
-		runtime.inst = runtime.chunk->instruction(runtime.inst_offset++);
+		__KPL_HOOK(state.hooks(), on_call_enter(state, function));
+	}
 
-	exec_instruction:
-		std::cout << static_cast<inst::Instruction>(runtime.inst) << std::endl;
+	// Enters method with self and args in a frame above the current one, so the operands of the
+	// executing instruction stay intact. Returns false if method is not a script function.
+	template<typename... _Args>
+	static inline bool enter_method(KPLState& state, RuntimeState& runtime, const Value& method, const Value& self,
+		Register* ret, ReturnAction action, const _Args&... args)
+	{
+		if (!method.isFunction())
+			return false;
 
-		switch (__KPL_INST_ARG_OPCODE(runtime.inst))
+		Function& function = method.function();
+		if (function.chunk().is_variadic())
 		{
-			case opcode::id::NOP:
-				end_inst;
+			std::array<Value, sizeof...(_Args)> values{ args... };
+			enter(state, runtime, function, self, CallArguments(values.data(), values.size()), ret, action);
+			return true;
+		}
 
-			case opcode::id::MOVE:
-				REGS.move(A, B);
-				end_inst;
+		enter(state, runtime, function, self, -1, 0, ret, action);
 
-			case opcode::id::LOAD_K:
-				R(A) = Kst(Bx);
-				end_inst;
+		const Chunk& chunk = function.chunk();
+		unsigned int index = 0;
+		(REGS.write_arg(chunk, index++, args), ...);
 
-			case opcode::id::LOAD_BOOL:
-				R(A) = B ? true : false;
-				if (C)
-					runtime.inst++;
-				end_inst;
+		return true;
+	}
 
-			case opcode::id::LOAD_NULL: {
-				unsigned int to = B;
-				for (unsigned int i = A; i <= to; ++i)
-					R(i) = nullptr;
-			} end_inst;
+	// Metamethods of Object operands run as script frames. Anything else, including native
+	// metamethods and Userdata, is left to the Value::runtime_* fallback.
+	template<typename... _Args>
+	static inline bool enter_metamethod(KPLState& state, RuntimeState& runtime, const Value& self, const std::string& name,
+		Register* ret, ReturnAction action, const _Args&... args)
+	{
+		return self.isObject() && enter_method(state, runtime, self.object().get_property(name), self, ret, action, args...);
+	}
 
-			case opcode::id::LOAD_INT:
-				R(A) = static_cast<type::Integer>(sBx);
-				end_inst;
+	static inline bool enter_eq(KPLState& state, RuntimeState& runtime, const Value& left, const Value& right)
+	{
+		return right.isObject() && enter_metamethod(state, runtime, left, special_props::operator_eq, nullptr, ReturnAction::SkipIfTrue, right);
+	}
 
-			case opcode::id::GET_GLOBAL:
-				R(A) = state._globals.get_value(RKB);
-				end_inst;
+	static inline bool enter_ne(KPLState& state, RuntimeState& runtime, const Value& left, const Value& right)
+	{
+		if (!left.isObject() || !right.isObject())
+			return false;
 
-			case opcode::id::GET_LOCAL:
-				R(A) = runtime.function->get_local(RKB);
-				end_inst;
+		const Value& noeq = left.object().get_property(special_props::operator_noeq);
+		if (!noeq.isNull())
+			return enter_method(state, runtime, noeq, left, nullptr, ReturnAction::SkipIfTrue, right);
 
-			case opcode::id::GET_PROP:
-				R(A) = RKB.get_property(RKC);
-				end_inst;
+		return enter_method(state, runtime, left.object().get_property(special_props::operator_eq), left, nullptr, ReturnAction::SkipIfFalse, right);
+	}
 
-			case opcode::id::SET_GLOBAL:
-				state._globals.set_value(RKB, RKC);
-				end_inst;
+#define __KPL_ENTER_COMPARE(_Name) \
+	static inline bool enter_##_Name(KPLState& state, RuntimeState& runtime, const Value& left, const Value& right) \
+	{ \
+		return enter_metamethod(state, runtime, left, special_props::operator_##_Name, nullptr, ReturnAction::SkipIfTrue, right); \
+	}
 
-			case opcode::id::SET_LOCAL:
-				runtime.function->set_local(RKB, RKC);
-				end_inst;
+	__KPL_ENTER_COMPARE(gr)
+	__KPL_ENTER_COMPARE(ls)
+	__KPL_ENTER_COMPARE(ge)
+	__KPL_ENTER_COMPARE(le)
 
-			case opcode::id::SET_PROP:
-				R(A).set_property(RKB, RKC);
-				end_inst;
+#undef __KPL_ENTER_COMPARE
 
-			case opcode::id::NEW_ARRAY:
-				R(A) = state._heap.make_array(static_cast<Size>(RKB.to_integer()));
-				end_inst;
+	template<opcode::operands _Kind>
+	static inline const Value& operand_b(RuntimeState& runtime)
+	{
+		if constexpr (_Kind == opcode::operands::Any)
+			return RKB;
+		else if constexpr (_Kind == opcode::operands::KR)
+			return Kst(B);
+		else return R(B);
+	}
 
-			case opcode::id::NEW_LIST:
-				R(A) = state._heap.make_list();
-				end_inst;
+	template<opcode::operands _Kind>
+	static inline const Value& operand_c(RuntimeState& runtime)
+	{
+		if constexpr (_Kind == opcode::operands::Any)
+			return RKC;
+		else if constexpr (_Kind == opcode::operands::RK)
+			return Kst(C);
+		else return R(C);
+	}
 
-			case opcode::id::NEW_OBJECT:
-				if (C)
-					R(A) = state._heap.make_object(RKB);
-				else R(A) = state._heap.make_object();
-				end_inst;
+	static constexpr unsigned int type_pair(DataType left, DataType right)
+	{
+		return (static_cast<unsigned int>(left) << 4) | static_cast<unsigned int>(right);
+	}
 
-			case opcode::id::SET_AL: {
-				const Value& iterable = R(A);
+	static inline unsigned int type_pair(const Value& left, const Value& right) { return type_pair(left.type(), right.type()); }
 
-				switch (iterable.type())
-				{
-					case DataType::Array: {
-						type::Array& array = iterable.array();
-						Offset offset = 0;
-						for (Register* r = &R(B), *end = &R(C); r <= end; ++r)
-							array[offset++] = *r;
-					} break;
-
-					case DataType::List:
-						type::List& list = iterable.list();
-						for (Register* r = &R(B), *end = &R(C); r <= end; ++r)
-							list.push_back(*r);
-						break;
-				}
-			} end_inst;
+	static constexpr unsigned int int_pair = type_pair(DataType::Integer, DataType::Integer);
+	static constexpr unsigned int float_pair = type_pair(DataType::Float, DataType::Float);
 
-			case opcode::id::SELF:
-				REGS.write(A, REGS.self());
-				end_inst;
+	// Rewrites the executing instruction to the variant specialized for the operand types, if any.
+	// Passing the generic opcode as float_op means there is no float variant.
+	static inline void quicken(RuntimeState& runtime, const Value& left, const Value& right, opcode::id int_op, opcode::id float_op)
+	{
+		const unsigned int types = type_pair(left, right);
+		if (types == int_pair)
+			runtime.chunk->set_dispatch_opcode(runtime.inst_offset - 1, int_op);
+		else if (types == float_pair)
+			runtime.chunk->set_dispatch_opcode(runtime.inst_offset - 1, float_op);
+	}
 
-			case opcode::id::ADD:
-				R(A) = RKB.runtime_add(RKC, state);
-				end_inst;
+	static inline void dequicken(RuntimeState& runtime, opcode::id generic_op)
+	{
+		runtime.chunk->set_dispatch_opcode(runtime.inst_offset - 1, generic_op);
+	}
 
-			case opcode::id::SUB:
-				R(A) = RKB.runtime_sub(RKC, state);
-				end_inst;
+	template<bool _OwnOnly>
+	static inline Value* probe_property_cache(const PropertyCache& cache, const type::Object& object)
+	{
+		for (unsigned int i = 0; i < cache.size; ++i)
+		{
+			const PropertyCache::Entry& entry = cache.entries[i];
+			if (!entry.layout)
+			{
+				if (entry.serial == object.serial())
+					return entry.slot;
+			}
+			else if constexpr (!_OwnOnly)
+			{
+				if (entry.layout == object.layout() && object.get_class().isObject() && object.get_class().object().serial() == entry.serial)
+					return entry.slot;
+			}
+		}
+		return nullptr;
+	}
 
-			case opcode::id::MUL:
-				R(A) = RKB.runtime_mul(RKC, state);
-				end_inst;
+	// Resolves name on object the way Object::get_property does, but only up to its direct class,
+	// and records where it was found. Returns nullptr if the result can not be cached.
+	template<bool _OwnOnly>
+	static Value* fill_property_cache(PropertyCache& cache, type::Object& object, const std::string& name)
+	{
+		PropertyCache::Entry entry;
 
-			case opcode::id::DIV:
-				R(A) = RKB.runtime_div(RKC, state);
-				end_inst;
+		auto it = object.find(name);
+		if (it != object.end())
+			entry = { nullptr, object.serial(), &it->second };
+		else
+		{
+			if (_OwnOnly || !object.layout() || !object.get_class().isObject())
+				return nullptr;
 
-			case opcode::id::IDIV:
-				R(A) = RKB.runtime_idiv(RKC, state);
-				end_inst;
+			type::Object& class_ = object.get_class().object();
+			auto class_it = class_.find(name);
+			if (class_it == class_.end())
+				return nullptr;
 
-			case opcode::id::MOD:
-				R(A) = RKB.runtime_mod(RKC, state);
-				end_inst;
+			entry = { object.layout(), class_.serial(), &class_it->second };
+		}
 
-			case opcode::id::EQ:
-				if (RKB.runtime_eq(RKC, state).to_bool())
-					++runtime.inst_offset;
-				end_inst;
+		if (cache.size == PropertyCache::capacity)
+		{
+			cache.megamorphic = true;
+			return nullptr;
+		}
 
-			case opcode::id::NE:
-				if (RKB.runtime_ne(RKC, state).to_bool())
-					++runtime.inst_offset;
-				end_inst;
+		cache.entries[cache.size++] = entry;
+		return entry.slot;
+	}
 
-			case opcode::id::GR:
-				if (RKB.runtime_gr(RKC, state).to_bool())
-					++runtime.inst_offset;
-				end_inst;
+	template<bool _OwnOnly>
+	static inline Value* cached_property(RuntimeState& runtime, const Value& receiver, const Value& name)
+	{
+		PropertyCache* cache = runtime.chunk->property_cache(runtime.inst_offset - 1);
+		if (!cache || cache->megamorphic || !receiver.isObject() || !name.isString())
+			return nullptr;
 
-			case opcode::id::LS:
-				if (RKB.runtime_ls(RKC, state).to_bool())
-					++runtime.inst_offset;
-				end_inst;
+		type::Object& object = receiver.object();
+		if (Value* slot = probe_property_cache<_OwnOnly>(*cache, object))
+			return slot;
 
-			case opcode::id::GE:
-				if (RKB.runtime_ge(RKC, state).to_bool())
-					++runtime.inst_offset;
-				end_inst;
+		return fill_property_cache<_OwnOnly>(*cache, object, name.string());
+	}
 
-			case opcode::id::LE:
-				if (RKB.runtime_le(RKC, state).to_bool())
-					++runtime.inst_offset;
-				end_inst;
-
-			case opcode::id::SHL:
-				R(A) = RKB.runtime_shl(RKC, state);
-				end_inst;
-
-			case opcode::id::SHR:
-				R(A) = RKB.runtime_shr(RKC, state);
-				end_inst;
-
-			case opcode::id::BAND:
-				R(A) = RKB.runtime_band(RKC, state);
-				end_inst;
-
-			case opcode::id::BOR:
-				R(A) = RKB.runtime_bor(RKC, state);
-				end_inst;
-
-			case opcode::id::XOR:
-				R(A) = RKB.runtime_xor(RKC, state);
-				end_inst;
-
-			case opcode::id::BNOT:
-				R(A) = RKB.runtime_bnot(state);
-				end_inst;
-
-			case opcode::id::NOT:
-				R(A) = RKB.runtime_not(state);
-				end_inst;
-
-			case opcode::id::NEG:
-				R(A) = RKB.runtime_neg(state);
-				end_inst;
-
-			case opcode::id::LEN:
-				R(A) = RKB.runtime_length(state);
-				end_inst;
-
-			case opcode::id::IN:
-				R(A) = RKB.runtime_in(RKC, state);
-				end_inst;
-
-			case opcode::id::INSTANCEOF:
-				R(A) = RKB.runtime_instanceof(RKC, state);
-				end_inst;
-
-			case opcode::id::GET:
-				R(A) = RKB.runtime_subscrived_get(RKC, state);
-				end_inst;
-
-			case opcode::id::SET:
-				R(A).runtime_subscrived_set(RKB, RKC, state);
-				end_inst;
-
-			case opcode::id::JP:
-				runtime.inst_offset = Ax;
-				runtime.inst = runtime.chunk->instruction(runtime.inst_offset);
-				goto exec_instruction;
-
-			case opcode::id::TEST:
-				if (RKB.to_bool() == static_cast<bool>(B))
-					runtime.inst_offset++;
-				end_inst;
-
-			case opcode::id::TEST_SET:
-				if (RKB.to_bool() == static_cast<bool>(B))
-					runtime.inst_offset++;
-				else R(A) = RKB;
-				end_inst;
-
-			case opcode::id::CALL: {
-				Value& callable = R(A);
-				if (callable.type() == DataType::Function)
-				{
-					state._calls.push(state._regs, *runtime.function, runtime.inst_offset);
-					
-					runtime.function = &callable.function();
-					runtime.chunk = &runtime.function->chunk();
-					runtime.inst_offset = 0;
+	static inline const Value& get_property(RuntimeState& runtime, const Value& receiver, const Value& name)
+	{
+		if (const Value* slot = cached_property<false>(runtime, receiver, name))
+			return *slot;
+		return receiver.get_property(name);
+	}
 
-					state._regs.set(*runtime.function, type::literal::Null, static_cast<int>(A), B);
-				}
-				else
+	static inline void set_property(RuntimeState& runtime, Value& receiver, const Value& name, const Value& value)
+	{
+		if (Value* slot = cached_property<true>(runtime, receiver, name))
+			*slot = value;
+		else receiver.set_property(name, value);
+	}
+
+	// Slot of the global named by constant in the state running the chunk, which links the
+	// chunk to that state first if another one ran it last.
+	static inline UInt32 global_slot(RuntimeState& runtime, Offset constant)
+	{
+		if (runtime.chunk->linked_globals() != runtime.globals.serial()) [[unlikely]]
+			runtime.chunk->link_globals(runtime.globals);
+		return runtime.chunk->global_slot(constant);
+	}
+
+	// Calls the method name of R(reg) with R(reg + 1) .. R(reg + args) and stores the result in R(reg).
+	static inline void invoke(KPLState& state, RuntimeState& runtime, unsigned int reg, const Value& name, unsigned int args)
+	{
+		Value& receiver = R(reg);
+		const Value& method = get_property(runtime, receiver, name);
+		if (method.isFunction())
+			enter(state, runtime, method.function(), receiver, static_cast<int>(reg), args, &receiver, ReturnAction::Store);
+		else receiver = method.runtime_call(state, receiver, { (&receiver + 1), args });
+	}
+
+	// Returns the script function that runs when callable is called and sets self to its receiver,
+	// or returns nullptr if the call has to go through Value::runtime_call.
+	static inline Function* script_callee(const Value& callable, const Value*& self)
+	{
+		if (callable.isFunction())
+		{
+			self = &type::literal::Null;
+			return &callable.function();
+		}
+
+		if (callable.isObject())
+		{
+			const Value& method = callable.object().get_property(special_props::operator_call);
+			if (method.isFunction())
+			{
+				self = &callable;
+				return &method.function();
+			}
+		}
+
+		return nullptr;
+	}
+
+	// Calls R(A) with R(A + 1) .. R(A + B) and stores the result in R(A). A C above 1 asks for
+	// C results in R(A) .. R(A + C - 1); a native callee only has one and the others are Null.
+	static inline void call(KPLState& state, RuntimeState& runtime)
+	{
+		Value& callable = R(A);
+		const unsigned int results = C > 1 ? C : 1;
+		const Value* self;
+		if (Function* function = script_callee(callable, self))
+			enter(state, runtime, *function, *self, static_cast<int>(A), B, &callable, ReturnAction::Store, results);
+		else
+		{
+			callable = callable.runtime_call(state, type::literal::Null, { (&callable + 1), B });
+			for (unsigned int i = 1; i < results; ++i)
+				(&callable)[i] = type::literal::Null;
+		}
+	}
+
+	// Copies count arguments of the running variadic frame, starting with argument first, to
+	// R(reg) ... Arguments past the ones passed read as Null.
+	static inline void vararg(RuntimeState& runtime, unsigned int reg, unsigned int first, unsigned int count)
+	{
+		const unsigned int args = runtime.calls.top()->args;
+		const Value* const arguments = REGS.arguments(args);
+		for (unsigned int i = 0; i < count; ++i, ++first)
+			R(reg + i) = first < args ? arguments[first] : type::literal::Null;
+	}
+
+	// Collects the arguments of the running variadic frame from argument first on into a new Array.
+	// Passing arguments never allocates otherwise, so only a script that asks for them pays for it.
+	static inline type::Array* varargs(RuntimeState& runtime, unsigned int first)
+	{
+		const unsigned int args = runtime.calls.top()->args;
+		if (first >= args)
+			return runtime.heap.make_array(0);
+		return runtime.heap.make_array(REGS.arguments(args) + first, args - first);
+	}
+
+	static inline Coroutine& coroutine_operand(const Value& value)
+	{
+		Coroutine* coroutine = value.isUserdata() ? dynamic_cast<Coroutine*>(&value.userdata()) : nullptr;
+		if (!coroutine)
+			throw BadValueOperation("Cannot resume a non coroutine value");
+		return *coroutine;
+	}
+
+	static inline bool is_number(const Value& value) { return value.isInteger() || value.isFloat(); }
+	static inline type::Float to_float(const Value& value) { return value.isInteger() ? static_cast<type::Float>(value.integral()) : value.floating(); }
+
+	// Prepares the numeric for loop in loop[0] index, loop[1] limit and loop[2] step and sets
+	// loop[3], the index the body sees. An all integer loop replaces its limit by the number of
+	// iterations left after the first one, so the counter can not overflow; any float operand
+	// makes all three floats. Returns false if the body does not run at all.
+	static bool for_prep(Register* loop)
+	{
+		Register& index = loop[0];
+		Register& limit = loop[1];
+		Register& step = loop[2];
+		if (!is_number(index) || !is_number(limit) || !is_number(step))
+			throw BadValueOperation("For loop index, limit and step must be numbers");
+
+		bool runs;
+		if (index.isInteger() && limit.isInteger() && step.isInteger())
+		{
+			const type::Integer first = index.integral();
+			const type::Integer last = limit.integral();
+			const type::Integer increment = step.integral();
+			if (increment == 0)
+				throw BadValueOperation("For loop step can not be zero");
+
+			runs = increment > 0 ? first <= last : first >= last;
+			if (runs)
+			{
+				const UInt64 distance = increment > 0
+					? static_cast<UInt64>(last) - static_cast<UInt64>(first)
+					: static_cast<UInt64>(first) - static_cast<UInt64>(last);
+				const UInt64 stride = increment > 0 ? static_cast<UInt64>(increment) : ~static_cast<UInt64>(increment) + 1;
+				limit = static_cast<type::Integer>(distance / stride);
+			}
+			else limit = static_cast<type::Integer>(0);
+		}
+		else
+		{
+			const type::Float first = to_float(index);
+			const type::Float last = to_float(limit);
+			const type::Float increment = to_float(step);
+			if (increment == 0)
+				throw BadValueOperation("For loop step can not be zero");
+
+			runs = increment > 0 ? first <= last : first >= last;
+			index = first;
+			limit = last;
+			step = increment;
+		}
+
+		loop[3] = index;
+		return runs;
+	}
+
+	static inline bool int_for_loop(Register* loop)
+	{
+		const UInt64 count = static_cast<UInt64>(loop[1].integral());
+		if (count == 0)
+			return false;
+
+		const type::Integer index = static_cast<type::Integer>(static_cast<UInt64>(loop[0].integral()) + static_cast<UInt64>(loop[2].integral()));
+		loop[0] = index;
+		loop[1] = static_cast<type::Integer>(count - 1);
+		loop[3] = index;
+		return true;
+	}
+
+	static inline bool float_for_loop(Register* loop)
+	{
+		const type::Float step = loop[2].floating();
+		const type::Float index = loop[0].floating() + step;
+		if (step > 0 ? index > loop[1].floating() : index < loop[1].floating())
+			return false;
+
+		loop[0] = index;
+		loop[3] = index;
+		return true;
+	}
+
+	// Generic FORLOOP: steps the loop prepared by for_prep and quickens the instruction to the
+	// variant for its counter type. Returns true if the body runs again.
+	static bool for_loop(RuntimeState& runtime, Register* loop)
+	{
+		if (loop[0].isInteger() && loop[1].isInteger() && loop[2].isInteger())
+		{
+			runtime.chunk->set_dispatch_opcode(runtime.inst_offset - 1, opcode::id::FORLOOP_INT);
+			return int_for_loop(loop);
+		}
+
+		if (loop[0].isFloat() && loop[1].isFloat() && loop[2].isFloat())
+		{
+			runtime.chunk->set_dispatch_opcode(runtime.inst_offset - 1, opcode::id::FORLOOP_FLOAT);
+			return float_for_loop(loop);
+		}
+
+		throw BadValueOperation("For loop registers were overwritten");
+	}
+
+	// Prepares the generic for loop over the container in loop[0]. loop[1] and loop[2] hold its
+	// state: the next index of an Array, String or List, the bucket and the position inside it
+	// of an Object, or the Userdata::iterate cursor. All of it is indices checked against the
+	// container, so a body that changes the container, or the registers, may see elements
+	// skipped or repeated but never freed ones.
+	static void iter_prep(Register* loop)
+	{
+		Register& container = loop[0];
+		switch (container.type())
+		{
+			case DataType::Array:
+			case DataType::String:
+			case DataType::List:
+			case DataType::Object:
+				loop[1] = static_cast<type::Integer>(0);
+				break;
+
+			case DataType::Userdata:
+				loop[1] = type::literal::Null;
+				break;
+
+			default:
+				throw BadValueOperation("Only arrays, lists, objects, strings and userdata can be iterated");
+		}
+		loop[2] = static_cast<type::Integer>(0);
+	}
+
+	// Steps the loop prepared by iter_prep, storing the next key in loop[3] and value in loop[4].
+	// Keys are indices, or the property names of an Object. Returns false and clears both
+	// registers once the container is exhausted. Each step is O(1), amortized over the empty
+	// buckets for an Object.
+	static bool iter_next(KPLState& state, Register* loop)
+	{
+		Register& container = loop[0];
+		Register& key = loop[3];
+		Register& value = loop[4];
+		if (!container.isUserdata() && (!loop[1].isInteger() || !loop[2].isInteger()))
+			throw BadValueOperation("Iterator registers were overwritten");
+
+		switch (container.type())
+		{
+			case DataType::Array: {
+				const type::Array& array = container.array();
+				const Size index = static_cast<Size>(loop[1].integral());
+				if (index >= array.length())
+					break;
+
+				key = static_cast<type::Integer>(index);
+				value = array[index];
+				loop[1] = static_cast<type::Integer>(index + 1);
+				return true;
+			}
+
+			case DataType::String: {
+				const type::String& string = container.string();
+				const Size index = static_cast<Size>(loop[1].integral());
+				if (index >= string.size())
+					break;
+
+				key = static_cast<type::Integer>(index);
+				value = state.make_string(string.data() + index, 1);
+				loop[1] = static_cast<type::Integer>(index + 1);
+				return true;
+			}
+
+			case DataType::List: {
+				const Size index = static_cast<Size>(loop[1].integral());
+				const Value* element = container.list().step(index);
+				if (!element)
+					break;
+
+				key = static_cast<type::Integer>(index);
+				value = *element;
+				loop[1] = static_cast<type::Integer>(index + 1);
+				return true;
+			}
+
+			case DataType::Object: {
+				type::Object& object = container.object();
+				Size bucket = static_cast<Size>(loop[1].integral());
+				Size position = static_cast<Size>(loop[2].integral());
+				for (; bucket < object.bucket_count(); ++bucket, position = 0)
 				{
-					callable.runtime_call(state, type::literal::Null, { (&callable + 1), B });
+					auto it = object.begin(bucket);
+					const auto end = object.end(bucket);
+					for (Size i = 0; i < position && it != end; ++i)
+						++it;
+
+					if (it != end)
+					{
+						key = state.make_string(it->first.data(), it->first.size());
+						value = it->second;
+						loop[1] = static_cast<type::Integer>(bucket);
+						loop[2] = static_cast<type::Integer>(position + 1);
+						return true;
+					}
 				}
-			} end_inst;
+				loop[1] = static_cast<type::Integer>(bucket);
+				loop[2] = static_cast<type::Integer>(0);
+				break;
+			}
+
+			case DataType::Userdata:
+				if (container.userdata().iterate(state, loop[1], key, value))
+					return true;
+				break;
+
+			default:
+				throw BadValueOperation("Iterator registers were overwritten");
+		}
+
+		key = type::literal::Null;
+		value = type::literal::Null;
+		return false;
+	}
+
+	// Like call, but a script callee takes over the current frame and its CallInfo, so the
+	// caller of this frame receives its result. Returns false if R(A) was called natively;
+	// the result is then in R(A) and the frame still has to return it.
+	static inline bool tail_call(KPLState& state, RuntimeState& runtime)
+	{
+		Value& callable = R(A);
+		const Value* self;
+		Function* function = script_callee(callable, self);
+		if (!function)
+		{
+			callable = callable.runtime_call(state, type::literal::Null, { (&callable + 1), B });
+			return false;
+		}
+
+		// replace moves the arguments down to R(0), while a variadic callee needs them below its
+		// frame. It is called normally instead and the RETURN after this instruction passes its result on.
+		if (function->chunk().is_variadic())
+		{
+			enter(state, runtime, *function, *self, static_cast<int>(A), B, &callable, ReturnAction::Store);
+			return true;
+		}
+
+		__KPL_HOOK(state.hooks(), on_call_exit(state, *runtime.function));
+
+		REGS.replace(*runtime.chunk, *function, *self, A + 1, B);
+
+		runtime.function = function;
+		runtime.chunk = &function->chunk();
+		runtime.inst_offset = 0;
+		count_call(state, *runtime.chunk);
+
+		__KPL_HOOK(state.hooks(), on_call_enter(state, *function));
+		return true;
+	}
+
+
+	// Runs the machine code of the current chunk from the NATIVE instruction just fetched and
+	// moves the dispatch loop to the instruction it stopped at. Returns the opcode that
+	// instruction has to be dispatched with. The chunk is interpreted instead while hooks are
+	// installed, and loses JIT generated code once the JIT is turned off.
+	static inline opcode::id run_native(KPLState& state, RuntimeState& runtime)
+	{
+		Chunk& chunk = *runtime.chunk;
+		const jit::NativeCode& native = *chunk.native_code();
+		Offset offset = runtime.inst_offset - 1;
+
+		if (!state.jit_enabled() && !native.ahead_of_time()) [[unlikely]]
+		{
+			jit::discard(chunk);
+			return chunk.dispatch_opcode(offset);
+		}
+
+#if KPL_ENABLE_HOOKS
+		if (state.hooks())
+			return native.opcode(offset);
+#endif
+
+		offset = native.run(&R(0), offset, runtime.fuel);
+		runtime.inst = chunk.instruction(offset);
+		runtime.inst_offset = offset + 1;
+
+		// The code stops at an instruction it has no template for, or at one whose operands
+		// its template does not handle.
+		const opcode::id op = chunk.dispatch_opcode(offset);
+		return op == opcode::id::NATIVE ? native.opcode(offset) : op;
+	}
+
+	// Hands the instruction just fetched to the recording of its loop. Returns the opcode to
+	// dispatch it with, which is opcode::id::TRACE if it completed the loop and got it traced.
+	static inline opcode::id record_step(KPLState& state, RuntimeState& runtime)
+	{
+		Chunk& chunk = *runtime.chunk;
+		const Offset offset = runtime.inst_offset - 1;
+
+		if (!state.jit_enabled()) [[unlikely]]
+		{
+			jit::discard(chunk);
+			return chunk.dispatch_opcode(offset);
+		}
+		return chunk.loop_traces()->record(chunk, offset, &R(0));
+	}
+
+	// Reports the breakpoint of the instruction just fetched to the handler of the state and
+	// returns the opcode to dispatch the instruction with, reading it after the handler ran
+	// since it may have cleared the breakpoint or set more.
+	static inline opcode::id break_point(KPLState& state, RuntimeState& runtime)
+	{
+		Chunk& chunk = *runtime.chunk;
+		const Offset offset = runtime.inst_offset - 1;
+
+		if (BreakpointHandler* handler = state.breakpoint_handler())
+			handler->on_breakpoint(state, chunk, offset, &R(0));
+
+		const opcode::id op = chunk.dispatch_opcode(offset);
+		return op == opcode::id::BREAK ? chunk.breakpoint_opcode(offset) : op;
+	}
+
+	// Runs the trace of the loop whose head was just fetched and moves the dispatch loop to
+	// the instruction it left at. Returns the opcode that instruction has to be dispatched
+	// with; leaving at the head itself means the head runs interpreted.
+	static inline opcode::id run_trace(KPLState& state, RuntimeState& runtime)
+	{
+		Chunk& chunk = *runtime.chunk;
+		const Offset head = runtime.inst_offset - 1;
+		const jit::Trace& trace = *chunk.loop_traces()->find(head);
+
+		if (!state.jit_enabled()) [[unlikely]]
+		{
+			jit::discard(chunk);
+			return chunk.dispatch_opcode(head);
+		}
+
+#if KPL_ENABLE_HOOKS
+		if (state.hooks())
+			return trace.opcode();
+#endif
+
+		const Offset offset = trace.run(&R(0), runtime.fuel);
+		if (offset == head)
+			return trace.opcode();
+
+		runtime.inst = chunk.instruction(offset);
+		runtime.inst_offset = offset + 1;
+		return chunk.dispatch_opcode(offset);
+	}
+
+
+
+#if KPL_DISPATCH == KPL_DISPATCH_TAILCALL
+	typedef void (*OpcodeHandler)(KPLState& state, RuntimeState& runtime);
+
+#define __KPL_DECLARE_HANDLER(_Name) static void op_##_Name(KPLState& state, RuntimeState& runtime);
+	__KPL_OPCODE_LIST(__KPL_DECLARE_HANDLER)
+#undef __KPL_DECLARE_HANDLER
+
+#define __KPL_HANDLER_ADDRESS(_Name) &op_##_Name,
+	static constexpr OpcodeHandler handlers[] = { __KPL_OPCODE_LIST(__KPL_HANDLER_ADDRESS) };
+#undef __KPL_HANDLER_ADDRESS
+
+	static_assert(sizeof(handlers) / sizeof(*handlers) == opcode::count);
+
+#define op_begin(_Name) static void op_##_Name(KPLState& state, RuntimeState& runtime) {
+#define op_end }
+#define end_inst do { fetch_inst; [[clang::musttail]] return handlers[inst_opcode](state, runtime); } while(0)
+#define dispatch_to(_Op) do { [[clang::musttail]] return handlers[static_cast<unsigned int>(_Op)](state, runtime); } while(0)
+#define to_end return
+
+#include "runtime_ops.inl"
+
+#undef op_begin
+#undef op_end
+#undef end_inst
+#undef dispatch_to
+#undef to_end
+#endif
+
+
+
+	// Runs the dispatch loop from runtime.inst_offset until the bottom frame returns or a coroutine yields.
+	static void run(KPLState& state, RuntimeState& runtime)
+	{
+#if KPL_DISPATCH == KPL_DISPATCH_TAILCALL
+		fetch_inst;
+		handlers[inst_opcode](state, runtime);
+#elif KPL_DISPATCH == KPL_DISPATCH_GOTO
+#define __KPL_LABEL_ADDRESS(_Name) &&op_##_Name,
+		static void* const dispatch_table[] = { __KPL_OPCODE_LIST(__KPL_LABEL_ADDRESS) };
+#undef __KPL_LABEL_ADDRESS
+
+		static_assert(sizeof(dispatch_table) / sizeof(*dispatch_table) == opcode::count);
+
+#define op_begin(_Name) op_##_Name: {
+#define op_end }
+#define end_inst do { fetch_inst; goto *dispatch_table[inst_opcode]; } while(0)
+#define dispatch_to(_Op) goto *dispatch_table[static_cast<unsigned int>(_Op)]
+#define to_end goto runtime_end
+
+		end_inst;
+
+#include "runtime_ops.inl"
+
+#undef op_begin
+#undef op_end
+#undef end_inst
+#undef dispatch_to
+#undef to_end
+#else
+#define op_begin(_Name) case opcode::id::_Name: {
+#define op_end }
+#define end_inst goto next_instruction
+#define dispatch_to(_Op) do { dispatch_op = (_Op); goto dispatch; } while(0)
+#define to_end goto runtime_end
 
-			case opcode::id::INVOKE: {
-				Value& object = R(A);
-				object.invoke(state, RKB, { (&object + 1), C });
-			} end_inst;
+		opcode::id dispatch_op;
 
-			case opcode::id::RETURN:
-				if (A)
-					REGS.write(0, RKB);
-				else REGS.reg(0) = nullptr;
-				if (end_call(runtime, state._calls, state._regs, &R(0)))
-					to_end;
-				end_inst;
+	next_instruction:
+		fetch_inst;
+		dispatch_op = static_cast<opcode::id>(inst_opcode);
+
+	dispatch:
+		switch (dispatch_op)
+		{
+#include "runtime_ops.inl"
 		}
 
+#undef op_begin
+#undef op_end
+#undef end_inst
+#undef dispatch_to
+#undef to_end
+#endif
+
+#if KPL_DISPATCH != KPL_DISPATCH_TAILCALL
 		runtime_end:
+		return;
+#endif
+	}
+
+
+
+	// Drops the current frame without returning from it. Returns the CallInfo of its caller.
+	static inline const CallInfo* pop_frame(RuntimeState& runtime)
+	{
+		const CallInfo* info = runtime.calls.top();
+		runtime.regs.close(*runtime.chunk, info->args);
+		runtime.regs.set(*info);
+		runtime.calls.pop();
+
+		runtime.function = info->function;
+		runtime.chunk = runtime.function ? &runtime.function->chunk() : nullptr;
+		return info;
+	}
+
+	// Drops the frames an exception left behind, down to and including the native entry frame,
+	// so the state can run scripts again after a failed or out of fuel execute.
+	static void unwind(RuntimeState& runtime, const CallInfo* native)
+	{
+		while (pop_frame(runtime) != native);
+	}
+
+	// Looks up a try region around the instruction that raised error, first in the current
+	// frame and then in each caller up to the native entry frame, dropping the frames it
+	// leaves. Returns true with the dispatch loop set up to continue at the handler.
+	static bool catch_error(RuntimeState& runtime, const CallInfo* native, const Value& error)
+	{
+		Offset instruction = runtime.inst_offset - 1;
+		for (;;)
+		{
+			if (const ExceptionHandler* handler = runtime.chunk->handler(instruction))
+			{
+				R(handler->reg) = error;
+				runtime.inst_offset = handler->target;
+				return true;
+			}
+
+			if (runtime.calls.top() == native)
+				return false;
+
+			instruction = pop_frame(runtime)->instruction - 1;
+		}
+	}
+
+	// Runs the dispatch loop, sending script errors to the try regions of the frames above native.
+	// Anything else, and errors no region handles, propagates with the remaining frames in place.
+	static void run_protected(KPLState& state, RuntimeState& runtime, const CallInfo* native)
+	{
+		for (;;)
+		{
+			try
+			{
+				run(state, runtime);
+				return;
+			}
+			catch (const ScriptError& error)
+			{
+				if (!catch_error(runtime, native, error.value()))
+					throw;
+			}
+			catch (const BadValueOperation& error)
+			{
+				if (!catch_error(runtime, native, state.make_string(error.what())))
+					throw;
+			}
+		}
+	}
+
+	Value execute(KPLState& state, Function& function, const Value& self, const CallArguments& args)
+	{
+		Value ret_value;
+		RuntimeState runtime{ state, function, ret_value };
+		runtime.calls.push_native(runtime.regs, static_cast<unsigned int>(args.size()));
+		const CallInfo* native = runtime.calls.top();
+		runtime.regs.set(function, self, args);
+		runtime.regs.set_self(self);
+		count_call(state, function.chunk());
+
+		__KPL_HOOK(state.hooks(), on_call_enter(state, function));
+
+		try
+		{
+			run_protected(state, runtime, native);
+		}
+		catch (...)
+		{
+			unwind(runtime, native);
+			throw;
+		}
 		return ret_value;
 	}
+
+	void execute_batch(KPLState& state, Function& function, const Value& self, std::span<const Value> args,
+		Size arg_count, std::span<Value> results)
+	{
+		if (args.size() != results.size() * arg_count)
+			throw BadValueOperation("execute_batch needs arg_count arguments for every result");
+		if (results.empty())
+			return;
+
+		RuntimeState runtime{ state, function, results[0] };
+		runtime.calls.push_native(runtime.regs, static_cast<unsigned int>(arg_count));
+		CallInfo* const native = runtime.calls.top();
+		native->action = ReturnAction::Keep;
+		runtime.regs.set(function, self, args.first(arg_count));
+		runtime.regs.set_self(self);
+		count_calls(state, function.chunk(), results.size());
+
+		__KPL_HOOK(state.hooks(), on_call_enter(state, function));
+
+		try
+		{
+			for (Offset row = 0; row < results.size(); ++row)
+			{
+				if (row > 0)
+				{
+					const std::span<const Value> row_args = args.subspan(row * arg_count, arg_count);
+					if (runtime.function != &function) [[unlikely]]
+					{
+						// A tail call of the previous row left another function in the frame.
+						__KPL_HOOK(state.hooks(), on_call_exit(state, *runtime.function));
+						runtime.regs.close(*runtime.chunk, native->args);
+						runtime.regs.set(*native);
+						runtime.function = &function;
+						runtime.chunk = &function.chunk();
+						runtime.regs.set(function, self, row_args);
+						runtime.regs.set_self(self);
+						__KPL_HOOK(state.hooks(), on_call_enter(state, function));
+					}
+					else
+						runtime.regs.rebind(function.chunk(), row_args);
+				}
+
+				runtime.inst_offset = 0;
+				runtime.ret_value = &results[row];
+				run_protected(state, runtime, native);
+			}
+		}
+		catch (...)
+		{
+			unwind(runtime, native);
+			throw;
+		}
+
+		__KPL_HOOK(state.hooks(), on_call_exit(state, *runtime.function));
+		unwind(runtime, native);
+	}
 }
+
+
+
+namespace kpl::runtime
+{
+	Coroutine::Coroutine(Function& function, const Value& self, Size call_stack_size, Size register_stack_size) :
+		Userdata{},
+		_calls{ call_stack_size },
+		_regs{ register_stack_size },
+		_function{ &function },
+		_self{ self },
+		_inst_offset{ 0 },
+		_resume_reg{ nullptr },
+		_status{ Status::Suspended },
+		_started{ false }
+	{}
+
+	// A coroutine that is dropped while parked still has frames and their registers.
+	Coroutine::~Coroutine()
+	{
+		if (_status == Status::Suspended || _status == Status::Preempted)
+			release(_function);
+	}
+
+	void Coroutine::release(Function* function)
+	{
+		while (const CallInfo* info = _calls.top())
+		{
+			if (function)
+				_regs.close(function->chunk(), info->args);
+			_regs.set(*info);
+			_calls.pop();
+			function = info->function;
+		}
+	}
+
+	Value Coroutine::resume(KPLState& state, const Value& value)
+	{
+		if (_status == Status::Running || _status == Status::Dead)
+			throw BadValueOperation(_status == Status::Dead ? "Cannot resume a dead coroutine" : "Cannot resume a running coroutine");
+
+		Value ret_value;
+		RuntimeState runtime{ state, _calls, _regs, *_function, ret_value, this };
+
+		if (!_started)
+		{
+			_calls.push_native(_regs, 1);
+			_regs.set(*_function, _self, CallArguments(value));
+			_started = true;
+			count_call(state, _function->chunk());
+
+			__KPL_HOOK(state.hooks(), on_call_enter(state, *_function));
+		}
+		else
+		{
+			runtime.inst_offset = _inst_offset;
+			if (_resume_reg)
+				*_resume_reg = value;
+		}
+
+		_status = Status::Running;
+		try
+		{
+			run_protected(state, runtime, _calls.base());
+		}
+		catch (...)
+		{
+			release(runtime.function);
+			_status = Status::Dead;
+			throw;
+		}
+
+		// Still running means the bottom frame returned instead of yielding.
+		if (_status == Status::Running)
+			_status = Status::Dead;
+
+		return ret_value;
+	}
+}
\ No newline at end of file
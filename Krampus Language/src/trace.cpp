@@ -0,0 +1,888 @@
+#include "jit_x64.h"
+
+namespace kpl::jit
+{
+	Trace::Trace(const std::vector<UInt8>& code, Offset head, opcode::id op) :
+		_code{ code.size() },
+		_head{ head },
+		_opcode{ op }
+	{
+		std::memcpy(_code.data(), code.data(), code.size());
+		_code.seal();
+	}
+}
+
+
+
+#if KPL_JIT
+namespace kpl::jit
+{
+	using namespace x64;
+
+	// Registers a trace keeps frame registers in. Everything else it uses is rax, rcx, xmm0
+	// and xmm1 as scratch, rbx for the frame and r12 for the fuel counter.
+	static constexpr Reg trace_gprs[] = { Reg::rdx, Reg::rsi, Reg::rdi, Reg::rbp, Reg::r8, Reg::r9, Reg::r10, Reg::r11, Reg::r13, Reg::r14, Reg::r15 };
+	static constexpr Xmm trace_xmms[] = { Xmm::xmm2, Xmm::xmm3, Xmm::xmm4, Xmm::xmm5 };
+
+	// Saved on entry, so the allocatable registers are free under either calling convention.
+	static constexpr Reg saved_gprs[] = { Reg::rbx, Reg::rbp, Reg::rsi, Reg::rdi, Reg::r12, Reg::r13, Reg::r14, Reg::r15 };
+
+	class TraceCompiler
+	{
+	private:
+		typedef Assembler::Label Label;
+
+		enum class Home { memory, gpr, xmm };
+
+		// A frame register the trace touches. Live-in registers are read before they are
+		// written in an iteration and are guarded to their entry type; the others are only
+		// guarded to hold no reference, since the trace overwrites them.
+		struct Slot
+		{
+			unsigned int reg = 0;
+			DataType entry = DataType::Null;
+			bool live_in = false;
+			bool written = false;
+			bool stable = true;		// every write stores the entry type
+			unsigned int uses = 0;
+
+			Home home = Home::memory;
+			Reg gpr = Reg::rax;
+			Xmm xmm = Xmm::xmm0;
+		};
+
+		const Chunk& _chunk;
+		const Offset _head;
+		const std::vector<TraceStep>& _steps;
+
+		std::map<unsigned int, Slot> _slots;
+		std::vector<std::array<DataType, 2>> _types;
+
+		Assembler _asm;
+		std::map<Offset, Label> _exits;
+		Label _bail;
+		Label _epilogue;
+
+		inline Operand operand(unsigned int index, bool constant) const
+		{
+			return constant ? Operand{ &_chunk.constant(index), 0 } : Operand{ nullptr, index };
+		}
+
+		inline Offset next(Size step) const { return step + 1 < _steps.size() ? _steps[step + 1].offset : _head; }
+
+		inline const Slot* slot(const Operand& op) const
+		{
+			if (op.constant)
+				return nullptr;
+			return &_slots.at(op.reg);
+		}
+
+		inline bool in_gpr(const Operand& op) const { const Slot* s = slot(op); return s && s->home == Home::gpr; }
+		inline bool in_xmm(const Operand& op) const { const Slot* s = slot(op); return s && s->home == Home::xmm; }
+
+		/* Analysis */
+
+		bool read(std::map<unsigned int, DataType>& current, unsigned int reg, DataType observed, DataType& type)
+		{
+			Slot& slot = _slots[reg];
+			slot.reg = reg;
+			++slot.uses;
+
+			auto it = current.find(reg);
+			if (it != current.end())
+				type = it->second;
+			else
+			{
+				if (!slot.live_in)
+				{
+					slot.live_in = true;
+					slot.entry = observed;
+				}
+				type = slot.entry;
+			}
+			return type == observed;
+		}
+
+		void write(std::map<unsigned int, DataType>& current, unsigned int reg, DataType type)
+		{
+			Slot& slot = _slots[reg];
+			slot.reg = reg;
+			++slot.uses;
+			slot.written = true;
+			if (slot.live_in && type != slot.entry)
+				slot.stable = false;
+			current[reg] = type;
+		}
+
+		// Works out the type of every operand from the entry types of the live-in registers.
+		// The recorded types only choose those entry types; they must agree with the rest.
+		bool analyze()
+		{
+			std::map<unsigned int, DataType> current;
+			_types.assign(_steps.size(), { DataType::Null, DataType::Null });
+
+			for (Size i = 0; i < _steps.size(); ++i)
+			{
+				const TraceStep& step = _steps[i];
+				const InstructionCode code = step.code;
+				const unsigned int a = inst::arg::a(code);
+				const unsigned int b = inst::arg::b(code);
+				const unsigned int c = inst::arg::c(code);
+
+				auto operand_type = [&](unsigned int index, bool constant, DataType observed, DataType& type) {
+					if (constant)
+					{
+						type = _chunk.constant(index).type();
+						return true;
+					}
+					return read(current, index, observed, type);
+				};
+
+				switch (inst::arg::opcode(code))
+				{
+					case opcode::id::NOP:
+					case opcode::id::JP:
+						break;
+
+					case opcode::id::MOVE: {
+						DataType type;
+						if (!read(current, b, step.types[0], type) || type_code(type) > last_scalar_type)
+							return false;
+						_types[i][0] = type;
+						write(current, a, type);
+					} break;
+
+					case opcode::id::LOAD_K: {
+						const Value& constant = _chunk.constant(inst::arg::bx(code));
+						if (!is_scalar(constant))
+							return false;
+						write(current, a, constant.type());
+					} break;
+
+					case opcode::id::LOAD_INT:
+						write(current, a, DataType::Integer);
+						break;
+
+					case opcode::id::LOAD_BOOL:
+						write(current, a, DataType::Boolean);
+						break;
+
+					case opcode::id::LOAD_NULL:
+						for (unsigned int reg = a; reg <= b; ++reg)
+							write(current, reg, DataType::Null);
+						break;
+
+					case opcode::id::ADD:
+					case opcode::id::SUB:
+					case opcode::id::MUL:
+					case opcode::id::DIV:
+					case opcode::id::EQ:
+					case opcode::id::NE:
+					case opcode::id::GR:
+					case opcode::id::LS:
+					case opcode::id::GE:
+					case opcode::id::LE: {
+						DataType left, right;
+						if (!operand_type(b, inst::arg::kb(code), step.types[0], left) || !operand_type(c, inst::arg::kc(code), step.types[1], right))
+							return false;
+						if (left != right || (left != DataType::Integer && left != DataType::Float))
+							return false;
+
+						_types[i] = { left, right };
+						const opcode::id op = inst::arg::opcode(code);
+						if (op == opcode::id::DIV)
+							write(current, a, DataType::Float);
+						else if (op == opcode::id::ADD || op == opcode::id::SUB || op == opcode::id::MUL)
+							write(current, a, left);
+					} break;
+
+					case opcode::id::TEST: {
+						DataType type;
+						if (!operand_type(b, inst::arg::kb(code), step.types[0], type))
+							return false;
+						if (type != DataType::Null && type != DataType::Integer && type != DataType::Boolean)
+							return false;
+						_types[i][0] = type;
+					} break;
+
+					case opcode::id::FORLOOP: {
+						for (unsigned int k = 0; k < 3; ++k)
+						{
+							DataType type;
+							if (!read(current, a + k, step.types[k], type) || type != DataType::Integer)
+								return false;
+						}
+						write(current, a, DataType::Integer);
+						write(current, a + 1, DataType::Integer);
+						write(current, a + 3, DataType::Integer);
+					} break;
+
+					default:
+						return false;
+				}
+			}
+
+			// Each iteration has to leave the live-in registers as the guards at the head expect them.
+			for (const auto& [reg, slot] : _slots)
+				if (slot.live_in && slot.written && current.at(reg) != slot.entry)
+					return false;
+			return true;
+		}
+
+		// Keeps the most used loop-carried Integers and Floats in machine registers.
+		void allocate()
+		{
+			std::vector<Slot*> candidates;
+			for (auto& [reg, slot] : _slots)
+				if (slot.live_in && slot.stable && (slot.entry == DataType::Integer || slot.entry == DataType::Float))
+					candidates.push_back(&slot);
+
+			std::stable_sort(candidates.begin(), candidates.end(), [](const Slot* left, const Slot* right) { return left->uses > right->uses; });
+
+			Size gprs = 0, xmms = 0;
+			for (Slot* slot : candidates)
+			{
+				if (slot->entry == DataType::Integer && gprs < std::size(trace_gprs))
+				{
+					slot->home = Home::gpr;
+					slot->gpr = trace_gprs[gprs++];
+				}
+				else if (slot->entry == DataType::Float && xmms < std::size(trace_xmms))
+				{
+					slot->home = Home::xmm;
+					slot->xmm = trace_xmms[xmms++];
+				}
+			}
+		}
+
+		/* Code generation */
+
+		// Leaves at the instruction at offset after writing the unboxed registers back.
+		inline Label exit(Offset offset)
+		{
+			auto it = _exits.find(offset);
+			if (it == _exits.end())
+				it = _exits.emplace(offset, _asm.label()).first;
+			return it->second;
+		}
+
+		inline void check_fuel(Offset offset)
+		{
+			_asm.cmp_fuel_zero();
+			_asm.jcc(Condition::less_equal, exit(offset));
+		}
+
+		void int_to(Reg dst, const Operand& op)
+		{
+			if (op.constant)
+				_asm.mov(dst, payload_bits(*op.constant));
+			else if (in_gpr(op))
+			{
+				if (slot(op)->gpr != dst)
+					_asm.mov(dst, slot(op)->gpr);
+			}
+			else _asm.load_payload(dst, op.reg);
+		}
+
+		void float_to(Xmm dst, const Operand& op)
+		{
+			if (op.constant)
+			{
+				_asm.mov(Reg::rax, payload_bits(*op.constant));
+				_asm.movq(dst, Reg::rax);
+			}
+			else if (in_xmm(op))
+			{
+				if (slot(op)->xmm != dst)
+					_asm.movsd(dst, slot(op)->xmm);
+			}
+			else _asm.load_float(dst, op.reg);
+		}
+
+		// dst op= right, right being an Integer.
+		void int_op(Alu op, Reg dst, const Operand& right)
+		{
+			if (right.constant)
+			{
+				_asm.mov(Reg::rcx, payload_bits(*right.constant));
+				_asm.alu(op, dst, Reg::rcx);
+			}
+			else if (in_gpr(right))
+				_asm.alu(op, dst, slot(right)->gpr);
+			else _asm.alu(op, dst, right.reg);
+		}
+
+		// Register an Integer result for R(reg) is best computed in, unless it would clobber
+		// the operand avoid before it is read.
+		inline Reg int_target(unsigned int reg, const Operand& avoid) const
+		{
+			const Slot& dst = _slots.at(reg);
+			if (dst.home == Home::gpr && (avoid.constant || avoid.reg != reg))
+				return dst.gpr;
+			return Reg::rax;
+		}
+
+		void store_int(unsigned int reg, Reg src)
+		{
+			const Slot& dst = _slots.at(reg);
+			if (dst.home == Home::gpr)
+			{
+				if (dst.gpr != src)
+					_asm.mov(dst.gpr, src);
+				return;
+			}
+			_asm.store_payload(reg, src);
+			_asm.store_type(reg, DataType::Integer);
+		}
+
+		void store_float(unsigned int reg, Xmm src)
+		{
+			const Slot& dst = _slots.at(reg);
+			if (dst.home == Home::xmm)
+			{
+				if (dst.xmm != src)
+					_asm.movsd(dst.xmm, src);
+				return;
+			}
+			_asm.store_float(reg, src);
+			_asm.store_type(reg, DataType::Float);
+		}
+
+		void store_constant(unsigned int reg, DataType type, UInt64 bits)
+		{
+			const Slot& dst = _slots.at(reg);
+			if (dst.home == Home::gpr)
+				_asm.mov(dst.gpr, bits);
+			else if (dst.home == Home::xmm)
+			{
+				_asm.mov(Reg::rax, bits);
+				_asm.movq(dst.xmm, Reg::rax);
+			}
+			else
+			{
+				_asm.store_payload(reg, bits);
+				_asm.store_type(reg, type);
+			}
+		}
+
+		void arithmetic(Size i, opcode::id op, unsigned int dst, const Operand& left, const Operand& right)
+		{
+			if (_types[i][0] == DataType::Integer)
+			{
+				if (op == opcode::id::DIV)
+				{
+					int_to(Reg::rax, left);
+					_asm.cvtsi2sd(Xmm::xmm0, Reg::rax);
+					int_to(Reg::rax, right);
+					_asm.cvtsi2sd(Xmm::xmm1, Reg::rax);
+					_asm.sse(Sse::div, Xmm::xmm0, Xmm::xmm1);
+					store_float(dst, Xmm::xmm0);
+					return;
+				}
+
+				const Alu alu = op == opcode::id::ADD ? Alu::add : op == opcode::id::SUB ? Alu::sub : Alu::imul;
+				const Reg result = int_target(dst, right);
+				int_to(result, left);
+				int_op(alu, result, right);
+				store_int(dst, result);
+				return;
+			}
+
+			const Sse sse = op == opcode::id::ADD ? Sse::add : op == opcode::id::SUB ? Sse::sub : op == opcode::id::MUL ? Sse::mul : Sse::div;
+			float_to(Xmm::xmm0, left);
+			if (in_xmm(right))
+				_asm.sse(sse, Xmm::xmm0, slot(right)->xmm);
+			else
+			{
+				float_to(Xmm::xmm1, right);
+				_asm.sse(sse, Xmm::xmm0, Xmm::xmm1);
+			}
+			store_float(dst, Xmm::xmm0);
+		}
+
+		// Exits unless the comparison skips the next instruction exactly when the recording did.
+		void compare(Size i, opcode::id op, const Operand& left, const Operand& right)
+		{
+			const Offset offset = _steps[i].offset;
+			const bool taken = next(i) == offset + 2;
+
+			if (_types[i][0] == DataType::Integer)
+			{
+				Condition condition;
+				switch (op)
+				{
+					case opcode::id::EQ: condition = Condition::equal; break;
+					case opcode::id::NE: condition = Condition::not_equal; break;
+					case opcode::id::GR: condition = Condition::greater; break;
+					case opcode::id::LS: condition = Condition::less; break;
+					case opcode::id::GE: condition = Condition::greater_equal; break;
+					default: condition = Condition::less_equal; break;
+				}
+
+				Reg reg = Reg::rax;
+				if (in_gpr(left))
+					reg = slot(left)->gpr;
+				else int_to(Reg::rax, left);
+				int_op(Alu::cmp, reg, right);
+				_asm.jcc(taken ? negate(condition) : condition, exit(offset));
+				return;
+			}
+
+			const Xmm x = in_xmm(left) ? slot(left)->xmm : Xmm::xmm0;
+			const Xmm y = in_xmm(right) ? slot(right)->xmm : Xmm::xmm1;
+			float_to(x, left);
+			float_to(y, right);
+			if (op == opcode::id::LS || op == opcode::id::LE)
+				_asm.ucomisd(y, x);
+			else _asm.ucomisd(x, y);
+			float_guard(_asm, op, taken, exit(offset));
+		}
+
+		void test(Size i, const Operand& value, bool expected)
+		{
+			const Offset offset = _steps[i].offset;
+			const bool truth = (next(i) == offset + 2) == expected;
+
+			const DataType type = _types[i][0];
+			if (value.constant || type == DataType::Null)
+			{
+				if ((value.constant && value.constant->to_bool()) != truth)
+					_asm.jmp(exit(offset));
+				return;
+			}
+
+			if (in_gpr(value))
+				_asm.test(slot(value)->gpr);
+			else if (type == DataType::Integer)
+				_asm.cmp_payload_zero(value.reg);
+			else _asm.cmp_payload_byte_zero(value.reg);
+			_asm.jcc(truth ? Condition::equal : Condition::not_equal, exit(offset));
+		}
+
+		// Integer FORLOOP as run by int_for_loop.
+		void for_loop(Size i, unsigned int base, Offset body)
+		{
+			const Offset offset = _steps[i].offset;
+			const Operand index{ nullptr, base }, count{ nullptr, base + 1 }, step{ nullptr, base + 2 };
+
+			if (in_gpr(count))
+				_asm.test(slot(count)->gpr);
+			else _asm.cmp_payload_zero(count.reg);
+
+			if (next(i) != body)
+			{
+				_asm.jcc(Condition::not_equal, exit(offset));
+				return;
+			}
+
+			_asm.jcc(Condition::equal, exit(offset));
+			const bool backward = body <= offset;
+			if (backward)
+				check_fuel(offset);
+
+			const Reg counter = in_gpr(count) ? slot(count)->gpr : Reg::rax;
+			int_to(counter, count);
+			_asm.dec(counter);
+			store_int(count.reg, counter);
+
+			const Reg result = int_target(index.reg, step);
+			int_to(result, index);
+			int_op(Alu::add, result, step);
+			store_int(index.reg, result);
+			store_int(base + 3, result);
+
+			if (backward)
+				_asm.dec_fuel();
+		}
+
+		void emit(Size i)
+		{
+			const TraceStep& step = _steps[i];
+			const InstructionCode code = step.code;
+			const opcode::id op = inst::arg::opcode(code);
+			const unsigned int a = inst::arg::a(code);
+			const unsigned int b = inst::arg::b(code);
+			const unsigned int c = inst::arg::c(code);
+			const Operand rkb = operand(b, inst::arg::kb(code));
+			const Operand rkc = operand(c, inst::arg::kc(code));
+
+			switch (op)
+			{
+				case opcode::id::MOVE: {
+					const DataType type = _types[i][0];
+					if (type == DataType::Integer)
+					{
+						const Reg reg = int_target(a, rkb);
+						int_to(reg, rkb);
+						store_int(a, reg);
+					}
+					else if (type == DataType::Float)
+					{
+						const Slot& dst = _slots.at(a);
+						const Xmm reg = dst.home == Home::xmm ? dst.xmm : Xmm::xmm0;
+						float_to(reg, rkb);
+						store_float(a, reg);
+					}
+					else
+					{
+						_asm.load_payload(Reg::rax, b);
+						_asm.store_payload(a, Reg::rax);
+						_asm.store_type(a, type);
+					}
+				} break;
+
+				case opcode::id::LOAD_K: {
+					const Value& constant = _chunk.constant(inst::arg::bx(code));
+					store_constant(a, constant.type(), payload_bits(constant));
+				} break;
+
+				case opcode::id::LOAD_INT:
+					store_constant(a, DataType::Integer, static_cast<UInt64>(static_cast<Int64>(inst::arg::sbx(code))));
+					break;
+
+				case opcode::id::LOAD_BOOL:
+					store_constant(a, DataType::Boolean, b ? 1 : 0);
+					break;
+
+				case opcode::id::LOAD_NULL:
+					for (unsigned int reg = a; reg <= b; ++reg)
+						store_constant(reg, DataType::Null, 0);
+					break;
+
+				case opcode::id::ADD:
+				case opcode::id::SUB:
+				case opcode::id::MUL:
+				case opcode::id::DIV:
+					arithmetic(i, op, a, rkb, rkc);
+					break;
+
+				case opcode::id::EQ:
+				case opcode::id::NE:
+				case opcode::id::GR:
+				case opcode::id::LS:
+				case opcode::id::GE:
+				case opcode::id::LE:
+					compare(i, op, rkb, rkc);
+					break;
+
+				case opcode::id::JP:
+					if (inst::arg::ax(code) <= step.offset)
+					{
+						check_fuel(step.offset);
+						_asm.dec_fuel();
+					}
+					break;
+
+				case opcode::id::TEST:
+					test(i, rkb, c != 0);
+					break;
+
+				case opcode::id::FORLOOP:
+					for_loop(i, a, inst::arg::bx(code));
+					break;
+
+				default:
+					break;
+			}
+		}
+
+	public:
+		inline TraceCompiler(const Chunk& chunk, Offset head, const std::vector<TraceStep>& steps) :
+			_chunk{ chunk },
+			_head{ head },
+			_steps{ steps },
+			_slots{},
+			_types{},
+			_asm{},
+			_exits{},
+			_bail{ 0 },
+			_epilogue{ 0 }
+		{}
+
+		// Returns false if the recorded path cannot be traced.
+		bool compile()
+		{
+			if (_steps.empty() || !analyze())
+				return false;
+			allocate();
+
+			_bail = _asm.label();
+			_epilogue = _asm.label();
+			const Label loop = _asm.label();
+
+			for (Reg reg : saved_gprs)
+				_asm.push(reg);
+			_asm.mov(Reg::rbx, args[0]);
+			_asm.mov(Reg::r12, args[1]);
+
+			for (const auto& [reg, slot] : _slots)
+			{
+				if (slot.live_in)
+				{
+					_asm.cmp_type(reg, type_code(slot.entry));
+					_asm.jcc(Condition::not_equal, _bail);
+				}
+				else if (slot.written)
+				{
+					_asm.cmp_type(reg, last_scalar_type);
+					_asm.jcc(Condition::above, _bail);
+				}
+			}
+
+			for (const auto& [reg, slot] : _slots)
+			{
+				if (slot.home == Home::gpr)
+					_asm.load_payload(slot.gpr, reg);
+				else if (slot.home == Home::xmm)
+					_asm.load_float(slot.xmm, reg);
+			}
+
+			_asm.bind(loop);
+			for (Size i = 0; i < _steps.size(); ++i)
+				emit(i);
+			_asm.jmp(loop);
+
+			// Allocated registers keep their entry type in the frame, so only payloads go back.
+			for (const auto& [offset, label] : _exits)
+			{
+				_asm.bind(label);
+				for (const auto& [reg, slot] : _slots)
+				{
+					if (!slot.written)
+						continue;
+					if (slot.home == Home::gpr)
+						_asm.store_payload(reg, slot.gpr);
+					else if (slot.home == Home::xmm)
+						_asm.store_float(reg, slot.xmm);
+				}
+				_asm.mov_eax(static_cast<UInt32>(offset));
+				_asm.jmp(_epilogue);
+			}
+
+			_asm.bind(_bail);
+			_asm.mov_eax(static_cast<UInt32>(_head));
+
+			_asm.bind(_epilogue);
+			for (Size i = std::size(saved_gprs); i-- > 0;)
+				_asm.pop(saved_gprs[i]);
+			_asm.ret();
+
+			_asm.link();
+			return true;
+		}
+
+		inline const std::vector<UInt8>& code() const { return _asm.code(); }
+	};
+}
+#endif
+
+
+
+namespace kpl::jit
+{
+	// Whether the recorder follows an instruction with this opcode at all.
+	static bool traceable(opcode::id op)
+	{
+		switch (op)
+		{
+			case opcode::id::NOP:
+			case opcode::id::MOVE:
+			case opcode::id::LOAD_K:
+			case opcode::id::LOAD_BOOL:
+			case opcode::id::LOAD_NULL:
+			case opcode::id::LOAD_INT:
+			case opcode::id::ADD:
+			case opcode::id::SUB:
+			case opcode::id::MUL:
+			case opcode::id::DIV:
+			case opcode::id::EQ:
+			case opcode::id::NE:
+			case opcode::id::GR:
+			case opcode::id::LS:
+			case opcode::id::GE:
+			case opcode::id::LE:
+			case opcode::id::JP:
+			case opcode::id::TEST:
+			case opcode::id::FORLOOP:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	// Whether the interpreter can get to offset right after running step.
+	static bool follows(const TraceStep& step, Offset offset)
+	{
+		const Offset next = step.offset + 1;
+		switch (inst::arg::opcode(step.code))
+		{
+			case opcode::id::JP: return offset == inst::arg::ax(step.code);
+			case opcode::id::FORLOOP: return offset == next || offset == inst::arg::bx(step.code);
+			case opcode::id::LOAD_BOOL: return offset == (inst::arg::c(step.code) ? next + 1 : next);
+
+			case opcode::id::EQ:
+			case opcode::id::NE:
+			case opcode::id::GR:
+			case opcode::id::LS:
+			case opcode::id::GE:
+			case opcode::id::LE:
+			case opcode::id::TEST:
+				return offset == next || offset == next + 1;
+
+			default: return offset == next;
+		}
+	}
+
+	LoopTraces::LoopTraces() :
+		_traces{},
+		_recorded{},
+		_steps{},
+		_saved{},
+		_head{ 0 },
+		_end{ 0 },
+		_recording{ false }
+	{}
+
+	LoopTraces::~LoopTraces() = default;
+
+	const Trace* LoopTraces::find(Offset head) const
+	{
+		for (const auto& trace : _traces)
+			if (trace->head() == head)
+				return trace.get();
+		return nullptr;
+	}
+
+	bool LoopTraces::recorded(Offset head) const
+	{
+		return std::find(_recorded.begin(), _recorded.end(), head) != _recorded.end();
+	}
+
+	void LoopTraces::start(Chunk& chunk, Offset head, Offset end)
+	{
+		_recorded.push_back(head);
+		_head = head;
+		_end = end;
+		_steps.clear();
+		_saved.clear();
+		for (Offset i = head; i <= end; ++i)
+		{
+			_saved.push_back(chunk.dispatch_opcode(i));
+			chunk.set_dispatch_opcode(i, opcode::id::RECORD);
+		}
+		_recording = true;
+	}
+
+	void LoopTraces::stop(Chunk& chunk)
+	{
+		for (Offset i = _head; i <= _end; ++i)
+			if (chunk.dispatch_opcode(i) == opcode::id::RECORD)
+				chunk.set_dispatch_opcode(i, _saved[i - _head]);
+
+		_steps.clear();
+		_saved.clear();
+		_recording = false;
+	}
+
+	opcode::id LoopTraces::record(Chunk& chunk, Offset offset, const Value* regs)
+	{
+		if (!_steps.empty())
+		{
+			// The handler of the previous step may have quickened it over its marker.
+			const Offset previous = _steps.back().offset;
+			if (chunk.dispatch_opcode(previous) != opcode::id::RECORD)
+				chunk.set_dispatch_opcode(previous, opcode::id::RECORD);
+
+			if (!follows(_steps.back(), offset))
+			{
+				stop(chunk);
+				return chunk.dispatch_opcode(offset);
+			}
+
+			if (offset == _head)
+			{
+#if KPL_JIT
+				TraceCompiler compiler{ chunk, _head, _steps };
+				const bool compiled = compiler.compile();
+				if (compiled)
+					_traces.push_back(std::make_unique<Trace>(compiler.code(), _head, _saved.front()));
+#else
+				const bool compiled = false;
+#endif
+				stop(chunk);
+				if (compiled)
+					chunk.set_dispatch_opcode(offset, opcode::id::TRACE);
+				return chunk.dispatch_opcode(offset);
+			}
+		}
+
+		const InstructionCode code = chunk.instruction(offset);
+		const opcode::id op = inst::arg::opcode(code);
+		if (_steps.size() == max_trace_length || !traceable(op))
+		{
+			stop(chunk);
+			return chunk.dispatch_opcode(offset);
+		}
+
+		TraceStep step{ offset, code, { DataType::Null, DataType::Null, DataType::Null } };
+		if (op == opcode::id::FORLOOP)
+		{
+			for (unsigned int k = 0; k < 3; ++k)
+				step.types[k] = regs[inst::arg::a(code) + k].type();
+		}
+		else
+		{
+			if (!inst::arg::kb(code))
+				step.types[0] = regs[inst::arg::b(code)].type();
+			if (!inst::arg::kc(code))
+				step.types[1] = regs[inst::arg::c(code)].type();
+		}
+		_steps.push_back(step);
+
+		// The generic handler runs each instruction on its own, so no superinstruction
+		// hides the one after it from the recording.
+		return op;
+	}
+
+	void LoopTraces::restore(Chunk& chunk)
+	{
+		if (_recording)
+			stop(chunk);
+
+		for (const auto& trace : _traces)
+			if (chunk.dispatch_opcode(trace->head()) == opcode::id::TRACE)
+				chunk.set_dispatch_opcode(trace->head(), trace->opcode());
+	}
+
+	void record_loop(Chunk& chunk, Offset head, Offset end)
+	{
+#if KPL_JIT
+		if (!chunk._verified || chunk._breakpoints)
+			return;
+
+		if (!chunk._traces)
+			chunk._traces = new LoopTraces();
+
+		LoopTraces& traces = *chunk._traces;
+		if (traces.recorded_count() >= max_loops)
+			return;
+
+		if (traces.recording())
+			chunk._loops = 0;
+		else if (traces.recorded(head))
+			chunk._loops = loop_threshold - loop_retry;
+		else
+		{
+			traces.start(chunk, head, end);
+
+			// Counting starts over to find the next hot loop.
+			chunk._loops = 0;
+		}
+#else
+		(void)chunk;
+		(void)head;
+		(void)end;
+#endif
+	}
+}
@@ -0,0 +1,194 @@
+#include "verifier.h"
+
+namespace kpl::verifier
+{
+	static bool verify_handler(const Chunk& chunk, const ExceptionHandler& handler)
+	{
+		const Size count = chunk.instruction_count();
+		return handler.start <= handler.end && handler.end <= count && handler.target < count && handler.reg < chunk.register_count();
+	}
+
+	static bool verify_switch(const Chunk& chunk, const SwitchTable& table)
+	{
+		const Size count = chunk.instruction_count();
+		if (table.default_target >= count)
+			return false;
+
+		for (Offset i = 0; i < table.dense_count; ++i)
+			if (table.dense[i] >= count)
+				return false;
+
+		if (table.entries)
+			for (Offset slot = 0; slot <= table.mask; ++slot)
+				if (!table.entries[slot].key.isNull() && table.entries[slot].target >= count)
+					return false;
+
+		return true;
+	}
+
+	bool verify_instruction(const Chunk& chunk, Offset offset)
+	{
+		using opcode::id;
+
+		const Size count = chunk.instruction_count();
+		const Size registers = chunk.register_count();
+		const InstructionCode code = chunk.instruction(offset);
+		const unsigned int a = inst::arg::a(code);
+		const unsigned int b = inst::arg::b(code);
+		const unsigned int c = inst::arg::c(code);
+
+		// R(first) .. R(last), which is empty if last is below first.
+		auto regs = [&](Size first, Size last) { return last < first || last < registers; };
+		auto reg = [&](Size index) { return index < registers; };
+		auto rk = [&](unsigned int operand, bool constant) { return constant ? operand < chunk.constants_count() : reg(operand); };
+		auto rkb = [&]() { return rk(b, inst::arg::kb(code)); };
+		auto rkc = [&]() { return rk(c, inst::arg::kc(code)); };
+		auto target = [&](Size index) { return index < count; };
+
+		const id op = inst::arg::opcode(code);
+		if (!opcode::is_bytecode(op))
+			return false;
+
+		switch (op)
+		{
+			case id::NOP:
+				return target(offset + 1);
+
+			case id::MOVE:
+				return reg(a) && reg(b) && target(offset + 1);
+
+			case id::LOAD_K:
+				return reg(a) && inst::arg::bx(code) < chunk.constants_count() && target(offset + 1);
+
+			case id::LOAD_BOOL:
+				return reg(a) && target(offset + (c ? 2 : 1));
+
+			case id::LOAD_NULL:
+				return regs(a, b) && target(offset + 1);
+
+			case id::LOAD_INT:
+			case id::NEW_LIST:
+			case id::SELF:
+			case id::VARARGS:
+			case id::ARG_COUNT:
+				return reg(a) && target(offset + 1);
+
+			case id::GET_GLOBAL:
+			case id::GET_LOCAL:
+			case id::NEW_ARRAY:
+			case id::BNOT:
+			case id::NOT:
+			case id::NEG:
+			case id::LEN:
+				return reg(a) && rkb() && target(offset + 1);
+
+			case id::NEW_OBJECT:
+				return reg(a) && (!c || rkb()) && target(offset + 1);
+
+			case id::SET_GLOBAL:
+			case id::SET_LOCAL:
+				return rkb() && rkc() && target(offset + 1);
+
+			case id::GET_PROP:
+			case id::SET_PROP:
+			case id::ADD:
+			case id::SUB:
+			case id::MUL:
+			case id::DIV:
+			case id::IDIV:
+			case id::MOD:
+			case id::SHL:
+			case id::SHR:
+			case id::BAND:
+			case id::BOR:
+			case id::XOR:
+			case id::IN:
+			case id::INSTANCEOF:
+			case id::GET:
+			case id::SET:
+			case id::RESUME:
+				return reg(a) && rkb() && rkc() && target(offset + 1);
+
+			case id::SET_AL:
+				return reg(a) && regs(b, c) && target(offset + 1);
+
+			case id::EQ:
+			case id::NE:
+			case id::GR:
+			case id::LS:
+			case id::GE:
+			case id::LE:
+				return rkb() && rkc() && target(offset + 2);
+
+			case id::JP:
+				return target(inst::arg::ax(code));
+
+			case id::TEST:
+				return rkb() && target(offset + 2);
+
+			case id::TEST_SET:
+				return reg(a) && rkb() && target(offset + 2);
+
+			case id::CALL:
+				return regs(a, a + std::max(b, c > 1 ? c - 1 : 0)) && target(offset + 1);
+
+			case id::INVOKE:
+				return regs(a, a + c) && rkb() && target(offset + 1);
+
+			case id::RETURN:
+				return !a || rkb();
+
+			case id::YIELD:
+				return reg(a) && rkb() && target(offset + 1);
+
+			case id::FORPREP:
+				return regs(a, a + 3) && target(offset + 1) && target(inst::arg::bx(code) + 1);
+
+			case id::FORLOOP:
+				return regs(a, a + 3) && target(offset + 1) && target(inst::arg::bx(code));
+
+			case id::ITER_PREP:
+				return regs(a, a + 2) && target(inst::arg::bx(code));
+
+			case id::ITER_NEXT:
+				return regs(a, a + 4) && target(offset + 1) && target(inst::arg::bx(code));
+
+			case id::SWITCH:
+				return rkb() && c < chunk.switch_count() && verify_switch(chunk, chunk.switch_table(c));
+
+			case id::THROW:
+				return rkb();
+
+			case id::RETURN_MULTI:
+				return !b || regs(a, a + b - 1);
+
+			case id::VARARG:
+				return (!c || regs(a, a + c - 1)) && target(offset + 1);
+
+			default:
+				return false;
+		}
+	}
+
+	bool verify(Chunk& chunk)
+	{
+		const Size count = chunk.instruction_count();
+		if (count == 0)
+			return false;
+
+		bool handlers = true;
+		for (Offset i = 0; i < chunk.handler_count(); ++i)
+			handlers = handlers && verify_handler(chunk, chunk.handlers()[i]);
+
+		bool verified = true;
+		for (Offset offset = 0; offset < count; ++offset)
+		{
+			if (!handlers || !verify_instruction(chunk, offset))
+			{
+				chunk.set_dispatch_opcode(offset, opcode::id::INVALID);
+				verified = false;
+			}
+		}
+		return verified;
+	}
+}
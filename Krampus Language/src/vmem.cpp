@@ -0,0 +1,132 @@
+#include "vmem.h"
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
+namespace kpl::utils
+{
+	static inline Size round_up(Size size, Size step) { return (size + step - 1) / step * step; }
+
+	Size ReservedBlock::page_size()
+	{
+#ifdef _WIN32
+		static const Size size = [] {
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return static_cast<Size>(info.dwPageSize);
+		}();
+#else
+		static const Size size = static_cast<Size>(sysconf(_SC_PAGESIZE));
+#endif
+		return size;
+	}
+
+	ReservedBlock::ReservedBlock(Size size) :
+		_base{ nullptr },
+		_size{ round_up(size, page_size()) },
+		_committed{ 0 }
+	{
+		const Size reserved = _size + page_size();
+
+#ifdef _WIN32
+		void* base = VirtualAlloc(nullptr, reserved, MEM_RESERVE, PAGE_NOACCESS);
+#else
+		void* base = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (base == MAP_FAILED)
+			base = nullptr;
+#endif
+		if (!base)
+			throw std::bad_alloc();
+
+		_base = reinterpret_cast<Byte*>(base);
+	}
+
+	ReservedBlock::~ReservedBlock()
+	{
+		if (_base)
+		{
+#ifdef _WIN32
+			VirtualFree(_base, 0, MEM_RELEASE);
+#else
+			munmap(_base, _size + page_size());
+#endif
+		}
+
+		_base = nullptr;
+		_size = _committed = 0;
+	}
+
+	bool ReservedBlock::commit(Size bytes)
+	{
+		if (bytes <= _committed)
+			return true;
+		if (bytes > _size)
+			return false;
+
+		const Size target = std::min(round_up(bytes, commit_step), _size);
+
+#ifdef _WIN32
+		if (!VirtualAlloc(_base + _committed, target - _committed, MEM_COMMIT, PAGE_READWRITE))
+			throw std::bad_alloc();
+#else
+		if (mprotect(_base + _committed, target - _committed, PROT_READ | PROT_WRITE) != 0)
+			throw std::bad_alloc();
+#endif
+
+		_committed = target;
+		return true;
+	}
+
+
+
+	ExecutableBlock::ExecutableBlock(Size size) :
+		_base{ nullptr },
+		_size{ round_up(size, ReservedBlock::page_size()) }
+	{
+#ifdef _WIN32
+		void* base = VirtualAlloc(nullptr, _size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void* base = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			base = nullptr;
+#endif
+		if (!base)
+			throw std::bad_alloc();
+
+		_base = reinterpret_cast<Byte*>(base);
+	}
+
+	ExecutableBlock::~ExecutableBlock()
+	{
+		if (_base)
+		{
+#ifdef _WIN32
+			VirtualFree(_base, 0, MEM_RELEASE);
+#else
+			munmap(_base, _size);
+#endif
+		}
+
+		_base = nullptr;
+		_size = 0;
+	}
+
+	void ExecutableBlock::seal()
+	{
+#ifdef _WIN32
+		DWORD old;
+		if (!VirtualProtect(_base, _size, PAGE_EXECUTE_READ, &old))
+			throw std::bad_alloc();
+		FlushInstructionCache(GetCurrentProcess(), _base, _size);
+#else
+		if (mprotect(_base, _size, PROT_READ | PROT_EXEC) != 0)
+			throw std::bad_alloc();
+#endif
+	}
+}
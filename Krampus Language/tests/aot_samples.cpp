@@ -0,0 +1,603 @@
+// Generated by kpl::aot::emit. Do not edit.
+
+#include "aot.h"
+
+static kpl::Offset aot_samples_0(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		default: return start;
+	}
+
+	return 0;
+	return 1;
+}
+
+static kpl::Offset aot_samples_1(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 1: goto i1;
+		case 2: goto i2;
+		case 3: goto i3;
+		case 4: goto i4;
+		case 5: goto i5;
+		case 6: goto i6;
+		case 7: goto i7;
+		case 8: goto i8;
+		case 9: goto i9;
+		case 10: goto i10;
+		case 11: goto i11;
+		case 12: goto i12;
+		case 13: goto i13;
+		case 14: goto i14;
+		case 15: goto i15;
+		case 16: goto i16;
+		default: return start;
+	}
+
+i0:
+{
+	regs[1] = kpl::type::Integer(0);
+}
+i1:
+{
+	regs[2] = kpl::type::Integer(0);
+}
+i2:
+{
+	regs[3] = kpl::Value(std::bit_cast<kpl::type::Float>(0x0ULL));
+}
+i3:
+{
+	regs[4] = kpl::Value(std::bit_cast<kpl::type::Float>(0x3ff8000000000000ULL));
+}
+i4:
+{
+	switch (kpl::aot::ops::ls(regs[1], regs[0])) { case -1: return 4; case 1: goto i6; }
+}
+i5:
+{
+	goto i16;
+}
+i6:
+{
+	if (!kpl::aot::ops::add(regs[2], regs[2], regs[1])) return 6;
+}
+i7:
+{
+	if (!kpl::aot::ops::add(regs[3], regs[3], regs[4])) return 7;
+}
+i8:
+{
+	switch (kpl::aot::ops::gr(regs[1], kpl::Value(kpl::type::Integer(1000LL)))) { case -1: return 8; case 1: goto i10; }
+}
+i9:
+{
+	goto i11;
+}
+i10:
+{
+	if (!kpl::aot::ops::sub(regs[2], regs[2], kpl::Value(kpl::type::Integer(3LL)))) return 10;
+}
+i11:
+{
+	if (!kpl::aot::ops::mul(regs[5], regs[1], regs[1])) return 11;
+}
+i12:
+{
+	if (!kpl::aot::ops::div(regs[6], regs[5], kpl::Value(kpl::type::Integer(7LL)))) return 12;
+}
+i13:
+{
+	if (!kpl::aot::ops::add(regs[3], regs[3], regs[6])) return 13;
+}
+i14:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], kpl::Value(kpl::type::Integer(1LL)))) return 14;
+}
+i15:
+{
+	if (!kpl::aot::ops::spend_fuel(fuel)) return 15;
+	goto i4;
+}
+i16:
+{
+	if (!kpl::aot::ops::add(regs[7], regs[2], regs[3])) return 16;
+}
+	return 17;
+	return 18;
+}
+
+static kpl::Offset aot_samples_2(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 1: goto i1;
+		case 2: goto i2;
+		case 3: goto i3;
+		case 5: goto i5;
+		case 6: goto i6;
+		case 7: goto i7;
+		case 9: goto i9;
+		case 10: goto i10;
+		case 11: goto i11;
+		case 12: goto i12;
+		case 13: goto i13;
+		case 14: goto i14;
+		case 15: goto i15;
+		case 16: goto i16;
+		default: return start;
+	}
+
+i0:
+{
+	regs[1] = kpl::type::Integer(0);
+}
+i1:
+{
+	regs[2] = kpl::type::Integer(1);
+}
+i2:
+{
+	regs[3] = regs[0];
+}
+i3:
+{
+	regs[4] = kpl::type::Integer(1);
+}
+	return 4;
+i5:
+{
+	regs[6] = kpl::type::Integer(1);
+}
+i6:
+{
+	regs[7] = kpl::type::Integer(20);
+}
+i7:
+{
+	regs[8] = kpl::type::Integer(1);
+}
+	return 8;
+i9:
+{
+	if (!kpl::aot::ops::mul(regs[10], regs[5], regs[9])) return 9;
+}
+i10:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[10])) return 10;
+}
+i11:
+{
+	if (regs[10].to_bool() == false) goto i13;
+}
+i12:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], kpl::Value(kpl::type::Integer(1LL)))) return 12;
+}
+i13:
+{
+	switch (kpl::aot::ops::for_loop(&regs[6], fuel, true)) { case -1: return 13; case 1: goto i9; }
+}
+i14:
+{
+	regs[12] = true;
+}
+i15:
+{
+	if (regs[12].to_bool() == false) goto i17;
+}
+i16:
+{
+	switch (kpl::aot::ops::for_loop(&regs[2], fuel, true)) { case -1: return 16; case 1: goto i5; }
+}
+i17:
+	return 17;
+	return 18;
+}
+
+static kpl::Offset aot_samples_3(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 1: goto i1;
+		case 2: goto i2;
+		case 3: goto i3;
+		case 4: goto i4;
+		case 5: goto i5;
+		case 6: goto i6;
+		case 7: goto i7;
+		case 8: goto i8;
+		case 11: goto i11;
+		case 13: goto i13;
+		case 14: goto i14;
+		case 15: goto i15;
+		case 16: goto i16;
+		case 17: goto i17;
+		case 18: goto i18;
+		default: return start;
+	}
+
+i0:
+{
+	regs[1] = kpl::type::Integer(0);
+}
+i1:
+{
+	regs[2] = kpl::type::Integer(0);
+}
+i2:
+{
+	regs[5] = kpl::type::Integer(0);
+}
+i3:
+{
+	switch (kpl::aot::ops::ls(regs[2], regs[0])) { case -1: return 3; case 1: goto i5; }
+}
+i4:
+{
+	goto i18;
+}
+i5:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[2])) return 5;
+}
+i6:
+{
+	regs[5] = regs[2];
+}
+i7:
+{
+	switch (kpl::aot::ops::eq(regs[2], kpl::Value(kpl::type::Integer(97LL)))) { case -1: return 7; case 1: goto i9; }
+}
+i8:
+{
+	goto i16;
+}
+i9:
+	return 9;
+	return 10;
+i11:
+{
+	regs[7] = regs[2];
+}
+	return 12;
+i13:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[6])) return 13;
+}
+i14:
+{
+}
+i15:
+{
+}
+i16:
+{
+	if (!kpl::aot::ops::add(regs[2], regs[2], kpl::Value(kpl::type::Integer(1LL)))) return 16;
+}
+i17:
+{
+	if (!kpl::aot::ops::spend_fuel(fuel)) return 17;
+	goto i3;
+}
+i18:
+{
+	regs[3] = regs[5];
+}
+	return 19;
+	return 20;
+}
+
+static kpl::Offset aot_samples_4(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 1: goto i1;
+		case 2: goto i2;
+		case 3: goto i3;
+		case 4: goto i4;
+		case 6: goto i6;
+		case 7: goto i7;
+		case 8: goto i8;
+		case 9: goto i9;
+		case 10: goto i10;
+		case 11: goto i11;
+		case 12: goto i12;
+		case 13: goto i13;
+		case 14: goto i14;
+		case 15: goto i15;
+		case 16: goto i16;
+		case 17: goto i17;
+		case 18: goto i18;
+		case 19: goto i19;
+		default: return start;
+	}
+
+i0:
+{
+	regs[1] = kpl::type::Integer(0);
+}
+i1:
+{
+	regs[2] = kpl::Value(std::bit_cast<kpl::type::Float>(0x4004000000000000ULL));
+}
+i2:
+{
+	regs[4] = kpl::type::Integer(1);
+}
+i3:
+{
+	regs[5] = regs[0];
+}
+i4:
+{
+	regs[6] = kpl::type::Integer(1);
+}
+	return 5;
+i6:
+{
+	if (!kpl::aot::ops::mul(regs[8], regs[7], regs[7])) return 6;
+}
+i7:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[8])) return 7;
+}
+i8:
+{
+	switch (kpl::aot::ops::gr(regs[7], kpl::Value(kpl::type::Integer(7LL)))) { case -1: return 8; case 1: goto i10; }
+}
+i9:
+{
+	goto i11;
+}
+i10:
+{
+	if (!kpl::aot::ops::sub(regs[1], regs[1], regs[7])) return 10;
+}
+i11:
+{
+	if (!kpl::aot::ops::div(regs[9], regs[8], regs[7])) return 11;
+}
+i12:
+{
+	if (!kpl::aot::ops::add(regs[2], regs[2], regs[9])) return 12;
+}
+i13:
+{
+	switch (kpl::aot::ops::le(regs[9], regs[2])) { case -1: return 13; case 1: goto i15; }
+}
+i14:
+{
+	regs[2] = nullptr;
+}
+i15:
+{
+	switch (kpl::aot::ops::for_loop(&regs[4], fuel, true)) { case -1: return 15; case 1: goto i6; }
+}
+i16:
+{
+	if (regs[1].to_bool() == true) goto i18;
+}
+i17:
+{
+	regs[1] = kpl::type::Integer(-1);
+}
+i18:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[2])) return 18;
+}
+i19:
+{
+	if (!kpl::aot::ops::mul(regs[1], regs[1], kpl::Value(std::bit_cast<kpl::type::Float>(0x3fe0000000000000ULL)))) return 19;
+}
+	return 20;
+	return 21;
+}
+
+static kpl::Offset aot_samples_5(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 2: goto i2;
+		case 3: goto i3;
+		case 4: goto i4;
+		case 6: goto i6;
+		case 7: goto i7;
+		case 8: goto i8;
+		case 9: goto i9;
+		case 10: goto i10;
+		case 11: goto i11;
+		case 12: goto i12;
+		case 13: goto i13;
+		case 14: goto i14;
+		case 15: goto i15;
+		default: return start;
+	}
+
+i0:
+{
+	regs[1] = kpl::type::Integer(0);
+}
+	return 1;
+i2:
+{
+	regs[4] = kpl::type::Integer(0);
+}
+i3:
+{
+	regs[5] = regs[0];
+}
+i4:
+{
+	regs[6] = kpl::type::Integer(1);
+}
+	return 5;
+i6:
+{
+	regs[8] = regs[2];
+}
+i7:
+{
+	regs[8] = kpl::type::Integer(2);
+}
+i8:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[8])) return 8;
+}
+i9:
+{
+	switch (kpl::aot::ops::eq(regs[7], kpl::Value(kpl::type::Integer(3LL)))) { case -1: return 9; case 1: goto i11; }
+}
+i10:
+{
+	goto i12;
+}
+i11:
+{
+	regs[1] = regs[7];
+}
+i12:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], kpl::Value(std::bit_cast<kpl::type::Float>(0x3ff8000000000000ULL)))) return 12;
+}
+i13:
+{
+}
+i14:
+{
+	switch (kpl::aot::ops::for_loop(&regs[4], fuel, true)) { case -1: return 14; case 1: goto i6; }
+}
+i15:
+{
+	if (!kpl::aot::ops::add(regs[1], regs[1], regs[8])) return 15;
+}
+	return 16;
+	return 17;
+}
+
+static kpl::Offset aot_samples_6(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 1: goto i1;
+		case 3: goto i3;
+		case 4: goto i4;
+		case 5: goto i5;
+		case 6: goto i6;
+		default: return start;
+	}
+
+i0:
+{
+	regs[1] = kpl::type::Integer(5);
+}
+i1:
+{
+	switch (kpl::aot::ops::eq(regs[0], kpl::Value(kpl::type::Integer(3LL)))) { case -1: return 1; case 1: goto i3; }
+}
+	return 2;
+i3:
+{
+	if (!kpl::aot::ops::add(regs[2], regs[1], regs[0])) return 3;
+}
+i4:
+{
+	if (regs[0].to_bool() == true) goto i6;
+	regs[3] = regs[0];
+}
+i5:
+{
+	regs[3] = true;
+	goto i7;
+}
+i6:
+{
+	regs[4] = nullptr;
+	regs[5] = nullptr;
+}
+i7:
+	return 7;
+	return 8;
+}
+
+static kpl::Offset aot_samples_7(kpl::Value* regs, kpl::Offset start, kpl::Int64* fuel)
+{
+	(void)regs;
+	(void)fuel;
+	switch (start)
+	{
+		case 0: goto i0;
+		case 1: goto i1;
+		case 2: goto i2;
+		case 3: goto i3;
+		case 4: goto i4;
+		case 5: goto i5;
+		default: return start;
+	}
+
+i0:
+{
+	if (!kpl::aot::ops::mul(regs[1], regs[0], kpl::Value(kpl::type::Integer(2LL)))) return 0;
+}
+i1:
+{
+	if (!kpl::aot::ops::neg(regs[2], regs[1])) return 1;
+}
+i2:
+{
+	if (!kpl::aot::ops::logical_not(regs[3], regs[2])) return 2;
+}
+i3:
+{
+	if (!kpl::aot::ops::idiv(regs[1], regs[1], kpl::Value(kpl::type::Integer(2LL)))) return 3;
+}
+i4:
+{
+	if (!kpl::aot::ops::mod(regs[2], regs[0], kpl::Value(kpl::type::Integer(2LL)))) return 4;
+}
+i5:
+{
+	if (!kpl::aot::ops::band(regs[1], regs[1], regs[2])) return 5;
+}
+	return 6;
+	return 7;
+}
+
+static const kpl::aot::CompiledChunk aot_samples_chunks[] =
+{
+	{ &aot_samples_0, 0xb5baf17bb095fd24ULL },
+	{ &aot_samples_1, 0x2bc14290a81803eeULL },
+	{ &aot_samples_2, 0x7e665594e910c65ULL },
+	{ &aot_samples_3, 0x635b8f1c14fea998ULL },
+	{ &aot_samples_4, 0x908ee7e8eb069cceULL },
+	{ &aot_samples_5, 0xb23b7f0fd45a3fa0ULL },
+	{ &aot_samples_6, 0x682b19aac88e5a64ULL },
+	{ &aot_samples_7, 0x1cd880713967d132ULL },
+};
+
+bool aot_samples(kpl::Chunk& root)
+{
+	return kpl::aot::install(root, aot_samples_chunks, 8);
+}
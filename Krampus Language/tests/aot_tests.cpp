@@ -0,0 +1,264 @@
+#include "test.h"
+#include "aot.h"
+
+// Generated into aot_samples.cpp from the tree build_samples assembles.
+bool aot_samples(kpl::Chunk& root);
+
+// Runs the chunks aot::emit translated to aot_samples.cpp against runtime::execute on the same
+// chunks interpreted, which have to compute bit-identical results, raise the same errors and
+// spend the same fuel.
+namespace kpl::test
+{
+	using namespace kpl::inst;
+
+	// While loop with integer and float carried values and a branch that flips partway through.
+	static Chunk* carried()
+	{
+		Chunk* chunk = new Chunk();
+		chunk->builder().registers(8).constants({ 0.0, 1.5, 1000LL, 3LL, 7LL, 1LL }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_int(2, 0),
+			Instruction::load_k(3, 0),
+			Instruction::load_k(4, 1),
+			Instruction::ls(1, 0),				// 4
+			Instruction::jp(16),
+			Instruction::add(2, 2, 1),
+			Instruction::add(3, 3, 4),
+			Instruction::gr(1, -3),
+			Instruction::jp(11),
+			Instruction::sub(2, 2, -4),
+			Instruction::mul(5, 1, 1),			// 11
+			Instruction::div(6, 5, -5),
+			Instruction::add(3, 3, 6),
+			Instruction::add(1, 1, -6),
+			Instruction::jp(4),
+			Instruction::add(7, 2, 3),			// 16
+			Instruction::return_(true, 7) }).build();
+		return chunk;
+	}
+
+	// Nested numeric loops with TEST and LOAD_BOOL.
+	static Chunk* nested()
+	{
+		Chunk* chunk = new Chunk();
+		chunk->builder().registers(13).constants({ 1LL }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_int(2, 1),
+			Instruction::move(3, 0),
+			Instruction::load_int(4, 1),
+			Instruction::forprep(2, 16),
+			Instruction::load_int(6, 1),		// 5
+			Instruction::load_int(7, 20),
+			Instruction::load_int(8, 1),
+			Instruction::forprep(6, 13),
+			Instruction::mul(10, 5, 9),			// 9
+			Instruction::add(1, 1, 10),
+			Instruction::test(10, 0),
+			Instruction::add(1, 1, -1),
+			Instruction::forloop(6, 9),			// 13
+			Instruction::load_bool(12, 1, 0),
+			Instruction::test(12, 0),
+			Instruction::forloop(2, 5),			// 16
+			Instruction::return_(true, 1) }).build();
+		return chunk;
+	}
+
+	// A register holds a String once in a while, and a call to the global id sits off the hot path.
+	static Chunk* stringly()
+	{
+		Chunk* chunk = new Chunk();
+		chunk->builder().registers(8).constants({ 97LL, "s", 1LL, "id" }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_int(2, 0),
+			Instruction::load_int(5, 0),
+			Instruction::ls(2, 0),				// 3
+			Instruction::jp(18),
+			Instruction::add(1, 1, 2),
+			Instruction::move(5, 2),
+			Instruction::eq(2, -1),
+			Instruction::jp(16),
+			Instruction::load_k(5, 1),
+			Instruction::get_global(6, -4),
+			Instruction::move(7, 2),
+			Instruction::call(6, 1),
+			Instruction::add(1, 1, 6),
+			Instruction::nop(),
+			Instruction::nop(),
+			Instruction::add(2, 2, -3),			// 16
+			Instruction::jp(3),
+			Instruction::move(3, 5),			// 18
+			Instruction::return_(true, 1) }).build();
+		return chunk;
+	}
+
+	// Numeric loop mixing integer and float arithmetic, comparisons and LOAD_NULL.
+	static Chunk* counting()
+	{
+		Chunk* chunk = new Chunk();
+		chunk->builder().registers(12).constants({ 2.5, "s", 7LL, 0.5 }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_k(2, 0),
+			Instruction::load_int(4, 1),
+			Instruction::move(5, 0),
+			Instruction::load_int(6, 1),
+			Instruction::forprep(4, 15),
+			Instruction::mul(8, 7, 7),			// 6
+			Instruction::add(1, 1, 8),
+			Instruction::gr(7, -3),
+			Instruction::jp(11),
+			Instruction::sub(1, 1, 7),
+			Instruction::div(9, 8, 7),			// 11
+			Instruction::add(2, 2, 9),
+			Instruction::le(9, 2),
+			Instruction::load_null(2, 2),
+			Instruction::forloop(4, 6),			// 15
+			Instruction::test(1, 1),
+			Instruction::load_int(1, -1),
+			Instruction::add(1, 1, 2),
+			Instruction::mul(1, 1, -4),
+			Instruction::return_(true, 1) }).build();
+		return chunk;
+	}
+
+	// Strings flow through registers, so the translated code keeps returning to the interpreter.
+	static Chunk* guarded()
+	{
+		Chunk* chunk = new Chunk();
+		chunk->builder().registers(12).constants({ "s", 3LL, 1.5 }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_k(2, 0),
+			Instruction::load_int(4, 0),
+			Instruction::move(5, 0),
+			Instruction::load_int(6, 1),
+			Instruction::forprep(4, 14),
+			Instruction::move(8, 2),			// 6
+			Instruction::load_int(8, 2),
+			Instruction::add(1, 1, 8),
+			Instruction::eq(7, -2),
+			Instruction::jp(12),
+			Instruction::move(1, 7),			// 11
+			Instruction::add(1, 1, -3),			// 12
+			Instruction::nop(),
+			Instruction::forloop(4, 6),			// 14
+			Instruction::add(1, 1, 8),
+			Instruction::return_(true, 1) }).build();
+		return chunk;
+	}
+
+	// Integer and logical operators whose errors come from the interpreter, in a nested chunk.
+	static Chunk* operators()
+	{
+		Chunk* child = new Chunk();
+		child->builder().registers(4).constants({ 2LL }).instructions({
+			Instruction::mul(1, 0, -1),
+			Instruction::neg(2, 1),
+			Instruction::not_(3, 2),
+			Instruction::idiv(1, 1, -1),
+			Instruction::mod(2, 0, -1),
+			Instruction::band(1, 1, 2),
+			Instruction::return_(true, 1) }).build();
+
+		Chunk* chunk = new Chunk();
+		chunk->builder().registers(6).chunks({ child }).constants({ "s", 3LL }).instructions({
+			Instruction::load_int(1, 5),
+			Instruction::eq(0, -2),
+			Instruction::load_k(1, 0),			// 2
+			Instruction::add(2, 1, 0),			// 3
+			Instruction::test_set(3, 0, 1),
+			Instruction::load_bool(3, 1, 1),
+			Instruction::load_null(4, 5),
+			Instruction::return_(true, 2) }).build();
+		return chunk;
+	}
+
+	// Every sample is a chunk nested in root, so aot::emit translates them to a single file.
+	static void build_samples(Chunk& root)
+	{
+		root.builder().registers(1).chunks({ carried(), nested(), stringly(), counting(), guarded(), operators() }).instructions({
+			Instruction::return_(false, 0) }).build();
+	}
+
+	void emit_aot_samples(std::ostream& out)
+	{
+		Chunk root;
+		build_samples(root);
+		aot::emit(out, root, "aot_samples");
+	}
+
+	// Every chunk of the tree at root, in the order aot::emit translates them.
+	static void collect(Chunk& root, std::vector<Chunk*>& chunks)
+	{
+		chunks.push_back(&root);
+		for (Offset i = 0; i < root.chunk_count(); ++i)
+			collect(*root.chunk(i), chunks);
+	}
+
+	void aot_tests()
+	{
+		Chunk identity_chunk;
+		identity_chunk.builder().registers(1).instructions({ Instruction::return_(true, 0) }).build();
+		type::Function identity{ identity_chunk };
+
+		KPLState translated_state, interpreted_state;
+		for (KPLState* state : { &translated_state, &interpreted_state })
+		{
+			state->set_jit_enabled(false);
+			state->globals().set_value("id", Value(&identity));
+		}
+
+		Chunk translated, interpreted;
+		build_samples(translated);
+		build_samples(interpreted);
+
+		// A stale aot_samples.cpp installs nothing. Regenerate it with: tests --emit-aot aot_samples.cpp
+		KPL_CHECK(aot_samples(translated));
+
+		std::vector<Chunk*> translated_chunks, interpreted_chunks;
+		collect(translated, translated_chunks);
+		collect(interpreted, interpreted_chunks);
+		for (Size i = 0; i < translated_chunks.size(); ++i)
+		{
+			KPL_CHECK(translated_chunks[i]->native_code() && translated_chunks[i]->native_code()->ahead_of_time());
+			KPL_CHECK(interpreted_chunks[i]->native_code() == nullptr);
+		}
+
+		const Value args[] = {
+			Value(3LL), Value(5000LL), Value(0LL), Value(7LL), Value(150LL), Value(-2LL),
+			Value(500.0), Value(2.5), Value(true), type::literal::Null,
+			Value(std::numeric_limits<Int64>::max()), Value(std::numeric_limits<Int64>::min()), Value(std::numeric_limits<Int64>::min() / 2) };
+
+		for (Size i = 1; i < translated_chunks.size(); ++i)
+		{
+			type::Function translated_function{ *translated_chunks[i] };
+			type::Function interpreted_function{ *interpreted_chunks[i] };
+
+			for (const Value& arg : args)
+			{
+				// Loops bounded by anything but a small enough number only stop when the fuel runs out.
+				const bool bounded = arg.isFloat() || (arg.isInteger() && arg.integral() < 1000000);
+				for (Int64 fuel : { KPLState::unlimited_fuel, Int64(1000), Int64(37), Int64(0) })
+				{
+					if (!bounded && fuel == KPLState::unlimited_fuel)
+						continue;
+
+					translated_state.set_fuel(fuel);
+					interpreted_state.set_fuel(fuel);
+					KPL_CHECK_IDENTICAL(run(translated_state, translated_function, { arg }), run(interpreted_state, interpreted_function, { arg }));
+				}
+			}
+			translated_state.set_fuel(KPLState::unlimited_fuel);
+			interpreted_state.set_fuel(KPLState::unlimited_fuel);
+
+			for (Int64 slice : { 1LL, 37LL, 1000LL })
+				KPL_CHECK_IDENTICAL(preemptions(translated_state, translated_function, Value(3000LL), slice),
+					preemptions(interpreted_state, interpreted_function, Value(3000LL), slice));
+		}
+
+		// A tree that changed since it was emitted is refused as a whole.
+		Chunk changed;
+		changed.builder().registers(1).chunks({ nested(), carried(), stringly(), counting(), guarded(), operators() }).instructions({
+			Instruction::return_(false, 0) }).build();
+		KPL_CHECK(!aot_samples(changed));
+		KPL_CHECK(changed.native_code() == nullptr && changed.chunk(0)->native_code() == nullptr);
+	}
+}
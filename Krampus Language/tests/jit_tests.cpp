@@ -0,0 +1,174 @@
+#include "test.h"
+#include "jit.h"
+
+// Runs the same chunks on a state with the JIT and on one without it, which has to compute the
+// same results, raise the same errors and spend fuel at the same instructions.
+namespace kpl::test
+{
+	using namespace kpl::inst;
+
+	// Numeric loop mixing integer and float arithmetic, with a branch taken on some iterations.
+	static void counting(Chunk& chunk)
+	{
+		chunk.builder().registers(12).constants({ 2.5, "s", 7LL, 0.5 }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_k(2, 0),
+			Instruction::load_int(4, 1),
+			Instruction::move(5, 0),
+			Instruction::load_int(6, 1),
+			Instruction::forprep(4, 15),
+			Instruction::mul(8, 7, 7),			// 6
+			Instruction::add(1, 1, 8),
+			Instruction::gr(7, -3),
+			Instruction::jp(11),
+			Instruction::sub(1, 1, 7),
+			Instruction::div(9, 8, 7),			// 11
+			Instruction::add(2, 2, 9),
+			Instruction::le(9, 2),
+			Instruction::load_null(2, 2),
+			Instruction::forloop(4, 6),			// 15
+			Instruction::test(1, 1),
+			Instruction::load_int(1, -1),
+			Instruction::add(1, 1, 2),
+			Instruction::mul(1, 1, -4),
+			Instruction::return_(true, 1) }).build();
+	}
+
+	// Strings flow through registers the templates guard, so they keep leaving to the interpreter.
+	static void guarded(Chunk& chunk)
+	{
+		chunk.builder().registers(12).constants({ "s", 3LL, 1.5 }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_k(2, 0),
+			Instruction::load_int(4, 0),
+			Instruction::move(5, 0),
+			Instruction::load_int(6, 1),
+			Instruction::forprep(4, 14),
+			Instruction::move(8, 2),			// 6
+			Instruction::load_int(8, 2),
+			Instruction::add(1, 1, 8),
+			Instruction::eq(7, -2),
+			Instruction::jp(12),
+			Instruction::move(1, 7),			// 11
+			Instruction::add(1, 1, -3),			// 12
+			Instruction::nop(),
+			Instruction::forloop(4, 6),			// 14
+			Instruction::add(1, 1, 8),
+			Instruction::return_(true, 1) }).build();
+	}
+
+	// While loop whose integer state overflows on every iteration, through each operand kind.
+	static void wrapping(Chunk& chunk)
+	{
+		chunk.builder().registers(6).constants({ 6364136223846793005LL, 1442695040888963407LL, 1LL }).instructions({
+			Instruction::load_int(1, 1),
+			Instruction::load_int(2, 0),
+			Instruction::load_int(4, 0),
+			Instruction::ls(2, 0),				// 3
+			Instruction::jp(11),
+			Instruction::mul(1, 1, -1),
+			Instruction::add(1, -2, 1),
+			Instruction::mul(3, 1, 1),
+			Instruction::add(4, 4, 3),
+			Instruction::add(2, 2, -3),
+			Instruction::jp(3),
+			Instruction::add(5, 4, 1),			// 11
+			Instruction::return_(true, 5) }).build();
+	}
+
+	// Additions and multiplications at the ends of the integer range.
+	static void overflowing(Chunk& chunk)
+	{
+		chunk.builder().registers(4).constants({ std::numeric_limits<Int64>::max(), -1LL }).instructions({
+			Instruction::add(1, 0, -1),
+			Instruction::mul(2, 0, 0),
+			Instruction::add(3, -1, 2),
+			Instruction::mul(1, 1, -2),
+			Instruction::add(1, 1, 3),
+			Instruction::return_(true, 1) }).build();
+	}
+
+	static void check_compiled(const Chunk& chunk)
+	{
+#if KPL_JIT
+		KPL_CHECK(chunk.native_code() != nullptr);
+#else
+		KPL_CHECK(chunk.native_code() == nullptr);
+#endif
+	}
+
+	static void numeric_loops()
+	{
+		Twin twin{ counting };
+		twin.compare_hot({ Value(0LL), Value(1LL), Value(17LL), Value(40LL), Value(-3LL) });
+		check_compiled(twin.jitted);
+		KPL_CHECK(twin.interpreted.native_code() == nullptr);
+
+		// A float count makes FORPREP pick FORLOOP_FLOAT, which runs in the interpreter.
+		twin.compare(Value(5.0));
+		twin.compare(Value(0.5));
+		twin.compare(Value(12.75));
+	}
+
+	static void guard_exits()
+	{
+		Twin twin{ guarded };
+		twin.compare_hot({ Value(0LL), Value(3LL), Value(9LL) });
+		check_compiled(twin.jitted);
+
+		// Operands the templates do not handle leave to the interpreter before changing anything,
+		// so errors are raised by the instruction that failed.
+		Twin loop{ counting };
+		loop.compare_hot({ Value(4LL), Value(11LL) });
+		for (const Value& arg : { Value(true), type::literal::Null, Value(2.5) })
+			loop.compare(arg);
+	}
+
+	static void integer_wraparound()
+	{
+		Twin loop{ wrapping };
+		loop.compare_hot({ Value(0LL), Value(1LL), Value(17LL), Value(300LL) });
+		check_compiled(loop.jitted);
+
+		Twin straight{ overflowing };
+		straight.compare_hot({
+			Value(std::numeric_limits<Int64>::max()),
+			Value(std::numeric_limits<Int64>::min()),
+			Value(3037000500LL),
+			Value(-3037000500LL),
+			Value(1LL),
+			Value(2.5),
+			Value(false) });
+		check_compiled(straight.jitted);
+	}
+
+	static void fuel()
+	{
+		// Compiled code spends fuel at the backward jumps the interpreter does, so both run out and
+		// get preempted after the same instructions.
+		for (void (*build)(Chunk&) : { counting, wrapping })
+		{
+			Twin twin{ build };
+			twin.compare_hot({ Value(1LL), Value(20LL) });
+			check_compiled(twin.jitted);
+
+			for (Int64 slice : { 1LL, 37LL, 100LL })
+				twin.compare_preemptions(Value(500LL), slice);
+			for (Int64 fuel : { 0LL, 1LL, 100LL, 1000LL })
+				twin.compare_fuel(Value(1000LL), fuel);
+
+			// Turning the JIT off drops the code on the next call.
+			twin.with_jit.set_jit_enabled(false);
+			twin.compare(Value(30LL));
+			KPL_CHECK(twin.jitted.native_code() == nullptr);
+		}
+	}
+
+	void jit_tests()
+	{
+		numeric_loops();
+		guard_exits();
+		integer_wraparound();
+		fuel();
+	}
+}
@@ -0,0 +1,62 @@
+#include "test.h"
+
+// Loops going through a List with step while it is reordered or assigned to, which have to
+// see the list as it is after the change and never an element of another list.
+namespace kpl::test
+{
+	static void fill(type::List& list, std::initializer_list<Int64> values)
+	{
+		for (Int64 value : values)
+			list.push_back(Value(value));
+	}
+
+	static const Value* element(type::List& list, Size index) { return &*std::next(list.begin(), index); }
+
+	static void reordered()
+	{
+		type::List list;
+		fill(list, { 3, 1, 2 });
+		KPL_CHECK(list.step(0)->integral() == 3);
+		KPL_CHECK(list.step(1)->integral() == 1);
+
+		list.sort([](const Value& left, const Value& right) { return left.integral() < right.integral(); });
+		KPL_CHECK(list.step(2) == element(list, 2));
+		KPL_CHECK(list.step(0) == element(list, 0) && list.step(1) == element(list, 1));
+
+		list.reverse();
+		KPL_CHECK(list.step(2) == element(list, 2) && element(list, 2)->integral() == 1);
+		KPL_CHECK(list.step(3) == nullptr);
+	}
+
+	static void assigned()
+	{
+		type::List list, copied, moved;
+		fill(list, { 1, 2, 3, 4 });
+		fill(copied, { 5, 6, 7 });
+		fill(moved, { 8, 9 });
+
+		list.step(0);
+		list.step(1);
+		copied.step(0);
+		copied.step(1);
+
+		list = copied;
+		KPL_CHECK(list.size() == 3);
+		KPL_CHECK(list.step(2) == element(list, 2) && element(list, 2)->integral() == 7);
+		KPL_CHECK(copied.step(2) == element(copied, 2));
+
+		list.step(0);
+		moved.step(0);
+
+		list = std::move(moved);
+		KPL_CHECK(list.size() == 2);
+		KPL_CHECK(list.step(1) == element(list, 1) && element(list, 1)->integral() == 9);
+		KPL_CHECK(moved.step(0) == nullptr);
+	}
+
+	void list_tests()
+	{
+		reordered();
+		assigned();
+	}
+}
@@ -0,0 +1,24 @@
+#include "test.h"
+
+#include <fstream>
+
+// Runs every suite. tests --emit-aot <file> writes the source of aot_samples.cpp to file instead.
+int main(int argc, char** argv)
+{
+	if (argc == 3 && std::string(argv[1]) == "--emit-aot")
+	{
+		std::ofstream out(argv[2]);
+		kpl::test::emit_aot_samples(out);
+		return out ? 0 : 1;
+	}
+
+	kpl::test::list_tests();
+	kpl::test::verifier_tests();
+	kpl::test::jit_tests();
+	kpl::test::trace_tests();
+	kpl::test::aot_tests();
+
+	const int failures = kpl::test::failures();
+	std::cout << (failures ? std::to_string(failures) + " checks failed" : "All checks passed") << std::endl;
+	return failures ? 1 : 0;
+}
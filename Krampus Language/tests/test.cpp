@@ -0,0 +1,153 @@
+#include "test.h"
+#include "jit.h"
+
+#include <bit>
+
+namespace kpl::test
+{
+	static int failed_checks = 0;
+
+	Outcome run(KPLState& state, type::Function& function, const CallArguments& args)
+	{
+		Outcome outcome{};
+		try
+		{
+			outcome.result = runtime::execute(state, function, type::literal::Null, args);
+		}
+		catch (const runtime::OutOfFuel& error) { outcome.error = error.what(); }
+		catch (const runtime::ScriptError& error) { outcome.error = "ScriptError " + error.value().to_string(); }
+		catch (const BadValueOperation& error) { outcome.error = std::string("BadValueOperation ") + error.what(); }
+		outcome.fuel = state.fuel();
+		return outcome;
+	}
+
+	std::vector<Outcome> preemptions(KPLState& state, type::Function& function, const Value& arg, Int64 slice)
+	{
+		std::vector<Outcome> outcomes;
+		runtime::Coroutine coroutine{ function };
+		Value value = arg;
+		for (;;)
+		{
+			Outcome outcome{};
+			state.set_fuel(slice);
+			try
+			{
+				outcome.result = coroutine.resume(state, value);
+			}
+			catch (const runtime::ScriptError& error) { outcome.error = "ScriptError " + error.value().to_string(); }
+			catch (const BadValueOperation& error) { outcome.error = std::string("BadValueOperation ") + error.what(); }
+			outcome.fuel = state.fuel();
+			outcomes.push_back(outcome);
+
+			if (!coroutine.preempted())
+				break;
+			value = type::literal::Null;
+		}
+		state.set_fuel(KPLState::unlimited_fuel);
+		return outcomes;
+	}
+
+	bool identical(const Value& left, const Value& right)
+	{
+		if (left.type() != right.type())
+			return false;
+
+		switch (left.type())
+		{
+			case DataType::Null: return true;
+			case DataType::Integer: return left.integral() == right.integral();
+			case DataType::Float: return std::bit_cast<UInt64>(left.floating()) == std::bit_cast<UInt64>(right.floating());
+			case DataType::Boolean: return left.boolean() == right.boolean();
+			default: return left.to_string() == right.to_string();
+		}
+	}
+
+	bool identical(const Outcome& left, const Outcome& right)
+	{
+		return identical(left.result, right.result) && left.error == right.error && left.fuel == right.fuel;
+	}
+
+	bool identical(const std::vector<Outcome>& left, const std::vector<Outcome>& right)
+	{
+		return std::equal(left.begin(), left.end(), right.begin(), right.end(),
+			[](const Outcome& a, const Outcome& b) { return identical(a, b); });
+	}
+
+	std::string describe(const Value& value)
+	{
+		std::ostringstream out;
+		out << value.to_string();
+		if (value.isFloat())
+			out << " (0x" << std::hex << std::bit_cast<UInt64>(value.floating()) << ")";
+		return out.str();
+	}
+
+	std::string describe(const Outcome& outcome)
+	{
+		return (outcome.error.empty() ? describe(outcome.result) : outcome.error) + " [fuel " + std::to_string(outcome.fuel) + "]";
+	}
+
+	std::string describe(const std::vector<Outcome>& outcomes)
+	{
+		std::string text;
+		for (const Outcome& outcome : outcomes)
+			text += (text.empty() ? "" : ", ") + describe(outcome);
+		return "{ " + text + " }";
+	}
+
+	void check(bool passed, const std::string& what, const char* file, int line)
+	{
+		if (passed)
+			return;
+
+		++failed_checks;
+		std::cerr << file << "(" << line << "): check failed: " << what << std::endl;
+	}
+
+	int failures() { return failed_checks; }
+
+
+
+	static inline Chunk& built(Chunk& chunk, void (*build)(Chunk&)) { return build(chunk), chunk; }
+
+	Twin::Twin(void (*build)(Chunk&)) :
+		with_jit{},
+		without_jit{},
+		jitted{},
+		interpreted{},
+		_jitted_function{ built(jitted, build) },
+		_interpreted_function{ built(interpreted, build) }
+	{
+		without_jit.set_jit_enabled(false);
+	}
+
+	bool Twin::compare(const Value& arg)
+	{
+		const Outcome left = run(with_jit, _jitted_function, { arg });
+		const Outcome right = run(without_jit, _interpreted_function, { arg });
+		KPL_CHECK_IDENTICAL(left, right);
+		return identical(left, right);
+	}
+
+	void Twin::compare_hot(std::initializer_list<Value> args)
+	{
+		for (UInt32 calls = 0; calls < 2 * jit::call_threshold;)
+			for (const Value& arg : args)
+				if (++calls, !compare(arg))
+					return;
+	}
+
+	void Twin::compare_fuel(const Value& arg, Int64 fuel)
+	{
+		with_jit.set_fuel(fuel);
+		without_jit.set_fuel(fuel);
+		compare(arg);
+		with_jit.set_fuel(KPLState::unlimited_fuel);
+		without_jit.set_fuel(KPLState::unlimited_fuel);
+	}
+
+	void Twin::compare_preemptions(const Value& arg, Int64 slice)
+	{
+		KPL_CHECK_IDENTICAL(preemptions(with_jit, _jitted_function, arg, slice), preemptions(without_jit, _interpreted_function, arg, slice));
+	}
+}
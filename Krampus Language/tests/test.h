@@ -0,0 +1,94 @@
+#pragma once
+
+#include "kplstate.h"
+#include "chunk.h"
+#include "runtime.h"
+
+
+// Checks shared by the test suites. A suite is a function running its checks on its own states
+// and chunks; main runs every suite and fails if any check did.
+namespace kpl::test
+{
+	// What a call left behind: its result, or the error that stopped it, and the fuel left.
+	struct Outcome
+	{
+		Value result;
+		std::string error;
+		Int64 fuel;
+	};
+
+	// Calls function on state, catching what a script can raise.
+	Outcome run(KPLState& state, type::Function& function, const CallArguments& args = CallArguments());
+
+	// Runs function as a coroutine passed arg, giving it slice fuel every time it is resumed until
+	// it finishes. Lists the fuel left at every preemption followed by the outcome of the last resume.
+	std::vector<Outcome> preemptions(KPLState& state, type::Function& function, const Value& arg, Int64 slice);
+
+	// Whether left and right have the same type and, for numbers, the same bits.
+	bool identical(const Value& left, const Value& right);
+	bool identical(const Outcome& left, const Outcome& right);
+	bool identical(const std::vector<Outcome>& left, const std::vector<Outcome>& right);
+
+	std::string describe(const Value& value);
+	std::string describe(const Outcome& outcome);
+	std::string describe(const std::vector<Outcome>& outcomes);
+
+	void check(bool passed, const std::string& what, const char* file, int line);
+
+	template<typename _Ty>
+	inline void check_identical(const _Ty& left, const _Ty& right, const char* what, const char* file, int line)
+	{
+		check(identical(left, right), std::string(what) + ": " + describe(left) + " vs " + describe(right), file, line);
+	}
+
+	// Checks failed so far.
+	int failures();
+
+
+
+	// The same chunk built twice and run on two states, one with the JIT and one without it,
+	// which have to compute the same results, raise the same errors and spend the same fuel.
+	class Twin
+	{
+	public:
+		KPLState with_jit;
+		KPLState without_jit;
+
+		Chunk jitted;
+		Chunk interpreted;
+
+	private:
+		type::Function _jitted_function;
+		type::Function _interpreted_function;
+
+	public:
+		explicit Twin(void (*build)(Chunk&));
+
+		// Calls both chunks with arg and checks they did the same. Returns false if they did not.
+		bool compare(const Value& arg);
+
+		// Calls both chunks with every arg in turn until the first has been called often enough
+		// to be compiled, and as often again after that.
+		void compare_hot(std::initializer_list<Value> args);
+
+		// Calls both chunks with arg on fuel.
+		void compare_fuel(const Value& arg, Int64 fuel);
+
+		// Runs both chunks as coroutines passed arg, resumed with slice fuel at a time.
+		void compare_preemptions(const Value& arg, Int64 slice);
+	};
+
+
+
+	void list_tests();
+	void verifier_tests();
+	void jit_tests();
+	void trace_tests();
+	void aot_tests();
+
+	// Writes the C++ aot_tests expects in aot_samples.cpp to out.
+	void emit_aot_samples(std::ostream& out);
+}
+
+#define KPL_CHECK(_Expr) ::kpl::test::check((_Expr), #_Expr, __FILE__, __LINE__)
+#define KPL_CHECK_IDENTICAL(_Left, _Right) ::kpl::test::check_identical((_Left), (_Right), #_Left " == " #_Right, __FILE__, __LINE__)
@@ -0,0 +1,202 @@
+#include "test.h"
+#include "jit.h"
+
+// Runs loops hot enough to be traced, but in chunks called too few times to be compiled whole,
+// on a state with the JIT and on one without it. Traces have to leave the loop with every
+// unboxed register written back whenever a guard fails, wherever in the iteration that is.
+namespace kpl::test
+{
+	using namespace kpl::inst;
+
+	// While loop carrying an integer and a float, with a branch that flips partway through.
+	static void carried(Chunk& chunk)
+	{
+		chunk.builder().registers(8).constants({ 0.0, 1.5, 1000LL, 3LL, 7LL, 1LL }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_int(2, 0),
+			Instruction::load_k(3, 0),
+			Instruction::load_k(4, 1),
+			Instruction::ls(1, 0),				// 4
+			Instruction::jp(16),
+			Instruction::add(2, 2, 1),
+			Instruction::add(3, 3, 4),
+			Instruction::gr(1, -3),
+			Instruction::jp(11),
+			Instruction::sub(2, 2, -4),
+			Instruction::mul(5, 1, 1),			// 11
+			Instruction::div(6, 5, -5),
+			Instruction::add(3, 3, 6),
+			Instruction::add(1, 1, -6),
+			Instruction::jp(4),
+			Instruction::add(7, 2, 3),			// 16
+			Instruction::return_(true, 7) }).build();
+	}
+
+	// An integer accumulator turns into a Float at iteration 3000, after the loop was traced with
+	// it an Integer. The branch guard and then the type guard of the next addition fail in the
+	// middle of the iteration, after the sum was updated in its unboxed register.
+	static void retyped(Chunk& chunk)
+	{
+		chunk.builder().registers(6).constants({ 1LL, 0.5, 3000LL }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_int(2, 0),
+			Instruction::load_int(3, 0),
+			Instruction::ls(1, 0),				// 3
+			Instruction::jp(13),
+			Instruction::add(3, 3, 1),
+			Instruction::eq(1, -3),
+			Instruction::jp(9),
+			Instruction::add(2, 2, -2),
+			Instruction::add(2, 2, 1),			// 9
+			Instruction::mul(4, 3, 3),
+			Instruction::add(1, 1, -1),
+			Instruction::jp(3),
+			Instruction::add(5, 2, 3),			// 13
+			Instruction::return_(true, 5) }).build();
+	}
+
+	// A register holds a String once in a while, and a call sits off the hot path.
+	static void stringly(Chunk& chunk)
+	{
+		chunk.builder().registers(8).constants({ 97LL, "s", 1LL, "id" }).instructions({
+			Instruction::load_int(1, 0),
+			Instruction::load_int(2, 0),
+			Instruction::load_int(5, 0),
+			Instruction::ls(2, 0),				// 3
+			Instruction::jp(18),
+			Instruction::add(1, 1, 2),
+			Instruction::move(5, 2),
+			Instruction::eq(2, -1),
+			Instruction::jp(16),
+			Instruction::load_k(5, 1),
+			Instruction::get_global(6, -4),
+			Instruction::move(7, 2),
+			Instruction::call(6, 1),
+			Instruction::add(1, 1, 6),
+			Instruction::nop(),
+			Instruction::nop(),
+			Instruction::add(2, 2, -3),			// 16
+			Instruction::jp(3),
+			Instruction::move(3, 5),			// 18
+			Instruction::return_(true, 1) }).build();
+	}
+
+	// Numeric loop running five short numeric loops one after the other, more loops than
+	// jit::max_loops. The backward jumps of all of them count towards the next recording.
+	static constexpr Offset nested_heads[] = { 9, 15, 21, 27, 33 };
+	static void nested(Chunk& chunk)
+	{
+		InstructionList code;
+		code << Instruction::load_int(1, 0)
+			<< Instruction::load_int(2, 1)
+			<< Instruction::move(3, 0)
+			<< Instruction::load_int(4, 1)
+			<< Instruction::forprep(2, 35);
+		for (int loop = 0; loop < 5; ++loop)
+		{
+			const int first = 5 + 6 * loop;
+			code << Instruction::load_int(6, 1)
+				<< Instruction::load_int(7, 6 + loop)
+				<< Instruction::load_int(8, 1)
+				<< Instruction::forprep(6, first + 5)
+				<< Instruction::add(1, 1, 9)
+				<< Instruction::forloop(6, first + 4);
+		}
+		code << Instruction::forloop(2, 5)
+			<< Instruction::return_(true, 1);
+
+		chunk.builder().registers(10).instructions(code).build();
+	}
+
+	// Calls both chunks with each arg, few enough times for the chunk not to be compiled.
+	static void compare_all(Twin& twin, std::initializer_list<Value> args)
+	{
+		for (const Value& arg : args)
+			twin.compare(arg);
+		KPL_CHECK(twin.jitted.native_code() == nullptr);
+		KPL_CHECK(twin.interpreted.loop_traces() == nullptr);
+	}
+
+	static void check_traced(const Chunk& chunk, Offset head)
+	{
+#if KPL_JIT
+		KPL_CHECK(chunk.loop_traces() && chunk.loop_traces()->find(head));
+#else
+		KPL_CHECK(!chunk.loop_traces() || !chunk.loop_traces()->find(head));
+#endif
+	}
+
+	static void carried_values()
+	{
+		Twin twin{ carried };
+		compare_all(twin, { Value(3LL), Value(5000LL), Value(0LL), Value(7LL), Value(20000LL), Value(150LL) });
+		check_traced(twin.jitted, 4);
+
+		// The entry guards fail on a Float bound.
+		twin.compare(Value(500.0));
+	}
+
+	static void type_changes()
+	{
+		Twin twin{ retyped };
+		compare_all(twin, { Value(2500LL), Value(2999LL), Value(3000LL), Value(3001LL), Value(10000LL) });
+		check_traced(twin.jitted, 3);
+		compare_all(twin, { Value(10000LL), Value(4000.0), Value(100LL) });
+
+		Chunk identity_chunk;
+		identity_chunk.builder().registers(1).instructions({ Instruction::return_(true, 0) }).build();
+		type::Function identity{ identity_chunk };
+
+		Twin strings{ stringly };
+		strings.with_jit.globals().set_value("id", Value(&identity));
+		strings.without_jit.globals().set_value("id", Value(&identity));
+		compare_all(strings, { Value(3LL), Value(5000LL), Value(0LL), Value(97LL), Value(20000LL), Value(150LL) });
+		check_traced(strings.jitted, 3);
+	}
+
+	static void loop_policy()
+	{
+		// A loop that gets hot again after it was recorded gives the others a turn after
+		// jit::loop_retry backward jumps, until jit::max_loops of them were recorded.
+		Twin twin{ nested };
+		compare_all(twin, { Value(2000LL), Value(3000LL), Value(1LL) });
+
+		const jit::LoopTraces* traces = twin.jitted.loop_traces();
+		KPL_CHECK(!traces || traces->recorded_count() <= jit::max_loops);
+#if KPL_JIT
+		KPL_CHECK(traces && traces->recorded_count() == jit::max_loops);
+		KPL_CHECK(traces && std::count_if(std::begin(nested_heads), std::end(nested_heads),
+			[traces](Offset head) { return traces->recorded(head) && traces->find(head); }) == jit::max_loops);
+#endif
+
+		compare_all(twin, { Value(5000LL) });
+		KPL_CHECK(!traces || traces->recorded_count() <= jit::max_loops);
+	}
+
+	static void fuel()
+	{
+		// Traces spend fuel at every iteration like the backward jump they replace.
+		for (void (*build)(Chunk&) : { carried, retyped, nested })
+		{
+			Twin twin{ build };
+			twin.compare(Value(5000LL));
+			for (Int64 slice : { 37LL, 41LL, 1000LL })
+				twin.compare_preemptions(Value(4000LL), slice);
+			for (Int64 fuel : { 0LL, 1000LL, 2999LL })
+				twin.compare_fuel(Value(100000LL), fuel);
+
+			// Turning the JIT off drops the traces on the next call.
+			twin.with_jit.set_jit_enabled(false);
+			twin.compare(Value(300LL));
+			KPL_CHECK(twin.jitted.loop_traces() == nullptr);
+		}
+	}
+
+	void trace_tests()
+	{
+		carried_values();
+		type_changes();
+		loop_policy();
+		fuel();
+	}
+}
@@ -0,0 +1,46 @@
+#include "test.h"
+#include "jit.h"
+
+// Chunks the verifier rejects, which have to raise an error whenever they run instead of
+// reading past the code they were built with.
+namespace kpl::test
+{
+	using namespace kpl::inst;
+
+	// What run reports for the error INVALID raises.
+	static std::string invalid_instruction() { return std::string("BadValueOperation ") + BadValueOperation("Invalid instruction").what(); }
+
+	static void empty_chunk()
+	{
+		Chunk chunk;
+		chunk.builder().registers(1).build();
+		KPL_CHECK(!chunk.is_verified());
+		KPL_CHECK(chunk.instruction_count() == 1);
+
+		// Called often enough to be compiled, which a chunk that failed verification never is.
+		KPLState state;
+		type::Function function{ chunk };
+		for (UInt32 calls = 0; calls <= jit::call_threshold; ++calls)
+			KPL_CHECK(run(state, function).error == invalid_instruction());
+		KPL_CHECK(chunk.native_code() == nullptr);
+	}
+
+	static void falling_off()
+	{
+		Chunk chunk;
+		chunk.builder().registers(2).instructions({
+			Instruction::load_int(1, 3),
+			Instruction::nop() }).build();
+		KPL_CHECK(!chunk.is_verified());
+
+		KPLState state;
+		type::Function function{ chunk };
+		KPL_CHECK(run(state, function).error == invalid_instruction());
+	}
+
+	void verifier_tests()
+	{
+		empty_chunk();
+		falling_off();
+	}
+}